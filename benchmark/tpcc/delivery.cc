@@ -179,6 +179,10 @@ void DeliveryTxn::Run()
       static auto constexpr DeleteNewOrder = [](auto state, auto index_handle, int i) -> void {
         index_handle(state->new_orders[i]).Delete();
         ClientBase::OnUpdateRow(state->new_orders[i]);
+        // Later Delivery txns scan from a larger order id, and nothing else
+        // looks up the new orders, so the row can leave the index. Not before
+        // the checkpoint of this epoch is done with it, though.
+        util::Instance<TableManager>().Get<NewOrder>().QueueDelete(state->new_orders[i]);
       };
 
       static auto constexpr UpdateOOrder = [](auto state, auto index_handle, int i, uint carrier_id) -> void {
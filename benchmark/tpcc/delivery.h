@@ -75,6 +75,7 @@ class DeliveryTxn : public Txn<DeliveryState>, public DeliveryStruct {
   DeliveryTxn(Client *client, uint64_t serial_id);
 
   void Run() override final;
+  int txn_type_id() const override final { return int(TxnType::Delivery); }
   void Prepare() override final;
   void PrepareInsert() override final;
 };
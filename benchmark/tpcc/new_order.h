@@ -115,6 +115,7 @@ class NewOrderTxn : public Txn<NewOrderState>, public NewOrderStruct {
   NewOrderTxn(Client *client, uint64_t serial_id, char* &input);
 
   void Run() override final;
+  int txn_type_id() const override final { return int(TxnType::NewOrder); }
   void Prepare() override final;
   void PrepareInsert() override final;
 };
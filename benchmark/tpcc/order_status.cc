@@ -13,8 +13,12 @@ OrderStatusStruct ClientBase::GenerateTransactionInput<OrderStatusStruct>()
 }
 
 OrderStatusTxn::OrderStatusTxn(Client *client, uint64_t serial_id)
-    : Txn<OrderStatusState>(serial_id),
-      OrderStatusStruct(client->GenerateTransactionInput<OrderStatusStruct>()),
+    : OrderStatusTxn(client, serial_id, client->GenerateTransactionInput<OrderStatusStruct>())
+{}
+
+OrderStatusTxn::OrderStatusTxn(Client *client, uint64_t serial_id, const OrderStatusStruct &input)
+    : SnapshotTxn<OrderStatusState>(serial_id),
+      OrderStatusStruct(input),
       client(client)
 {}
 
@@ -70,7 +74,7 @@ static void ScanOrdersIndex(
 void OrderStatusTxn::Prepare()
 {
   if (!VHandleSyncService::g_lock_elision) {
-    if (!Options::kTpccReadOnlyDelayQuery) {
+    if (!Options::kTpccReadOnlyDelayQuery && !is_snapshot()) {
       LookupCustomerIndex(state, warehouse_id, district_id, customer_id);
       ScanOrdersIndex(state, serial_id(), warehouse_id, district_id, customer_id);
     }
@@ -121,17 +125,25 @@ void OrderStatusTxn::Run()
   auto aff = std::numeric_limits<uint64_t>::max();
 
   static constexpr auto ReadCustomer = [](auto state, auto index_handle, int warehouse_id, int district_id, int customer_id) -> void {
-    auto customer = index_handle(state->customer).template Read<Customer::Value>();
+    auto row = index_handle(state->customer);
+    if (g_tpcc_config.read_only_snapshot)
+      row.template ReadSnapshot<Customer::Value>();
+    else
+      row.template Read<Customer::Value>();
   };
 
   static constexpr auto ScanOrderLine = [](auto state, auto index_handle, int warehouse_id, int district_id, int oid) -> void {
     for (int i = 0; i < 15; i++) {
       if (state->order_line[i] == nullptr) break;
-      index_handle(state->order_line[i]).template Read<OrderLine::Value>();
+      auto row = index_handle(state->order_line[i]);
+      if (g_tpcc_config.read_only_snapshot)
+        row.template ReadSnapshot<OrderLine::Value>();
+      else
+        row.template Read<OrderLine::Value>();
     }
   };
 
-  if (!Options::kEnablePartition || g_tpcc_config.IsWarehousePinnable()) {
+  if (is_snapshot() || !Options::kEnablePartition || g_tpcc_config.IsWarehousePinnable()) {
     if (g_tpcc_config.IsWarehousePinnable()) {
       aff = Config::WarehouseToCoreId(warehouse_id);
     }
@@ -141,7 +153,8 @@ void OrderStatusTxn::Run()
           auto &[state, index_handle, warehouse_id, district_id, customer_id] = ctx;
           INIT_ROUTINE_BRK(8 << 10);
 
-          if (Options::kTpccReadOnlyDelayQuery)
+          bool snapshot = g_tpcc_config.read_only_snapshot;
+          if (Options::kTpccReadOnlyDelayQuery || snapshot)
             LookupCustomerIndex(state, warehouse_id, district_id, customer_id);
 
           ReadCustomer(state, index_handle, warehouse_id, district_id, customer_id);
@@ -151,7 +164,9 @@ void OrderStatusTxn::Run()
                 PWVGraph::VHandleToResource(state->customer));
           }
 
-          if (Options::kTpccReadOnlyDelayQuery)
+          if (snapshot)
+            ScanOrdersIndex(state, index_handle.snapshot_id(), warehouse_id, district_id, customer_id);
+          else if (Options::kTpccReadOnlyDelayQuery)
             ScanOrdersIndex(state, index_handle.serial_id(), warehouse_id, district_id, customer_id);
 
           int oid = state->oid;
@@ -21,11 +21,14 @@ struct OrderStatusState {
   int oid;
 };
 
-class OrderStatusTxn : public Txn<OrderStatusState>, public OrderStatusStruct {
+class OrderStatusTxn : public SnapshotTxn<OrderStatusState>, public OrderStatusStruct {
   Client *client;
  public:
   OrderStatusTxn(Client *client, uint64_t serial_id);
+  OrderStatusTxn(Client *client, uint64_t serial_id, const OrderStatusStruct &input);
   void Run() override final;
+  int txn_type_id() const override final { return int(TxnType::OrderStatus); }
+  bool is_snapshot() const override final { return g_tpcc_config.read_only_snapshot; }
   void PrepareInsert() override final {}
   void Prepare() override final;
 };
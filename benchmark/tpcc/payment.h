@@ -55,6 +55,7 @@ class PaymentTxn : public Txn<PaymentState>, public PaymentStruct {
 
   void Prepare() override final;
   void Run() override final;
+  int txn_type_id() const override final { return int(TxnType::Payment); }
   void PrepareInsert() override final {}
 };
 
@@ -16,8 +16,12 @@ StockLevelStruct ClientBase::GenerateTransactionInput<StockLevelStruct>()
 }
 
 StockLevelTxn::StockLevelTxn(Client *client, uint64_t serial_id)
-    : Txn<StockLevelState>(serial_id),
-      StockLevelStruct(client->GenerateTransactionInput<StockLevelStruct>()),
+    : StockLevelTxn(client, serial_id, client->GenerateTransactionInput<StockLevelStruct>())
+{}
+
+StockLevelTxn::StockLevelTxn(Client *client, uint64_t serial_id, const StockLevelStruct &input)
+    : SnapshotTxn<StockLevelState>(serial_id),
+      StockLevelStruct(input),
       client(client)
 {}
 
@@ -60,7 +64,7 @@ void StockLevelTxn::Prepare()
 {
   state->res = nullptr;
   if (!VHandleSyncService::g_lock_elision) {
-    if (!Options::kTpccReadOnlyDelayQuery)
+    if (!Options::kTpccReadOnlyDelayQuery && !is_snapshot())
       ScanOrderLineIndex(state, serial_id(), warehouse_id, district_id);
   } else {
     if (Client::g_enable_pwv) {
@@ -99,9 +103,18 @@ void StockLevelTxn::Run()
 {
   static constexpr auto ScanOrderLine = [](
       auto state, auto index_handle, int warehouse_id, int district_id) -> void {
+    int n = 0;
     for (int i = 0; i < state->n; i++) {
-      state->item_ids[i] = index_handle(state->items[i]).template Read<OrderLine::Value>().ol_i_id;
+      auto row = index_handle(state->items[i]);
+      if (g_tpcc_config.read_only_snapshot) {
+        auto ol = row.template ReadSnapshot<OrderLine::Value>();
+        if (!ol) continue;
+        state->item_ids[n++] = ol->ol_i_id;
+      } else {
+        state->item_ids[n++] = row.template Read<OrderLine::Value>().ol_i_id;
+      }
     }
+    state->n = n;
     std::sort(state->item_ids.begin(), state->item_ids.begin() + state->n);
   };
 
@@ -122,16 +135,23 @@ void StockLevelTxn::Run()
       // go::RoutineScopedData sb(mem::Brk::New(stk_data, 4UL << 10));
 
       auto stock_key = Stock::Key::New(warehouse_id, id);
-      auto stock_value = index_handle(mgr.Get<Stock>().Search(stock_key.EncodeView(buf)))
-                         .template Read<Stock::Value>();
-      if (stock_value.s_quantity < threshold) result++;
+      auto row = index_handle(mgr.Get<Stock>().Search(stock_key.EncodeView(buf)));
+      int quantity;
+      if (g_tpcc_config.read_only_snapshot) {
+        auto stock_value = row.template ReadSnapshot<Stock::Value>();
+        if (!stock_value) continue;
+        quantity = stock_value->s_quantity;
+      } else {
+        quantity = row.template Read<Stock::Value>().s_quantity;
+      }
+      if (quantity < threshold) result++;
     }
   };
 
   auto aff = std::numeric_limits<uint64_t>::max();
   state->n = 0;
 
-  if (!Options::kEnablePartition || g_tpcc_config.IsWarehousePinnable()) {
+  if (is_snapshot() || !Options::kEnablePartition || g_tpcc_config.IsWarehousePinnable()) {
     if (Options::kEnablePartition) {
       aff = Config::WarehouseToCoreId(warehouse_id);
     }
@@ -141,7 +161,9 @@ void StockLevelTxn::Run()
         [](const auto &ctx) {
           auto &[state, index_handle, warehouse_id, district_id, threshold] = ctx;
 
-          if (Options::kTpccReadOnlyDelayQuery)
+          if (g_tpcc_config.read_only_snapshot)
+            ScanOrderLineIndex(state, index_handle.snapshot_id(), warehouse_id, district_id);
+          else if (Options::kTpccReadOnlyDelayQuery)
             ScanOrderLineIndex(state, index_handle.serial_id(), warehouse_id, district_id);
 
           ScanOrderLine(state, index_handle, warehouse_id, district_id);
@@ -156,7 +178,7 @@ void StockLevelTxn::Run()
           }
         },
         aff);
-    if (!Client::g_enable_granola && !Client::g_enable_pwv) {
+    if (!Client::g_enable_granola && !Client::g_enable_pwv && !is_snapshot()) {
       root->AssignSchedulingKey(serial_id() + (2024ULL << 8));
     }
   } else { // kEnablePartition && !IsWarehousePinnable()
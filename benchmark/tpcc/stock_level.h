@@ -25,14 +25,17 @@ struct StockLevelState {
   int nr_res;
 };
 
-class StockLevelTxn : public felis::Txn<StockLevelState>, public StockLevelStruct {
+class StockLevelTxn : public felis::SnapshotTxn<StockLevelState>, public StockLevelStruct {
   Client *client;
  public:
   StockLevelTxn(Client *client, uint64_t serial_id);
+  StockLevelTxn(Client *client, uint64_t serial_id, const StockLevelStruct &input);
 
   void PrepareInsert() override final;
   void Prepare() override final;
   void Run() override final;
+  int txn_type_id() const override final { return int(TxnType::StockLevel); }
+  bool is_snapshot() const override final { return g_tpcc_config.read_only_snapshot; }
 };
 
 }
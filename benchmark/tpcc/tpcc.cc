@@ -43,6 +43,7 @@ Config::Config()
   max_supported_warehouse = 64;
 
   shard_by_warehouse = true;
+  read_only_snapshot = false;
 }
 
 Config g_tpcc_config;
@@ -112,6 +113,12 @@ void InitializeTPCC()
   if (felis::Options::kTpccHashShard)
     g_tpcc_config.shard_by_warehouse = false;
 
+  if (felis::Options::kTpccReadOnlySnapshot) {
+    abort_if(felis::Options::kVHandleLockElision,
+             "TpccReadOnlySnapshot does not work with VHandleLockElision");
+    g_tpcc_config.read_only_snapshot = true;
+  }
+
   logger->info("Warehouses {}, Pin? {}",
                g_tpcc_config.nr_warehouses,
                g_tpcc_config.IsWarehousePinnable());
@@ -151,6 +158,10 @@ void InitializeTPCC()
              OrderLine, Stock, Warehouse>();
 
   logger->info("TPCC Table schemas created");
+
+  // Not in the Order loader, because we need them when loading from a
+  // checkpoint too.
+  ClientBase::InitializeLastNewOrderIds();
 }
 
 // TPC-C workload mix
@@ -334,6 +345,19 @@ uint ClientBase::GetCurrentTime()
   return ++tl_hack;
 }
 
+void ClientBase::InitializeLastNewOrderIds()
+{
+  // These match the initial NewOrder rows.
+  auto nr_all_districts = g_tpcc_config.nr_warehouses * g_tpcc_config.districts_per_warehouse;
+  for (int i = 1; i <= util::Instance<NodeConfiguration>().nr_nodes(); i++) {
+    g_last_no_start[i] = new std::atomic_ulong[nr_all_districts];
+    g_last_no_end[i] = new std::atomic_ulong[nr_all_districts];
+
+    std::fill(g_last_no_start[i], g_last_no_start[i] + nr_all_districts, 2101);
+    std::fill(g_last_no_end[i], g_last_no_end[i] + nr_all_districts, 3000);
+  }
+}
+
 uint32_t ClientBase::AcquireLastNewOrderId(int warehouse, int district)
 {
   abort_if(!g_tpcc_config.shard_by_warehouse, "TODO: needs to implement this under random sharding.");
@@ -714,15 +738,6 @@ void Loader<LoaderType::Customer>::DoLoad()
 template <>
 void Loader<LoaderType::Order>::DoLoad()
 {
-  auto nr_all_districts = g_tpcc_config.nr_warehouses * g_tpcc_config.districts_per_warehouse;
-  for (int i = 1; i <= util::Instance<NodeConfiguration>().nr_nodes(); i++) {
-    g_last_no_start[i] = new std::atomic_ulong[nr_all_districts];
-    g_last_no_end[i] = new std::atomic_ulong[nr_all_districts];
-
-    std::fill(g_last_no_start[i], g_last_no_start[i] + nr_all_districts, 2101);
-    std::fill(g_last_no_end[i], g_last_no_end[i] + nr_all_districts, 3000);
-  }
-
   void *large_buf = alloca(1024);
   // a random permutation of customer IDs
   auto c_ids = new uint32_t[g_tpcc_config.customers_per_district];
@@ -872,6 +887,19 @@ felis::BaseTxn *Client::ParseAndPopulateTxn(uint64_t serial_id, char* &input)
 
 }
 
+size_t Client::MarshalledTxnSize()
+{
+  return sizeof(TPCCTransactionMarshalled);
+}
+
+std::string Client::TxnTypeName(int type_id)
+{
+  static const char *kTxnTypeNames[] = {
+    "NewOrder", "Payment", "Delivery", "OrderStatus", "StockLevel",
+  };
+  return kTxnTypeNames[type_id];
+}
+
 using namespace felis;
 
 int TpccSliceRouter::SliceToNodeId(int16_t slice_id)
@@ -61,6 +61,8 @@ struct Config {
   size_t max_supported_warehouse;
 
   bool shard_by_warehouse;
+  // OrderStatus and StockLevel read the snapshot of their epoch, see SnapshotTxn.
+  bool read_only_snapshot;
 
   Config();
 
@@ -173,9 +175,17 @@ struct Item {
 };
 
 struct NewOrder {
+  static uint32_t HashKey(const felis::VarStrView &k) {
+    // The low 16 bits of the order id, then its high bits folded with the
+    // district, then the warehouse.
+    uint8_t x[] = {k[11], k[10], (uint8_t) (k[9] ^ k[8] ^ ((k[7] - 1) << 4)), (uint8_t) (k[3] - 1)};
+    return *(uint32_t *) x;
+  }
   static constexpr auto kTable = TableType::NewOrder;
-  static constexpr auto kIndexArgs = std::make_tuple(true);
-  using IndexBackend = felis::MasstreeIndex;
+  // Delivery scans the new orders of a district, so they are also ordered by
+  // the warehouse and district prefix.
+  static constexpr auto kIndexArgs = std::make_tuple(HashKey, 1 << 20, true, 8);
+  using IndexBackend = felis::HashtableIndex;
   using Key = sql::NewOrderKey;
   using Value = sql::NewOrderValue;
 };
@@ -344,6 +354,7 @@ class ClientBase {
   template <class T> T GenerateTransactionInput();
   template <typename T> T ParseTransactionInput(char* &input);
 
+  static void InitializeLastNewOrderIds();
   static uint32_t AcquireLastNewOrderId(int warehouse, int district);
   // TODO: We need the following for random sharding.
   // static void AddLastNewOrderid(int warehouse, int district, uint32_t id);
@@ -429,9 +440,12 @@ class Client : public felis::EpochClient, public ClientBase {
   // XXX: hack for delivery transaction
   int last_no_o_ids[10];
 
+  std::string TxnTypeName(int type_id) final override;
+
  protected:
   felis::BaseTxn *CreateTxn(uint64_t serial_id) final override;
   felis::BaseTxn *ParseAndPopulateTxn(uint64_t serial_id, char* &input) final override;
+  size_t MarshalledTxnSize() final override;
 };
 
 using TxnFactory =
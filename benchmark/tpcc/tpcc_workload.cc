@@ -7,6 +7,8 @@
 #include "util/factory.h"
 #include "index.h"
 #include "module.h"
+#include "opts.h"
+#include "checkpoint.h"
 #include "gopp/gopp.h"
 #include "gopp/channels.h"
 
@@ -98,7 +100,18 @@ class TPCCModule : public Module<WorkloadModule> {
 
     tpcc::InitializeTPCC();
     tpcc::InitializeSliceManager();
-    LoadTPCCDataSet();
+    if (Options::kLoadCheckpoint) {
+      abort_if(NodeConfiguration::g_data_migration,
+               "Rows loaded from a checkpoint are not registered with the slices");
+      auto epoch_nr = Checkpointer::Load(Options::kLoadCheckpoint.Get());
+      // Epochs always start from 1, and the ids Delivery takes the next
+      // NewOrder rows from are not in the image. Both match only the image of
+      // epoch 1.
+      abort_if(epoch_nr != 1, "Cannot start from the checkpoint of epoch {}, only from one of epoch 1",
+               epoch_nr);
+    } else {
+      LoadTPCCDataSet();
+    }
 
     tpcc::TxnFactory::Initialize();
 
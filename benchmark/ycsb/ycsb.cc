@@ -119,7 +119,7 @@ class RMWTxn : public Txn<RMWState>, public RMWStruct {
     for (int i = 0; i < kTotal; i++) {
       auto worker_cnt = NodeConfiguration::g_nr_threads;
 #ifdef DISPATCHER
-      worker_cnt--;
+      worker_cnt -= EpochClient::g_nr_dispatchers;
 #endif
       auto part = (keys[i] * worker_cnt) / Client::g_table_size;
       f(part, root, Tuple<unsigned long, int, decltype(state), decltype(handle), int>(keys[i], i, state, handle, part));
@@ -452,4 +452,9 @@ BaseTxn *Client::ParseAndPopulateTxn(uint64_t serial_id, char* &input)
   return new RMWTxn(this, serial_id, input);
 }
 
+size_t Client::MarshalledTxnSize()
+{
+  return sizeof(YCSBTransactionMarshalled);
+}
+
 }
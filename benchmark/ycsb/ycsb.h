@@ -48,6 +48,7 @@ class Client : public felis::EpochClient {
   unsigned int LoadPercentage() final override { return 100; }
   felis::BaseTxn *CreateTxn(uint64_t serial_id) final override;
   felis::BaseTxn *ParseAndPopulateTxn(uint64_t serial_id, char* &input) final override;
+  size_t MarshalledTxnSize() final override;
 
   template <typename T> T GenerateTransactionInput();
   template <typename T> T ParseTransactionInput(char* &input);
@@ -1,6 +1,7 @@
 #include "ycsb.h"
 #include "module.h"
 #include "opts.h"
+#include "checkpoint.h"
 
 namespace felis {
 
@@ -27,9 +28,17 @@ class YcsbModule : public Module<WorkloadModule> {
 
     ycsb::Client::g_dependency = Options::kYcsbDependency;
 
-    auto loader = new ycsb::YcsbLoader();
-    go::GetSchedulerFromPool(1)->WakeUp(loader);
-    loader->Wait();
+    if (Options::kLoadCheckpoint) {
+      util::Instance<TableManager>().Create<ycsb::Ycsb>();
+      auto epoch_nr = Checkpointer::Load(Options::kLoadCheckpoint.Get());
+      // Epochs always start from 1.
+      abort_if(epoch_nr != 1, "Cannot start from the checkpoint of epoch {}, only from one of epoch 1",
+               epoch_nr);
+    } else {
+      auto loader = new ycsb::YcsbLoader();
+      go::GetSchedulerFromPool(1)->WakeUp(loader);
+      loader->Wait();
+    }
 
     EpochClient::g_workload_client = new ycsb::Client();
   }
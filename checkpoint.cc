@@ -1,5 +1,384 @@
+#include <thread>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "checkpoint.h"
 #include "index.h"
+#include "log.h"
+#include "csum.h"
+#include "gopp/gopp.h"
+#include "util/arch.h"
 
 namespace felis {
 
+static uint32_t Checksum(const void *data, size_t len)
+{
+  unsigned int crc = INITIAL_CRC32_VALUE;
+  update_crc32((const unsigned char *) data, len, &crc);
+  return crc;
+}
+
+static void WriteAll(int fd, const void *data, size_t len, uint64_t offset)
+{
+  size_t l = 0;
+  while (l < len) {
+    auto rs = pwrite(fd, (const uint8_t *) data + l, len - l, offset + l);
+    if (rs < 0 && errno == EINTR) continue;
+    abort_if(rs <= 0, "Cannot write the checkpoint, errno={}", errno);
+    l += rs;
+  }
+}
+
+// False if the file ends before len bytes, or on an error.
+static bool ReadAll(int fd, void *data, size_t len, uint64_t offset)
+{
+  size_t l = 0;
+  while (l < len) {
+    auto rs = pread(fd, (uint8_t *) data + l, len - l, offset + l);
+    if (rs < 0 && errno == EINTR) continue;
+    if (rs <= 0) return false;
+    l += (size_t) rs;
+  }
+  return true;
+}
+
+Checkpointer::Checkpointer(const std::string &path, uint64_t interval, int nr_threads)
+    : path(path), interval(interval), nr_threads(nr_threads)
+{
+  for (int i = 0; i < nr_threads; i++) {
+    std::thread([this, i]() { WorkerLoop(i); }).detach();
+  }
+}
+
+void Checkpointer::WaitForCompletion()
+{
+  while (nr_running.load(std::memory_order_acquire) != 0)
+    _mm_pause();
+}
+
+void Checkpointer::OnEpochBegin(uint64_t epoch_nr)
+{
+  WaitForCompletion();
+  if (!is_checkpoint_epoch(epoch_nr))
+    return;
+
+  fd = open(tmp_path().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  abort_if(fd < 0, "Cannot create checkpoint {}, errno={}", tmp_path(), errno);
+  write_offset = sizeof(CheckpointHeader);
+  nr_rows = 0;
+  index.clear();
+
+  // AutoIncrement() is only called in the Insert phase, so the counters are
+  // as of the end of the last epoch now.
+  auto &mgr = util::Instance<TableManager>();
+  uint64_t counters[Table::kAutoIncrementZones];
+  parts.clear();
+  for (int i = 0; i < TableManager::kMaxNrRelations; i++) {
+    auto table = mgr.GetTable(i);
+    if (table == nullptr) continue;
+
+    for (size_t zone = 0; zone < Table::kAutoIncrementZones; zone++) {
+      counters[zone] = table->GetCurrentAutoIncrement(zone) >> 8;
+    }
+    WriteChunk(i, CheckpointChunk::kAutoIncrement, 0, (uint8_t *) counters, sizeof(counters));
+
+    for (size_t p = 0; p < table->nr_scan_partitions(); p++) {
+      parts.emplace_back(table, p);
+    }
+  }
+}
+
+void Checkpointer::OnInitializeComplete(uint64_t epoch_nr)
+{
+  if (!is_checkpoint_epoch(epoch_nr))
+    return;
+
+  logger->info("Checkpoint of epoch {} starts, {} partitions", epoch_nr, parts.size());
+  start_time = std::chrono::steady_clock::now();
+  cur_part = 0;
+  // The last thread writes the header, and then drops the extra one.
+  nr_running = nr_threads + 1;
+  {
+    std::lock_guard _(start_lock);
+    this->epoch_nr = epoch_nr;
+  }
+  start_cond.notify_all();
+}
+
+void Checkpointer::WorkerLoop(int id)
+{
+  // After the ids of the go thread pool.
+  auto ti = MasstreeIndex::NewThreadInfo(NodeConfiguration::g_nr_threads + 2 + id);
+  uint64_t last_epoch_nr = 0;
+  while (true) {
+    {
+      std::unique_lock l(start_lock);
+      start_cond.wait(l, [this, last_epoch_nr]() { return epoch_nr != last_epoch_nr; });
+      last_epoch_nr = epoch_nr;
+    }
+    Scan(ti);
+    if (nr_running.fetch_sub(1) == 2) {
+      Finish();
+      nr_running.fetch_sub(1, std::memory_order_release);
+    }
+  }
+}
+
+void Checkpointer::Scan(threadinfo *ti)
+{
+  auto nr_cores = NodeConfiguration::g_nr_threads;
+  auto sid = epoch_nr << 32;
+  std::vector<std::vector<uint8_t>> buffers(nr_cores);
+  std::vector<uint32_t> nr(nr_cores, 0);
+  int relation_id = -1;
+
+  auto flush = [&](int core) {
+    if (nr[core] == 0) return;
+    WriteChunk(relation_id, core, nr[core], buffers[core].data(), buffers[core].size());
+    buffers[core].clear();
+    nr[core] = 0;
+  };
+
+  unsigned long i;
+  while ((i = cur_part.fetch_add(1)) < parts.size()) {
+    auto [table, part] = parts[i];
+    if (table->relation_id() != relation_id) {
+      for (int core = 0; core < nr_cores; core++) flush(core);
+      relation_id = table->relation_id();
+    }
+
+    table->ScanPartition(
+        part,
+        [&](const VarStrView &k, VHandle *row) {
+          VarStr *v = nullptr;
+          // Rows that did not exist yet, or were deleted.
+          if (!row->ReadStableVersion(sid, &v) || v == nullptr)
+            return;
+
+          auto core = row->object_coreid() % nr_cores;
+          auto &buf = buffers[core];
+          uint16_t key_len = k.length();
+          uint16_t value_hdr[] = {v->length(), 0};
+          buf.insert(buf.end(), (uint8_t *) &key_len, (uint8_t *) (&key_len + 1));
+          buf.insert(buf.end(), k.data(), k.data() + k.length());
+          buf.resize(util::Align(buf.size(), 2));
+          buf.insert(buf.end(), (uint8_t *) value_hdr, (uint8_t *) (value_hdr + 2));
+          buf.insert(buf.end(), v->data(), v->data() + v->length());
+          buf.resize(util::Align(buf.size(), 2));
+          nr[core]++;
+          if (buf.size() >= kChunkSize) flush(core);
+        },
+        ti);
+  }
+  for (int core = 0; core < nr_cores; core++) flush(core);
+}
+
+void Checkpointer::WriteChunk(int relation_id, int core, uint32_t nr, const uint8_t *payload, uint32_t size)
+{
+  CheckpointChunk chunk;
+  memset(&chunk, 0, sizeof(CheckpointChunk));
+  chunk.offset = write_offset.fetch_add(size);
+  chunk.relation_id = relation_id;
+  chunk.core = core;
+  chunk.nr_rows = nr;
+  chunk.size = size;
+  chunk.crc = Checksum(payload, size);
+
+  WriteAll(fd, payload, size, chunk.offset);
+  nr_rows.fetch_add(nr);
+
+  std::lock_guard _(index_lock);
+  index.push_back(chunk);
+}
+
+void Checkpointer::Finish()
+{
+  CheckpointHeader hdr;
+  memset(&hdr, 0, sizeof(CheckpointHeader));
+  hdr.magic = CheckpointHeader::kMagic;
+  hdr.epoch_nr = epoch_nr;
+  hdr.nr_chunks = index.size();
+  hdr.nr_rows = nr_rows.load();
+  hdr.index_offset = write_offset.load();
+  hdr.size = hdr.index_offset + index.size() * sizeof(CheckpointChunk);
+  hdr.crc = INITIAL_CRC32_VALUE;
+  update_crc32((const unsigned char *) &hdr, offsetof(CheckpointHeader, crc), &hdr.crc);
+  update_crc32((const unsigned char *) index.data(), index.size() * sizeof(CheckpointChunk), &hdr.crc);
+  WriteAll(fd, index.data(), index.size() * sizeof(CheckpointChunk), hdr.index_offset);
+  WriteAll(fd, &hdr, sizeof(CheckpointHeader), 0);
+
+  // Only replace the last image once this one is complete.
+  abort_if(fdatasync(fd) < 0, "fdatasync() on checkpoint {} failed, errno={}", tmp_path(), errno);
+  close(fd);
+  fd = -1;
+  abort_if(rename(tmp_path().c_str(), path.c_str()) < 0,
+           "Cannot rename {} to {}, errno={}", tmp_path(), path, errno);
+
+  std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start_time;
+  logger->info("Checkpoint of epoch {} done in {:.0f} ms, {} rows, {} MB",
+               hdr.epoch_nr, duration.count(), hdr.nr_rows, hdr.size >> 20);
+}
+
+// Hugepages from hugetlbfs if there are any, like util::OSMemory. Otherwise
+// transparent hugepages. Nothing is touched here, so that every core faults
+// in its own part on its own NUMA node.
+static uint8_t *AllocSnapshotMemory(size_t length)
+{
+  void *p = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                 MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB | MAP_NORESERVE, -1, 0);
+  if (p == MAP_FAILED) {
+    p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    abort_if(p == MAP_FAILED, "Cannot allocate {} bytes for the checkpoint, errno={}", length, errno);
+    madvise(p, length, MADV_HUGEPAGE);
+  }
+  return (uint8_t *) p;
+}
+
+// Reads and inserts the row chunks of one core, on that core.
+class CheckpointLoader : public go::Routine {
+  int fd;
+  uint8_t *mem;
+  std::vector<CheckpointChunk> chunks;
+  std::atomic_int *count_down;
+ public:
+  CheckpointLoader(int fd, std::atomic_int *count_down) : fd(fd), count_down(count_down) {}
+  void Add(const CheckpointChunk &chunk) { chunks.push_back(chunk); }
+  size_t size() const {
+    size_t s = 0;
+    for (auto &chunk: chunks) s += chunk.size;
+    return s;
+  }
+  void set_memory(uint8_t *p) { mem = p; }
+  void Run() override final;
+};
+
+void CheckpointLoader::Run()
+{
+  // Keep the reads sequential.
+  std::sort(chunks.begin(), chunks.end(),
+            [](const auto &a, const auto &b) { return a.offset < b.offset; });
+
+  auto &mgr = util::Instance<TableManager>();
+  auto p = mem;
+  for (auto &chunk: chunks) {
+    abort_if(!ReadAll(fd, p, chunk.size, chunk.offset), "Cannot read the checkpoint, errno={}", errno);
+    abort_if(Checksum(p, chunk.size) != chunk.crc,
+             "Checkpoint chunk of table {} is corrupted", chunk.relation_id);
+
+    auto table = mgr.GetTable(chunk.relation_id);
+    for (uint32_t i = 0; i < chunk.nr_rows; i++) {
+      uint16_t key_len = *(uint16_t *) p;
+      p += sizeof(uint16_t);
+
+      bool created = false;
+      auto row = table->SearchOrCreate(VarStrView(key_len, p), &created);
+      abort_if(!created, "Table {} is not empty, or the checkpoint has duplicate keys",
+               chunk.relation_id);
+      p += util::Align(key_len, 2);
+
+      auto value_len = *(uint16_t *) p;
+      auto buf = row->AllocFromInline(VarStr::NewSize(value_len));
+      VarStr *v;
+      if (buf) {
+        v = VarStr::FromPtr(buf, value_len);
+        memcpy(v->data(), p + sizeof(VarStr), value_len);
+      } else {
+        v = VarStr::FromPtr(p, value_len);
+      }
+      InitVersion(row, v);
+      p += util::Align(VarStr::NewSize(value_len), 2);
+    }
+  }
+  count_down->fetch_sub(1);
+}
+
+uint64_t Checkpointer::Load(const std::string &path)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  abort_if(fd < 0, "Cannot open checkpoint {}, errno={}", path, errno);
+  struct stat st;
+  abort_if(fstat(fd, &st) < 0 || st.st_size < 0, "Cannot stat checkpoint {}", path);
+  uint64_t file_size = st.st_size;
+
+  CheckpointHeader hdr;
+  abort_if(!ReadAll(fd, &hdr, sizeof(CheckpointHeader), 0)
+           || hdr.magic != CheckpointHeader::kMagic
+           || hdr.size != file_size
+           || hdr.index_offset < sizeof(CheckpointHeader) || hdr.index_offset > hdr.size
+           || hdr.nr_chunks > (hdr.size - hdr.index_offset) / sizeof(CheckpointChunk)
+           || hdr.index_offset + hdr.nr_chunks * sizeof(CheckpointChunk) != hdr.size,
+           "{} is not a complete checkpoint", path);
+
+  std::vector<CheckpointChunk> index(hdr.nr_chunks);
+  auto index_size = hdr.nr_chunks * sizeof(CheckpointChunk);
+  abort_if(!ReadAll(fd, index.data(), index_size, hdr.index_offset),
+           "Cannot read the index of checkpoint {}", path);
+  unsigned int crc = INITIAL_CRC32_VALUE;
+  update_crc32((const unsigned char *) &hdr, offsetof(CheckpointHeader, crc), &crc);
+  update_crc32((const unsigned char *) index.data(), index_size, &crc);
+  abort_if(crc != hdr.crc, "Checkpoint {} has a corrupted header", path);
+
+  logger->info("Loading checkpoint {} of epoch {}, {} rows", path, hdr.epoch_nr, hdr.nr_rows);
+  auto start = std::chrono::steady_clock::now();
+
+  // Images from a machine with more cores are spread over ours.
+  auto nr_cores = NodeConfiguration::g_nr_threads;
+  std::atomic_int count_down(nr_cores);
+  std::vector<CheckpointLoader *> loaders;
+  for (int core = 0; core < nr_cores; core++) {
+    loaders.push_back(new CheckpointLoader(fd, &count_down));
+  }
+
+  auto &mgr = util::Instance<TableManager>();
+  for (auto &chunk: index) {
+    abort_if(chunk.offset < sizeof(CheckpointHeader) || chunk.offset > hdr.index_offset
+             || chunk.size > hdr.index_offset - chunk.offset,
+             "Checkpoint {} has a chunk out of bounds", path);
+    abort_if(chunk.relation_id < 0 || chunk.relation_id >= TableManager::kMaxNrRelations
+             || mgr.GetTable(chunk.relation_id) == nullptr,
+             "Checkpoint {} has rows of table {}, which does not exist", path, chunk.relation_id);
+
+    if (chunk.core == CheckpointChunk::kAutoIncrement) {
+      uint64_t counters[Table::kAutoIncrementZones];
+      abort_if(chunk.size != sizeof(counters)
+               || !ReadAll(fd, counters, chunk.size, chunk.offset)
+               || Checksum(counters, chunk.size) != chunk.crc,
+               "Checkpoint auto increment counters of table {} are corrupted", chunk.relation_id);
+      for (int zone = 0; zone < Table::kAutoIncrementZones; zone++) {
+        mgr.GetTable(chunk.relation_id)->ResetAutoIncrement(zone, counters[zone]);
+      }
+    } else {
+      loaders[chunk.core % nr_cores]->Add(chunk);
+    }
+  }
+
+  // One piece of memory for all, so that IsSnapshotData() is cheap. Each core
+  // gets its own hugepages.
+  static constexpr size_t kHugePageSize = 2 << 20;
+  size_t total = 0;
+  for (auto loader: loaders) total += util::Align(loader->size(), kHugePageSize);
+  auto mem = AllocSnapshotMemory(std::max(total, kHugePageSize));
+  g_snapshot_start = mem;
+  g_snapshot_end = mem + total;
+
+  for (int core = 0; core < nr_cores; core++) {
+    loaders[core]->set_memory(mem);
+    mem += util::Align(loaders[core]->size(), kHugePageSize);
+    go::GetSchedulerFromPool(core + 1)->WakeUp(loaders[core]);
+  }
+  while (count_down.load() > 0)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  close(fd);
+
+  std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+  logger->info("Checkpoint loaded in {:.0f} ms, {} MB/s",
+               duration.count(), (long) (hdr.size / 1000 / duration.count()));
+  return hdr.epoch_nr;
+}
+
 }
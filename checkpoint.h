@@ -0,0 +1,141 @@
+// -*- mode: c++ -*-
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+class threadinfo;
+
+namespace felis {
+
+class Table;
+
+// A checkpoint image is
+//
+//   CheckpointHeader
+//   payloads of the chunks, in any order
+//   nr_chunks CheckpointChunk, the index
+//
+// A row chunk holds rows of one table, which were all allocated by the same
+// core. Each row is
+//
+//   uint16_t key_len, key, the value as a VarStr
+//
+// Keys and values are padded to 2 bytes, so that the loader can use the VarStr
+// where it reads it. The auto increment chunk of a table holds its
+// Table::kAutoIncrementZones counters. Payloads are checksummed with the crc32
+// in csum.h, and so are the header and the index.
+struct CheckpointHeader {
+  static constexpr uint64_t kMagic = 0x544E494F504B4843; // "CHKPOINT"
+
+  uint64_t magic;
+  uint64_t epoch_nr; // rows are as of the beginning of this epoch
+  uint64_t nr_chunks;
+  uint64_t nr_rows;
+  uint64_t index_offset;
+  uint64_t size; // of the whole image
+  uint32_t crc; // of the fields above and the index
+  uint32_t __padding__[3];
+};
+
+static_assert(sizeof(CheckpointHeader) == 64);
+
+struct CheckpointChunk {
+  static constexpr int16_t kAutoIncrement = -1;
+
+  uint64_t offset;
+  int16_t relation_id;
+  int16_t core; // that allocated the rows, or kAutoIncrement
+  uint32_t nr_rows;
+  uint32_t size;
+  uint32_t crc; // of the payload
+};
+
+static_assert(sizeof(CheckpointChunk) == 24);
+
+// Background checkpoints (-XCheckpoint).
+//
+// Every version carries the epoch in its serial id, so reading every row at
+// serial id (E << 32) gives the database exactly as it was at the end of
+// epoch E - 1. That's a consistent cut with no coordination at all. Between
+// the Initialize phase of epoch E and the Insert phase of epoch E + 1, the
+// version arrays do not change, and versions older than epoch E are all
+// written. So we scan the tables while epoch E is executing, and the epoch
+// after only waits if we are not done by then.
+//
+// The scan runs on its own threads. Tables are split into partitions (see
+// Table::ScanPartition()), and the threads take them one by one.
+class Checkpointer {
+ public:
+  static constexpr size_t kChunkSize = 256 << 10;
+ private:
+  std::string path;
+  uint64_t interval;
+  int nr_threads;
+
+  // epoch_nr changes when a checkpoint starts.
+  std::mutex start_lock;
+  std::condition_variable start_cond;
+  uint64_t epoch_nr = 0;
+
+  int fd = -1;
+  std::vector<std::pair<Table *, size_t>> parts; // table, partition
+  std::atomic_ulong cur_part;
+  std::atomic_ulong write_offset;
+  std::atomic_ulong nr_rows;
+  std::mutex index_lock;
+  std::vector<CheckpointChunk> index;
+  std::atomic_int nr_running = 0;
+  std::chrono::steady_clock::time_point start_time;
+
+  bool is_checkpoint_epoch(uint64_t epoch_nr) const {
+    return interval == 0 ? epoch_nr == 1 : (epoch_nr - 1) % interval == 0;
+  }
+  std::string tmp_path() const { return path + ".tmp"; }
+  void WorkerLoop(int id);
+  void Scan(threadinfo *ti);
+  void WriteChunk(int relation_id, int core, uint32_t nr, const uint8_t *payload, uint32_t size);
+  void Finish();
+ public:
+  // Writes an image every interval epochs, starting from epoch 1, so the
+  // first image is the loaded data. If interval is 0, that's the only one.
+  Checkpointer(const std::string &path, uint64_t interval, int nr_threads);
+  Checkpointer(const Checkpointer &rhs) = delete;
+
+  // Called by the control routine before the Insert phase. Waits for the
+  // last checkpoint, which might still be reading the versions that the GC is
+  // going to collect, and saves the auto increment counters if a checkpoint
+  // is due.
+  void OnEpochBegin(uint64_t epoch_nr);
+  // Called by the control routine after the Initialize phase. Starts the
+  // checkpoint of this epoch, if it is due.
+  void OnInitializeComplete(uint64_t epoch_nr);
+
+  // Loads an image into the empty tables, instead of running the loaders.
+  // Every core reads the chunks of rows it allocated in the first place into
+  // its own hugepages, and inserts them. Values that do not fit inline stay
+  // where they were read, so loading is mostly I/O. Returns the epoch of the
+  // image.
+  static uint64_t Load(const std::string &path);
+
+  // The values Load() left in place are never freed. The GC asks here.
+  static inline uint8_t *g_snapshot_start = nullptr;
+  static inline uint8_t *g_snapshot_end = nullptr;
+  static bool IsSnapshotData(const void *p) {
+    return p >= g_snapshot_start && p < g_snapshot_end;
+  }
+
+  void WaitForCompletion();
+};
+
+}
+
+#endif /* CHECKPOINT_H */
@@ -0,0 +1,147 @@
+#include <thread>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "command_log.h"
+#include "epoch.h"
+#include "mem.h"
+#include "log.h"
+#include "util/arch.h"
+#include "xxHash/xxhash.h"
+
+namespace felis {
+
+CommandLog::CommandLog(const std::string &path, size_t record_size)
+    : record_size(record_size),
+      buffer_size(util::Align(sizeof(CommandLogEpochHeader) + EpochClient::g_txn_per_epoch * record_size,
+                              kBlockSize)),
+      write_offset(0)
+{
+  Recover(path);
+
+  fd = open(path.c_str(), O_WRONLY | O_CREAT | O_DIRECT, 0644);
+  if (fd < 0 && errno == EINVAL) {
+    // tmpfs, for example.
+    logger->warn("{} does not support O_DIRECT, falling back to the page cache", path);
+    fd = open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+  }
+  abort_if(fd < 0, "Cannot open command log {}, errno={}", path, errno);
+  // Drop the torn frame, if any.
+  abort_if(ftruncate(fd, write_offset) < 0,
+           "Cannot truncate command log {} to {}, errno={}", path, write_offset, errno);
+
+  // mmap()ed, so they are aligned for O_DIRECT.
+  for (int i = 0; i < kNrBuffers; i++) {
+    buffers[i] = (uint8_t *) mem::AllocMemory(mem::GenericMemory, buffer_size);
+  }
+  durable_epoch_nr = recovered.size();
+
+  std::thread([this]() { WriteLoop(); }).detach();
+}
+
+void CommandLog::Recover(const std::string &path)
+{
+  int rfd = open(path.c_str(), O_RDONLY);
+  if (rfd < 0) {
+    abort_if(errno != ENOENT, "Cannot open command log {}, errno={}", path, errno);
+    return;
+  }
+  struct stat st;
+  abort_if(fstat(rfd, &st) < 0, "Cannot stat command log {}", path);
+  recovered_len = st.st_size;
+  if (recovered_len > 0) {
+    recovered_data = (uint8_t *) mmap(nullptr, recovered_len, PROT_READ, MAP_PRIVATE, rfd, 0);
+    abort_if(recovered_data == MAP_FAILED, "Cannot mmap command log {}, errno={}", path, errno);
+  }
+  close(rfd);
+
+  uint64_t off = 0;
+  while (off + sizeof(CommandLogEpochHeader) <= recovered_len) {
+    auto hdr = (CommandLogEpochHeader *) (recovered_data + off);
+    auto data_len = hdr->nr_txns * record_size;
+    if (hdr->magic != CommandLogEpochHeader::kMagic
+        || hdr->epoch_nr != recovered.size() + 1
+        || hdr->record_size != record_size
+        || hdr->frame_size != util::Align(sizeof(CommandLogEpochHeader) + data_len, kBlockSize)
+        || off + hdr->frame_size > recovered_len
+        || XXH64(hdr + 1, data_len, 0) != hdr->checksum)
+      break;
+    abort_if(hdr->nr_txns > EpochClient::g_txn_per_epoch,
+             "Epoch {} in the command log has {} txns, more than EpochSize {}",
+             hdr->epoch_nr, hdr->nr_txns, EpochClient::g_txn_per_epoch);
+    recovered.push_back(hdr);
+    off += hdr->frame_size;
+  }
+  write_offset = off;
+
+  logger->info("Recovered {} epochs from command log {}, {} bytes discarded",
+               recovered.size(), path, recovered_len - off);
+}
+
+void CommandLog::WaitForBuffer(uint64_t epoch_nr)
+{
+  while (durable_epoch_nr.load(std::memory_order_acquire) + kNrBuffers < epoch_nr)
+    _mm_pause();
+}
+
+void CommandLog::Append(uint64_t epoch_nr, uint64_t seq, const char *input)
+{
+  memcpy(buffer(epoch_nr) + sizeof(CommandLogEpochHeader) + (seq - 1) * record_size,
+         input, record_size);
+}
+
+void CommandLog::Seal(uint64_t epoch_nr, uint64_t nr_txns)
+{
+  {
+    std::lock_guard _(seal_lock);
+    sealed_epochs.emplace_back(epoch_nr, nr_txns);
+  }
+  seal_cond.notify_one();
+}
+
+void CommandLog::WriteLoop()
+{
+  while (true) {
+    uint64_t epoch_nr, nr_txns;
+    {
+      std::unique_lock l(seal_lock);
+      seal_cond.wait(l, [this]() { return !sealed_epochs.empty(); });
+      std::tie(epoch_nr, nr_txns) = sealed_epochs.front();
+      sealed_epochs.pop_front();
+    }
+    abort_if(epoch_nr != durable_epoch_nr.load() + 1,
+             "Command log: epoch {} sealed out of order, {} is durable", epoch_nr, durable_epoch_nr.load());
+
+    auto buf = buffer(epoch_nr);
+    auto data_len = nr_txns * record_size;
+    auto frame_size = util::Align(sizeof(CommandLogEpochHeader) + data_len, kBlockSize);
+    auto hdr = (CommandLogEpochHeader *) buf;
+    memset(hdr, 0, sizeof(CommandLogEpochHeader));
+    hdr->magic = CommandLogEpochHeader::kMagic;
+    hdr->record_size = record_size;
+    hdr->epoch_nr = epoch_nr;
+    hdr->nr_txns = nr_txns;
+    hdr->frame_size = frame_size;
+    hdr->checksum = XXH64(hdr + 1, data_len, 0);
+    memset(buf + sizeof(CommandLogEpochHeader) + data_len, 0,
+           frame_size - sizeof(CommandLogEpochHeader) - data_len);
+
+    size_t l = 0;
+    while (l < frame_size) {
+      auto rs = pwrite(fd, buf + l, frame_size - l, write_offset + l);
+      if (rs < 0 && errno == EINTR) continue;
+      abort_if(rs <= 0, "Cannot write epoch {} to the command log, errno={}", epoch_nr, errno);
+      l += rs;
+    }
+    // O_DIRECT bypasses the page cache, but not the disk's write cache.
+    abort_if(fdatasync(fd) < 0, "fdatasync() on the command log failed, errno={}", errno);
+
+    write_offset += frame_size;
+    durable_epoch_nr.store(epoch_nr, std::memory_order_release);
+  }
+}
+
+}
@@ -0,0 +1,104 @@
+// -*- mode: c++ -*-
+
+#ifndef COMMAND_LOG_H
+#define COMMAND_LOG_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace felis {
+
+// Each epoch in the command log is one frame,
+//
+//   CommandLogEpochHeader
+//   nr_txns records, record_size bytes each, in sequence number order
+//   padding up to frame_size, a multiple of kBlockSize
+//
+// The checksum covers the records. Recovery stops at the first frame that is
+// torn or out of order.
+struct CommandLogEpochHeader {
+  static constexpr uint32_t kMagic = 0x444D4346; // "FCMD"
+
+  uint32_t magic;
+  uint32_t record_size;
+  uint64_t epoch_nr;
+  uint64_t nr_txns;
+  uint64_t frame_size;
+  uint64_t checksum; // XXH64 of the records
+  uint64_t __padding__[3];
+};
+
+static_assert(sizeof(CommandLogEpochHeader) == 64);
+
+// Durability for the streaming dispatchers (-XCommandLog). Because execution
+// is deterministic, the marshalled txn inputs of every epoch are all we need
+// to rebuild the database: replay them on the initial data in the same epochs
+// and with the same serial ids.
+//
+// The dispatchers copy each input into the epoch's buffer, at the position of
+// its sequence number, so the shards don't coordinate. The last shard to
+// finish an epoch seals it, and a writer thread writes the whole frame with
+// one O_DIRECT write and fdatasync(). That's the group commit: an epoch is
+// acknowledged to clients only after its frame is durable.
+//
+// There are two buffers. While one is being written, the dispatchers fill the
+// other one. They wait if they get two epochs ahead of the disk.
+class CommandLog {
+ public:
+  static constexpr size_t kBlockSize = 4096;
+  static constexpr int kNrBuffers = 2;
+ private:
+  int fd;
+  size_t record_size;
+  size_t buffer_size;
+  uint8_t *buffers[kNrBuffers];
+  uint64_t write_offset;
+
+  // Frames found by Recover(), mmap()ed.
+  uint8_t *recovered_data = nullptr;
+  size_t recovered_len = 0;
+  std::vector<CommandLogEpochHeader *> recovered;
+
+  std::atomic_ulong durable_epoch_nr = 0;
+
+  std::mutex seal_lock;
+  std::condition_variable seal_cond;
+  std::deque<std::pair<uint64_t, uint64_t>> sealed_epochs; // epoch_nr, nr_txns
+
+  uint8_t *buffer(uint64_t epoch_nr) { return buffers[epoch_nr % kNrBuffers]; }
+  void Recover(const std::string &path);
+  void WriteLoop();
+ public:
+  // Opens or creates the log at path, and recovers whatever epochs are in it.
+  CommandLog(const std::string &path, size_t record_size);
+  CommandLog(const CommandLog &rhs) = delete;
+
+  // Epochs 1 to nr_recovered_epochs() are in the log already. They should be
+  // replayed from recovered_epoch() instead of taking new input, and they are
+  // not logged again.
+  uint64_t nr_recovered_epochs() const { return recovered.size(); }
+  // The records of a recovered epoch and how many there are.
+  std::pair<char *, uint64_t> recovered_epoch(uint64_t epoch_nr) const {
+    auto hdr = recovered[epoch_nr - 1];
+    return {(char *) (hdr + 1), hdr->nr_txns};
+  }
+
+  // Called by every dispatcher shard before it adds txns to epoch_nr. Waits
+  // until the buffer of epoch_nr is free.
+  void WaitForBuffer(uint64_t epoch_nr);
+  void Append(uint64_t epoch_nr, uint64_t seq, const char *input);
+  // Called by the last shard to finish epoch_nr.
+  void Seal(uint64_t epoch_nr, uint64_t nr_txns);
+
+  bool is_durable(uint64_t epoch_nr) const { return durable_epoch_nr.load(std::memory_order_acquire) >= epoch_nr; }
+};
+
+}
+
+#endif /* COMMAND_LOG_H */
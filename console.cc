@@ -1,4 +1,6 @@
 #include "console.h"
+#include "felis_probes.h"
+#include "tracer.h"
 #include <functional>
 
 namespace felis {
@@ -9,6 +11,10 @@ Console::Console()
 {
   g_handlers["status_change"] = &Console::HandleStatusChange;
   g_handlers["get_status"] = &Console::HandleGetStatus;
+  g_handlers["get_probes"] = &Console::HandleGetProbes;
+  g_handlers["set_probe"] = &Console::HandleSetProbe;
+  g_handlers["set_trace"] = &Console::HandleSetTrace;
+  g_handlers["dump_trace"] = &Console::HandleDumpTrace;
 }
 
 static const auto kJsonResponseError = json11::Json::object({
@@ -61,4 +67,43 @@ json11::Json Console::HandleGetStatus(const json11::Json &j)
   return kJsonResponseError;
 }
 
+json11::Json Console::HandleGetProbes(const json11::Json &j)
+{
+  json11::Json::object probes;
+  for (auto &[name, enabled]: probes::ListProbes())
+    probes[name] = enabled;
+  return JsonResponse({{"probes", probes}});
+}
+
+// {"type": "set_probe", "name": "WaitCounters", "enabled": true}
+json11::Json Console::HandleSetProbe(const json11::Json &j)
+{
+  auto name = j["name"].string_value();
+  if (!j["enabled"].is_bool() || !probes::SetEnabled(name, j["enabled"].bool_value()))
+    return kJsonResponseError;
+  return JsonResponse();
+}
+
+// {"type": "set_trace", "enabled": true}
+json11::Json Console::HandleSetTrace(const json11::Json &j)
+{
+  if (!j["enabled"].is_bool())
+    return kJsonResponseError;
+  Tracer::SetEnabled(j["enabled"].bool_value());
+  return JsonResponse();
+}
+
+// {"type": "dump_trace", "path": "/tmp/trace.json"}, in the Chrome trace-event
+// format. Best between epochs, because the cores keep recording.
+json11::Json Console::HandleDumpTrace(const json11::Json &j)
+{
+  auto path = j["path"].string_value();
+  if (path.empty())
+    return kJsonResponseError;
+  auto nr_events = Tracer::Instance().DumpChromeTrace(path);
+  if (nr_events < 0)
+    return kJsonResponseError;
+  return JsonResponse({{"nr_events", (double) nr_events}});
+}
+
 }
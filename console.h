@@ -60,6 +60,10 @@ class Console {
  private:
   json11::Json HandleStatusChange(const json11::Json &j);
   json11::Json HandleGetStatus(const json11::Json &j);
+  json11::Json HandleGetProbes(const json11::Json &j);
+  json11::Json HandleSetProbe(const json11::Json &j);
+  json11::Json HandleSetTrace(const json11::Json &j);
+  json11::Json HandleDumpTrace(const json11::Json &j);
 
   json11::Json JsonResponse() {
     return json11::Json::object({
@@ -1,5 +1,6 @@
 #include <algorithm>
 #include <fstream>
+#include <thread>
 
 #include <syscall.h>
 
@@ -9,6 +10,7 @@
 #include "vhandle.h"
 #include "contention_manager.h"
 #include "threshold_autotune.h"
+#include "epoch_size_autotune.h"
 #include "pwv_graph.h"
 
 #include "console.h"
@@ -16,6 +18,13 @@
 #include "gc.h"
 #include "opts.h"
 #include "commit_buffer.h"
+#include "txn_log.h"
+#include "ingest.h"
+#include "command_log.h"
+#include "checkpoint.h"
+#include "latency_stats.h"
+#include "perf_counters.h"
+#include "tracer.h"
 
 #include "literals.h"
 #include "util/os.h"
@@ -26,6 +35,7 @@ namespace felis {
 EpochClient *EpochClient::g_workload_client = nullptr;
 bool EpochClient::g_enable_granola = false;
 bool EpochClient::g_enable_pwv = false;
+bool EpochClient::g_enable_pipeline = false;
 long EpochClient::g_corescaling_threshold = 0;
 long EpochClient::g_splitting_threshold = std::numeric_limits<long>::max();
 size_t EpochClient::g_txn_per_epoch = 100000;
@@ -39,6 +49,8 @@ void EpochCallback::operator()(unsigned long cnt)
 
   if (cnt == 0) {
     perf.End();
+    if (client->perf_counters) client->perf_counters->EndPhase(p);
+    Tracer::RecordPhase(Tracer::PhaseEnd, util::Instance<EpochManager>().current_epoch_nr(), p);
     //perf.Show(label);
     printf("\n");
 
@@ -115,6 +127,9 @@ long EpochClient::WaitCountPerMS()
 }
 
 static ThresholdAutoTuneController g_threshold_autotune;
+#ifdef DISPATCHER
+static EpochSizeAutoTuneController *g_epoch_size_autotune = nullptr;
+#endif
 
 EpochClient::EpochClient()
     : control(this),
@@ -128,7 +143,7 @@ EpochClient::EpochClient()
   best_duration = std::numeric_limits<int>::max();
   core_limit = conf.g_nr_threads;
 #ifdef DISPATCHER
-  core_limit--;
+  core_limit -= g_nr_dispatchers;
 #endif
 
   auto cnt_len = conf.nr_nodes() * conf.nr_nodes() * PromiseRoutineTransportService::kPromiseMaxLevels;
@@ -136,7 +151,7 @@ EpochClient::EpochClient()
   EpochWorkers *workers_mem = nullptr;
 
 #ifdef DISPATCHER
-  for (int t = 0; t < NodeConfiguration::g_nr_threads - 1; t++) {
+  for (int t = 0; t < NodeConfiguration::g_nr_threads - g_nr_dispatchers; t++) {
 #else
   for (int t = 0; t < NodeConfiguration::g_nr_threads; t++) {
 #endif
@@ -168,6 +183,41 @@ EpochClient::EpochClient()
     g_splitting_threshold = Options::kOnDemandSplitting.ToInt();
   }
 
+  abort_if(g_enable_pipeline && conf.nr_nodes() > 1,
+           "Pipelined epochs only work on a single node");
+  abort_if(g_enable_pipeline && GC::g_background,
+           "The background GC runs in the Execute phase, "
+           "but pipelined epochs append new versions at the same time");
+
+  if (Options::kCheckpoint) {
+    abort_if(g_enable_pipeline,
+             "Checkpoints read the version arrays while an epoch executes, "
+             "but pipelined epochs append to them at the same time");
+    checkpointer = new Checkpointer(
+        Options::kCheckpoint.Get(),
+        Options::kCheckpointInterval.ToLargeNumber("0"),
+        Options::kCheckpointThreads.ToInt(std::to_string(core_limit).c_str()));
+  }
+
+  if (Options::kPerfCounters)
+    perf_counters = new PerfCounters(core_limit);
+
+#ifdef DISPATCHER
+  next_epoch_size = g_txn_per_epoch;
+  if (Options::kEpochLatencySLO) {
+    // -XEpochSize is the largest epoch we will ever try.
+    g_epoch_size_autotune = new EpochSizeAutoTuneController(
+        Options::kEpochLatencySLO.ToLargeNumber(),
+        core_limit,
+        g_txn_per_epoch);
+  }
+#else
+  abort_if(Options::kEpochLatencySLO,
+           "EpochLatencySLO needs the DISPATCHER build. Otherwise all epochs are populated upfront.");
+  abort_if(Options::kCommandLog,
+           "CommandLog needs the DISPATCHER build. Otherwise the input log is all the input.");
+#endif
+
   commit_buffer = new CommitBuffer();
 }
 
@@ -175,7 +225,9 @@ EpochTxnSet::EpochTxnSet()
 {
   auto nr_threads = NodeConfiguration::g_nr_threads;
 #ifdef DISPATCHER
-  nr_threads--;
+  nr_threads -= EpochClient::g_nr_dispatchers;
+  nr_pending_dispatchers = EpochClient::g_nr_dispatchers;
+  nr_txns = 0;
 #endif
   auto d = std::div((int) EpochClient::g_txn_per_epoch, nr_threads);
   for (auto t = 0; t < nr_threads; t++) {
@@ -192,8 +244,43 @@ EpochTxnSet::~EpochTxnSet()
   // TODO: free these pointers via munmap().
 }
 
+#ifdef DISPATCHER
+unsigned long EpochTxnSet::Open(unsigned long nr)
+{
+  unsigned long old = 0;
+  if (!nr_txns.compare_exchange_strong(old, nr))
+    return old;
+
+  // Published to the workers by the release in nr_pending_dispatchers.
+  open_time_ns = time_ns();
+  Resize(nr);
+  return nr;
+}
+
+void EpochTxnSet::Shrink(unsigned long nr)
+{
+  nr_txns.store(nr);
+  Resize(nr);
+}
+#endif
+
+void EpochTxnSet::Resize(unsigned long nr)
+{
+  int nr_threads = NodeConfiguration::g_nr_threads;
+#ifdef DISPATCHER
+  nr_threads -= EpochClient::g_nr_dispatchers;
+#endif
+  auto d = std::div((int) nr, nr_threads);
+  for (auto t = 0; t < nr_threads; t++) {
+    per_core_txns[t]->nr = d.quot + (t < d.rem ? 1 : 0);
+  }
+}
+
 void EpochClient::GenerateBenchmarks()
 {
+  // Unlike PopulateTxnsFromLogs(), this stays on one thread: the workloads
+  // generate txn inputs from a single seeded random generator, and the input
+  // of each serial id should not depend on thread interleaving.
   all_txns = new EpochTxnSet[g_max_epoch - 1];
   for (auto i = 1; i < g_max_epoch; i++) {
     for (uint64_t j = 1; j <= NumberOfTxns(); j++) {
@@ -205,52 +292,101 @@ void EpochClient::GenerateBenchmarks()
   }
 }
 
+#ifdef DISPATCHER
 void EpochDispatcher::Run()
 {
-  uint32_t count = 0;
-  bool before_first_epoch = true;
-  auto &mgr = util::Instance<EpochManager>();
+  auto nr_dispatchers = EpochClient::g_nr_dispatchers;
+  int nr_workers = NodeConfiguration::g_nr_threads - nr_dispatchers;
+  auto txn_size = client->MarshalledTxnSize();
+  uint64_t log_pos = 0; // position of the current epoch's first txn in the log
   long next_ts = time_ns();
-  for (auto i = 1; i < client->g_max_epoch; i++) {
-    for (uint64_t j = 1; j <= client->NumberOfTxns(); j++) {
-      // spin-wait 
-      while(time_ns() < next_ts) _mm_pause();
 
-      if (count >= log_len) {
-        count = 0;
-        read_pos = read_top;
+  // Arrivals are interleaved across shards, so shard d starts d arrivals late
+  // and each of its arrivals is nr_dispatchers arrivals apart.
+  for (int k = 0; ingest == nullptr && k < shard; k++)
+    next_ts += gen_inter_arrival(dist);
+
+  auto cmd_log = client->cmd_log;
+
+  for (auto i = 1; i < client->g_max_epoch; i++) {
+    auto &txn_set = client->all_txns[i - 1];
+    char *replay = nullptr;
+    unsigned long nr_txns = 0;
+    if (cmd_log && i <= cmd_log->nr_recovered_epochs()) {
+      std::tie(replay, nr_txns) = cmd_log->recovered_epoch(i);
+      nr_txns = txn_set.Open(nr_txns);
+    } else {
+      if (cmd_log) cmd_log->WaitForBuffer(i);
+      nr_txns = txn_set.Open(client->next_epoch_size.load());
+    }
+    for (uint64_t j = shard + 1; ingest || j <= nr_txns; j += nr_dispatchers) {
+      char *input;
+      if (replay) {
+        if (j > nr_txns) break;
+        input = replay + (j - 1) * txn_size;
+      } else if (ingest) {
+        // Sequence numbers follow the arrivals, not the shards.
+        input = ingest->WaitForRequest(shard, txn_set.ingest, nr_txns, &j);
+        if (input == nullptr) {
+          // Closed early. Workers only look at the sizes once every shard is
+          // done with this epoch.
+          if (j != 0) txn_set.Shrink(j);
+          break;
+        }
+      } else {
+        // spin-wait
+        while(time_ns() < next_ts) _mm_pause();
+
+        // The log is replayed from the beginning once it runs out.
+        input = read_top + ((log_pos + j - 1) % log_len) * txn_size;
       }
-      auto d = std::div((int)(j - 1), NodeConfiguration::g_nr_threads - 1);
+      auto d = std::div((int)(j - 1), nr_workers);
       auto t = d.rem, pos = d.quot;
       BaseTxn::g_cur_numa_node = t / mem::kNrCorePerNode;
-      
-      client->all_txns[i - 1].per_core_txns[t]->txns[pos] = 
-        client->ParseAndPopulateTxn(client->GenerateSerialId(i, j), read_pos);
-      if (before_first_epoch) {
-        client->g_workload_client->Start();
-        before_first_epoch = false;
-      } 
-      
-      count++;
-      next_ts += gen_inter_arrival(dist);
+
+      if (cmd_log && !replay)
+        cmd_log->Append(i, j, input);
+      txn_set.per_core_txns[t]->txns[pos] =
+        client->ParseAndPopulateTxn(client->GenerateSerialId(i, j), input);
+      if (i == 1 && j == 1)
+        client->Start();
+
+      if (replay)
+        continue;
+      if (ingest) {
+        ingest->FinishRequest(shard, i, j);
+        continue;
+      }
+      for (int k = 0; k < nr_dispatchers; k++)
+        next_ts += gen_inter_arrival(dist);
     }
-#ifdef DISPATCHER
-    // mark ready epochs and only trigger the first
-    mgr.ready_epoch_nr.fetch_add(1);
-#endif
+    log_pos += nr_txns;
+    // The last shard to finish makes this epoch ready for InitializeEpoch().
+    bool last = txn_set.nr_pending_dispatchers.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    if (last && cmd_log && !replay)
+      cmd_log->Seal(i, txn_set.nr_txns.load());
   }
 }
 
-void EpochClient::InitializeDispatcher(char* input, uint32_t count, std::string gen_type)
+void EpochClient::InitializeDispatcher(char* input, uint32_t count, std::string gen_type,
+                                       IngestService *ingest)
 {
-  dispatcher = new EpochDispatcher(input, count, this, const_cast<char*>(gen_type.c_str()));
+  abort_if(g_nr_dispatchers < 1 || g_nr_dispatchers >= NodeConfiguration::g_nr_threads,
+           "Need at least one dispatcher and one worker, but we have {} dispatchers out of {} cores",
+           g_nr_dispatchers, NodeConfiguration::g_nr_threads);
+  // The log replays from epoch 1, on top of the loaded dataset.
+  abort_if(Options::kCommandLog && Options::kLoadCheckpoint,
+           "CommandLog cannot be replayed on top of a checkpoint yet");
+  if (Options::kCommandLog)
+    cmd_log = new CommandLog(Options::kCommandLog.Get(), MarshalledTxnSize());
+  for (int d = 0; d < g_nr_dispatchers; d++) {
+    dispatchers[d] = new EpochDispatcher(input, count, this, d, gen_type, ingest);
+  }
+  this->ingest = ingest;
   all_txns = new EpochTxnSet[g_max_epoch - 1];
 
 #ifdef LATENCY
-#define LOG_SIZE 400'000'000
-  //log_arr = new std::vector<uint32_t>();
-  log_arr = new std::vector<long long>();
-  log_arr->reserve(LOG_SIZE);
+  latency_stats = new TxnLatencyStats();
 #endif
 
   util::Instance<Console>().UpdateServerStatus(Console::ServerStatus::Listening);
@@ -259,32 +395,59 @@ void EpochClient::InitializeDispatcher(char* input, uint32_t count, std::string
   abort_if(g_workload_client == nullptr,
            "Workload Module did not setup the EpochClient properly");
 
-  // pin the dispatcher to the last core
-  go::GetSchedulerFromPool(NodeConfiguration::g_nr_threads)->WakeUp(dispatcher);
+  // pin the dispatchers to the last cores
+  for (int d = 0; d < g_nr_dispatchers; d++) {
+    go::GetSchedulerFromPool(NodeConfiguration::g_nr_threads - d)->WakeUp(dispatchers[d]);
+  }
 
   util::Instance<Console>().WaitForServerStatus(Console::ServerStatus::Exiting); 
   go::WaitThreadPool();
 }
+#endif
 
-void EpochClient::PopulateTxnsFromLogs(char* &input, uint32_t log_len)
+void EpochClient::PopulateTxnsFromLogs(const TxnLog &log)
 {
-  char* read_top = input;
-  uint32_t count = 0;
   all_txns = new EpochTxnSet[g_max_epoch - 1];
-  for (auto i = 1; i < g_max_epoch; i++) {
-    for (uint64_t j = 1; j <= NumberOfTxns(); j++) {
-      if (count >= log_len) {
-        count = 0;
-        input = read_top;
-      }
-      auto d = std::div((int)(j - 1), NodeConfiguration::g_nr_threads);
-      auto t = d.rem, pos = d.quot;
-      BaseTxn::g_cur_numa_node = t / mem::kNrCorePerNode;
-      all_txns[i - 1].per_core_txns[t]->txns[pos] =
-        ParseAndPopulateTxn(GenerateSerialId(i, j), input);
-      count++;
+  int nr_threads = NodeConfiguration::g_nr_threads;
+  // Follow the epochs in the log if it has them all. Otherwise, cut it into
+  // g_txn_per_epoch sized epochs and wrap around.
+  bool use_epoch_table = log.nr_epochs() >= g_max_epoch - 1;
+
+  if (use_epoch_table) {
+    for (auto i = 1; i < g_max_epoch; i++) {
+      auto [start, end] = log.epoch_range(i);
+      abort_if(end - start > g_txn_per_epoch, "Epoch {} in the log has {} txns, more than EpochSize {}",
+               i, end - start, g_txn_per_epoch);
+      all_txns[i - 1].Resize(end - start);
     }
   }
+
+  // Every core fills its own per_core_txns[t] for all epochs, so the txns it
+  // is going to run come from its own NUMA node. Records can be located
+  // directly and parsing has no shared state, so the cores don't coordinate.
+  std::vector<std::thread> tasks;
+  for (int t = 0; t < nr_threads; t++) {
+    tasks.emplace_back(
+        [this, &log, t, nr_threads, use_epoch_table]() {
+          util::Cpu info;
+          info.set_affinity(t);
+          info.Pin();
+          BaseTxn::g_cur_numa_node = t / mem::kNrCorePerNode;
+
+          for (auto i = 1; i < g_max_epoch; i++) {
+            uint64_t first = (i - 1) * NumberOfTxns();
+            if (use_epoch_table)
+              first = log.epoch_range(i).first;
+            auto set = all_txns[i - 1].per_core_txns[t];
+            for (uint64_t pos = 0; pos < set->nr; pos++) {
+              uint64_t j = pos * nr_threads + t + 1;
+              char *input = log.record((first + j - 1) % log.size());
+              set->txns[pos] = ParseAndPopulateTxn(GenerateSerialId(i, j), input);
+            }
+          }
+        });
+  }
+  for (auto &t: tasks) t.join();
 }
 
 void EpochClient::Start()
@@ -332,12 +495,29 @@ void CallTxnsWorker::Run()
   set_urgent(true);
   auto pq = client->cur_txns.load()->per_core_txns[t];
 
+  if (client->perf_counters) client->perf_counters->OpenForCurrentThread(t);
+
   while (AllocStateTxnWorker::comp.load() != 0) _mm_pause();
 
+  if (mem_func == nullptr) {
+    // This epoch ran Insert and Initialize in the pipeline. All that is left
+    // is what the pipeline could not do while the last epoch was executing.
+    client->commit_buffer->Clear(t);
+    util::Instance<GC>().RunGC();
+    client->workers[t]->pipeline_worker.ApplyDeferredAppends(
+        util::Instance<EpochManager>().current_epoch_nr());
+  }
+
   for (auto i = 0; i < pq->nr; i++) {
     auto txn = pq->txns[i];
     txn->ResetRoot();
-    std::invoke(mem_func, txn);
+#if defined(DISPATCHER) && defined(LATENCY)
+    if (client->callback.phase == EpochPhase::Execute) {
+      std::chrono::duration<double> delay = std::chrono::system_clock::now() - txn->init_time;
+      txn->queue_delay = static_cast<uint32_t>(delay.count() * 1'000'000);
+    }
+#endif
+    if (mem_func) std::invoke(mem_func, txn);
     client->conf.CollectBufferPlan(txn->root_promise(), cnt);
   }
 
@@ -389,7 +569,7 @@ void CallTxnsWorker::Run()
 
     size_t worker_cnt = NodeConfiguration::g_nr_threads;
 #ifdef DISPATCHER
-    worker_cnt--;
+    worker_cnt -= EpochClient::g_nr_dispatchers;
 #endif
     while (EpochClient::g_enable_granola && g_finished.load() != worker_cnt)
       _mm_pause();
@@ -417,13 +597,14 @@ void EpochClient::CallTxns(uint64_t epoch_nr, TxnMemberFunc func, const char *la
 {
   auto nr_threads = NodeConfiguration::g_nr_threads;
 #ifdef DISPATCHER
-  nr_threads--;
+  nr_threads -= g_nr_dispatchers;
 #endif
   conf.ResetBufferPlan();
   conf.SendStartPhase();
   callback.label = label;
   callback.perf.Clear();
   callback.perf.Start();
+  Tracer::RecordPhase(Tracer::PhaseBegin, epoch_nr, callback.phase);
 
   if ((EpochClient::g_enable_granola || EpochClient::g_enable_pwv) && callback.phase == EpochPhase::Execute)
     CallTxnsWorker::g_finished = 0;
@@ -462,24 +643,46 @@ void EpochClient::CallTxns(uint64_t epoch_nr, TxnMemberFunc func, const char *la
 void EpochClient::InitializeEpoch()
 {
   auto &mgr = util::Instance<EpochManager>();
+  auto nr_threads = NodeConfiguration::g_nr_threads;
+#ifdef DISPATCHER
+  nr_threads -= g_nr_dispatchers;
+#endif
+
+  bool pipelined = (pipelined_epoch_nr == mgr.current_epoch_nr() + 1);
+  if (pipelined) {
+    // We might be running on a worker core, so let the pipeline run there.
+    while (PipelineTxnWorker::g_stage_finished[PipelineTxnWorker::kNrStages - 1] != nr_threads)
+      go::Scheduler::Current()->RunNext(go::Scheduler::NextReadyState);
+  }
+
   mgr.DoAdvance(this);
   auto epoch_nr = mgr.current_epoch_nr();
 
 #ifdef DISPATCHER
   // spin waiting if the epoch is not ready yet
-  while(epoch_nr > mgr.get_ready_epoch_nr()) _mm_pause();
+  while (!all_txns[epoch_nr - 1].is_ready()) _mm_pause();
   //logger->info("Safe to trigger the next epoch {}", epoch_nr);
 #endif
 
-  util::Impl<PromiseAllocationService>().Reset();
+  // Before the GC runs in the Insert phase.
+  if (checkpointer) checkpointer->OnEpochBegin(epoch_nr);
 
-  auto nr_threads = NodeConfiguration::g_nr_threads;
-#ifdef DISPATCHER
-  nr_threads--;
-#endif
+  // The last checkpoint is done, and the next one only starts after the
+  // Initialize phase.
+  auto &tables = util::Instance<TableManager>();
+  for (int i = 0; i < TableManager::kMaxNrRelations; i++) {
+    auto table = tables.GetTable(i);
+    if (table) table->ApplyQueuedDeletes();
+  }
+
+  util::Impl<PromiseAllocationService>().Reset();
 
   cur_txns = &all_txns[epoch_nr - 1];
-  total_nr_txn = NumberOfTxns();
+  total_nr_txn = 0;
+  for (auto t = 0; t < nr_threads; t++) {
+    total_nr_txn += cur_txns.load()->per_core_txns[t]->nr;
+  }
+  nr_txns_done += total_nr_txn;
 
   cont_lmgr.Reset();
 
@@ -488,6 +691,13 @@ void EpochClient::InitializeEpoch()
   util::Instance<GC>().PrepareGCForAllCores();
 
   commit_buffer->Reset();
+
+  if (pipelined) {
+    callback.phase = EpochPhase::Initialize;
+    CallTxns(epoch_nr, nullptr, "Initialization");
+    return;
+  }
+
   AllocStateTxnWorker::comp = nr_threads + 1;
   for (auto t = 0; t < nr_threads; t++) {
     auto r = &workers[t]->alloc_state_worker;
@@ -536,6 +746,7 @@ void EpochClient::OnInitializeComplete()
   }
 
   util::Impl<VHandleSyncService>().ClearWaitCountStats();
+  util::Instance<GC>().StartBackground();
 
   // exec_lmgr.PrintLoads();
   if (!Options::kBinpackSplitting) {
@@ -545,28 +756,131 @@ void EpochClient::OnInitializeComplete()
 
   auto &mgr = util::Instance<EpochManager>();
 
+  // Start the pipeline before issuing, because the control routine cannot do
+  // anything after the Execute phase might have completed.
+  if (g_enable_pipeline)
+    StartPipeline(mgr.current_epoch_nr() + 1);
+
+  if (checkpointer) checkpointer->OnInitializeComplete(mgr.current_epoch_nr());
+
   CallTxns(
       util::Instance<EpochManager>().current_epoch_nr(),
       &BaseTxn::Run0,
       "Execution");
 }
 
+void EpochClient::StartPipeline(uint64_t epoch_nr)
+{
+  if (epoch_nr >= g_max_epoch)
+    return;
+#ifdef DISPATCHER
+  // Never wait for the dispatchers here. This epoch will run serially instead.
+  if (!all_txns[epoch_nr - 1].is_ready())
+    return;
+#endif
+
+  auto nr_threads = NodeConfiguration::g_nr_threads;
+#ifdef DISPATCHER
+  nr_threads -= g_nr_dispatchers;
+#endif
+
+  util::Instance<EpochManager>().OpenNextEpoch(this);
+  next_txns = &all_txns[epoch_nr - 1];
+  pipelined_epoch_nr = epoch_nr;
+
+  for (auto &c: PipelineTxnWorker::g_stage_finished) c = 0;
+  for (auto t = 0; t < nr_threads; t++) {
+    auto r = &workers[t]->pipeline_worker;
+    r->Reset();
+    go::GetSchedulerFromPool(t + 1)->WakeUp(r);
+  }
+}
+
+void EpochClient::DeferAppend(VHandle *row, uint64_t sid, int ondemand_split_weight)
+{
+  auto core_id = go::Scheduler::CurrentThreadPoolId() - 1;
+  workers[core_id]->pipeline_worker.DeferAppend(row, sid, ondemand_split_weight);
+}
+
+void PipelineTxnWorker::WaitForStage(int stage)
+{
+  auto nr_workers = nr_threads;
+#ifdef DISPATCHER
+  nr_workers -= EpochClient::g_nr_dispatchers;
+#endif
+  g_stage_finished[stage].fetch_add(1);
+  while (g_stage_finished[stage].load() != nr_workers)
+    go::Scheduler::Current()->RunNext(go::Scheduler::NextReadyState);
+}
+
+void PipelineTxnWorker::Run()
+{
+  // Unlike CallTxnsWorker, we are not urgent. Pieces of the executing epoch
+  // always go first, and we yield to them every few txns.
+  static constexpr int kYieldInterval = 32;
+  static TxnMemberFunc stage_funcs[] = {
+    &BaseTxn::PrepareInsert0,
+    &BaseTxn::Prepare0,
+  };
+  auto pq = client->next_txns.load()->per_core_txns[t];
+
+  for (auto i = 0; i < pq->nr; i++) {
+    pq->txns[i]->PrepareState();
+  }
+  WaitForStage(0);
+
+  for (int s = 1; s < kNrStages; s++) {
+    for (auto i = 0; i < pq->nr; i++) {
+      auto txn = pq->txns[i];
+      txn->ResetRoot();
+      std::invoke(stage_funcs[s - 1], txn);
+      abort_if(txn->root_promise()->nr_routines() > 0,
+               "Pipelined epochs require Insert and Initialize to finish inline, "
+               "but txn {} issued pieces", txn->serial_id());
+      if ((i + 1) % kYieldInterval == 0)
+        go::Scheduler::Current()->RunNext(go::Scheduler::NextReadyState);
+    }
+    if (s < kNrStages - 1)
+      WaitForStage(s);
+  }
+  g_stage_finished[kNrStages - 1].fetch_add(1);
+}
+
+void PipelineTxnWorker::ApplyDeferredAppends(uint64_t epoch_nr)
+{
+  for (auto &a: deferred_appends) {
+    a.row->AppendNewVersion(a.sid, epoch_nr, a.ondemand_split_weight);
+  }
+  deferred_appends.clear();
+}
+
 void EpochClient::OnExecuteComplete()
 {
   stats.execution_time_ms += callback.perf.duration_ms();
+  util::Instance<GC>().StopBackground();
   fmt::memory_buffer buf;
   long ctt = 0;
   auto cur_epoch_nr = util::Instance<EpochManager>().current_epoch_nr();
   size_t worker_cnt = NodeConfiguration::g_nr_threads;
 #ifdef DISPATCHER
-  worker_cnt--;
+  worker_cnt -= EpochClient::g_nr_dispatchers;
 #endif
   for (int i = 0; i < worker_cnt; i++) {
     auto c = util::Impl<VHandleSyncService>().GetWaitCountStat(i);
     ctt += c / core_limit;
     fmt::format_to(buf, "{} ", c);
+    if (perf_counters) perf_counters->AddWaitCount(i, c);
   }
   //logger->info("Wait Counts {}", std::string_view(buf.begin(), buf.size()));
+  if (Options::kWorkStealing) {
+    auto &svc = util::Impl<PromiseRoutineDispatchService>();
+    fmt::memory_buffer steal_buf;
+    for (int i = 0; i < worker_cnt; i++) {
+      fmt::format_to(steal_buf, "{} ", svc.GetStealCountStat(i));
+    }
+    logger->info("Steals {}", std::string_view(steal_buf.begin(), steal_buf.size()));
+    svc.ClearStealCountStats();
+  }
   if (Options::kCoreScaling && cur_epoch_nr > 1) {
     auto ctt_rate = ctt / callback.perf.duration_ms();
 
@@ -599,6 +913,17 @@ void EpochClient::OnExecuteComplete()
 
   probes::EndOfPhase{cur_epoch_nr, 2}();
 
+#ifdef DISPATCHER
+  if (cmd_log) {
+    // Group commit. Nothing in this epoch is acknowledged before its inputs
+    // are durable. Usually the log has caught up long ago.
+    while (!cmd_log->is_durable(cur_epoch_nr)) _mm_pause();
+  }
+  // Replayed epochs were acknowledged before the restart.
+  if (ingest && (cmd_log == nullptr || cur_epoch_nr > cmd_log->nr_recovered_epochs()))
+    ingest->OnEpochCommit(cur_epoch_nr, all_txns[cur_epoch_nr - 1].nr_txns);
+#endif
+
   if (Options::kAutoTuneThreshold) {
     g_splitting_threshold = g_threshold_autotune.GetNextThreshold(
         g_splitting_threshold,
@@ -607,24 +932,43 @@ void EpochClient::OnExecuteComplete()
     logger->info("Autotune threshold={}", g_splitting_threshold);
   }
 
-  if (cur_epoch_nr + 1 < g_max_epoch) {
 #if defined(DISPATCHER) && defined(LATENCY)
-    // collecting all duration before dealloc
-    auto epoch_id = util::Instance<EpochManager>().current_epoch_nr();
-    for (int t = 0; t < NodeConfiguration::g_nr_threads - 1; t++) {
-      for (int i = 0; i < all_txns[epoch_id - 1].per_core_txns[t]->nr; i++) {
-        auto d = all_txns[epoch_id - 1].per_core_txns[t]->txns[i]->duration;
-        //log_arr->push_back(static_cast<long long>(d.count()));
-        log_arr->push_back(d);
-      }
+  // Some workloads record the duration from inside their pieces, so it is
+  // only final now that the epoch is done.
+  for (int t = 0; t < NodeConfiguration::g_nr_threads - g_nr_dispatchers; t++) {
+    auto set = all_txns[cur_epoch_nr - 1].per_core_txns[t];
+    for (int i = 0; i < set->nr; i++) {
+      auto txn = set->txns[i];
+      latency_stats->Add(txn->txn_type_id(), txn->duration, txn->queue_delay);
+    }
+  }
+  long p99_us = latency_stats->EpochPercentile(0.99);
+  latency_stats->EndEpoch(cur_epoch_nr);
+#endif
+
+  if (cur_epoch_nr + 1 < g_max_epoch) {
+#ifdef DISPATCHER
+    if (g_epoch_size_autotune) {
+      auto &txn_set = all_txns[cur_epoch_nr - 1];
+      int phase_time_ms = stats.insert_time_ms + stats.initialize_time_ms + stats.execution_time_ms;
+      long epoch_time_us = (phase_time_ms - stats.last_phase_time_ms) * 1000L;
+      stats.last_phase_time_ms = phase_time_ms;
+#ifndef LATENCY
+      // Without per-txn latencies, the first txn of this epoch has waited the
+      // longest. Its latency is an upper bound of p99.
+      long p99_us = (time_ns() - txn_set.open_time_ns) / 1000;
+#endif
+      next_epoch_size = g_epoch_size_autotune->GetNextEpochSize(
+          txn_set.nr_txns, p99_us, epoch_time_us);
     }
 #endif
     InitializeEpoch();
   } else {
     // End of the experiment.
+    if (checkpointer) checkpointer->WaitForCompletion();
     perf.Show("All epochs done in");
-    auto thr = NumberOfTxns() * 1000 * (g_max_epoch - 1) / perf.duration_ms();
-    logger->info("NumberOfTxns {}, g_max_epoch {}", NumberOfTxns(), g_max_epoch);
+    auto thr = nr_txns_done * 1000 / perf.duration_ms();
+    logger->info("NumberOfTxns {}, g_max_epoch {}", nr_txns_done, g_max_epoch);
     logger->info("Throughput {} txn/s", thr);
     logger->info("Insert / Initialize / Execute {} ms {} ms {} ms",
                  stats.insert_time_ms, stats.initialize_time_ms, stats.execution_time_ms);
@@ -640,6 +984,11 @@ void EpochClient::OnExecuteComplete()
         {"initialize_time", stats.initialize_time_ms},
         {"execution_time", stats.execution_time_ms},
       };
+      if (perf_counters)
+        result["perf_counters"] = perf_counters->ToJson();
+#if defined(DISPATCHER) && defined(LATENCY)
+      result["latency"] = latency_stats->ToJson([this](int type) { return TxnTypeName(type); });
+#endif
       auto node_name = util::Instance<NodeConfiguration>().config().name;
       time_t tm;
       char now[80];
@@ -651,10 +1000,10 @@ void EpochClient::OnExecuteComplete()
 #if defined(DISPATCHER) && defined(LATENCY)
       std::ofstream latency_output(
           Options::kOutputDir.Get() + "/" + node_name + "latency" + now + ".txt");
-      for (auto i : *log_arr)
-        latency_output << i << "\n";
-      latency_output << std::endl;
+      latency_stats->DumpBuckets(latency_output);
 #endif
+      if (Tracer::g_enabled)
+        Tracer::Instance().DumpChromeTrace(Options::kOutputDir.Get() + "/" + node_name + "trace" + now + ".json");
     }
     conf.CloseAndShutdown();
     util::Instance<Console>().UpdateServerStatus(Console::ServerStatus::Exiting);
@@ -670,7 +1019,7 @@ EpochPromiseAllocationService::EpochPromiseAllocationService()
   size_t acc = 0;
   size_t worker_cnt = NodeConfiguration::g_nr_threads;
 #ifdef DISPATCHER
-  worker_cnt--;
+  worker_cnt -= EpochClient::g_nr_dispatchers;
 #endif
   for (size_t i = 0; i <= worker_cnt; i++) {
     auto s = kEpochPromiseAllocationWorkerLimit / worker_cnt;
@@ -709,7 +1058,7 @@ void *EpochPromiseAllocationService::Alloc(size_t size)
 void EpochPromiseAllocationService::Reset()
 {
 #ifdef DISPATCHER
-  for (size_t i = 0; i <= NodeConfiguration::g_nr_threads - 1; i++) {
+  for (size_t i = 0; i <= NodeConfiguration::g_nr_threads - EpochClient::g_nr_dispatchers; i++) {
 #else
   for (size_t i = 0; i <= NodeConfiguration::g_nr_threads; i++) {
 #endif
@@ -765,6 +1114,8 @@ void EpochMemory::Reset()
 
 Epoch *EpochManager::epoch(uint64_t epoch_nr) const
 {
+  if (epoch_nr != cur_epoch_nr && epoch_nr == next_epoch_nr)
+    return next_epoch;
   abort_if(epoch_nr != cur_epoch_nr, "Confused by epoch_nr {} since current epoch is {}",
            epoch_nr, cur_epoch_nr);
   return cur_epoch;
@@ -772,7 +1123,7 @@ Epoch *EpochManager::epoch(uint64_t epoch_nr) const
 
 uint8_t *EpochManager::ptr(uint64_t epoch_nr, int node_id, uint64_t offset) const
 {
-  abort_if(epoch_nr != cur_epoch_nr,
+  abort_if(epoch_nr != cur_epoch_nr && epoch_nr != next_epoch_nr,
            "Confused by epoch_nr {} since current epoch is {}, node {}, offset "
            "{}, current core {}",
            epoch_nr, cur_epoch_nr, node_id, offset, go::Scheduler::CurrentThreadPoolId() - 1);
@@ -783,19 +1134,37 @@ static Epoch *g_epoch; // We don't support concurrent epochs for now.
 
 void EpochManager::DoAdvance(EpochClient *client)
 {
+  if (next_epoch_nr == cur_epoch_nr + 1) {
+    // The pipeline has opened the next epoch already. Just take turns.
+    auto e = cur_epoch.load();
+    cur_epoch = next_epoch;
+    next_epoch = e;
+    std::swap(mem, next_mem);
+    cur_epoch_nr.fetch_add(1);
+    return;
+  }
   cur_epoch_nr.fetch_add(1);
   cur_epoch.load()->~Epoch();
   cur_epoch = new (cur_epoch) Epoch(cur_epoch_nr, client, mem);
   //logger->info("We are going into epoch {}", cur_epoch_nr);
 }
 
-EpochManager::EpochManager(EpochMemory *mem, Epoch *epoch)
-    : cur_epoch_nr(0), cur_epoch(epoch), mem(mem)
-#ifdef DISPATCHER
-      , ready_epoch_nr(0)
-#endif
+void EpochManager::OpenNextEpoch(EpochClient *client)
+{
+  abort_if(next_mem == nullptr, "Pipelined epochs are not enabled");
+  auto epoch_nr = cur_epoch_nr + 1;
+  next_epoch->~Epoch();
+  next_epoch = new (next_epoch) Epoch(epoch_nr, client, next_mem);
+  next_epoch_nr = epoch_nr;
+}
+
+EpochManager::EpochManager(EpochMemory *mem, Epoch *epoch,
+                           EpochMemory *next_mem, Epoch *next_epoch)
+    : cur_epoch_nr(0), cur_epoch(epoch), mem(mem),
+      next_mem(next_mem), next_epoch(next_epoch), next_epoch_nr(0)
 {
   cur_epoch.load()->mem = mem;
+  if (next_epoch) next_epoch->mem = next_mem;
 }
 
 }
@@ -808,9 +1177,15 @@ EpochManager *InstanceInit<EpochManager>::instance = nullptr;
 
 InstanceInit<EpochManager>::InstanceInit()
 {
-  // We currently do not support concurrent epochs.
+  // At most two epochs run concurrently, and only with pipelining.
   static Epoch g_epoch;
   static EpochMemory mem;
+  if (EpochClient::g_enable_pipeline) {
+    static Epoch g_next_epoch;
+    static EpochMemory next_mem;
+    instance = new EpochManager(&mem, &g_epoch, &next_mem, &g_next_epoch);
+    return;
+  }
   instance = new EpochManager(&mem, &g_epoch);
 }
 
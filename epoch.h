@@ -3,18 +3,27 @@
 
 #include <cstdint>
 #include <array>
+#include <string>
+#include <vector>
 #include "node_config.h"
 #include "mem.h"
 #include "completion.h"
 #include "shipping.h"
 #include "locality_manager.h"
 #include "lancet/inter_arrival.h"
+#include "ingest.h"
 
 namespace felis {
 
 class Epoch;
 class BaseTxn;
 class EpochClient;
+class VHandle;
+class TxnLog;
+class CommandLog;
+class Checkpointer;
+class TxnLatencyStats;
+class PerfCounters;
 
 using EpochMemberFunc = void (EpochClient::*)();
 
@@ -32,18 +41,31 @@ class EpochControl : public go::Routine {
   }
 };
 
+// With g_nr_dispatchers > 1, every dispatcher owns an interleaved shard of
+// each epoch's sequence numbers: shard d parses sequence d + 1, d + 1 + N, ...
+// Since the input log has fixed-size records, every dispatcher can seek to its
+// records directly and all of them write into the EpochTxnSet in parallel.
+//
+// With an IngestService, txns come from clients instead of the log, and they
+// are dispatched as soon as they arrive.
+//
+// With a CommandLog, the epochs it recovered are replayed first, and the inputs
+// of the new epochs are logged.
 class EpochDispatcher : public go::Routine {
   char* read_top;
-  char* read_pos;
   uint32_t log_len;
-  EpochClient *client; 
-  struct rand_gen *dist; // inter-arrival distribution
+  EpochClient *client;
+  int shard;
+  IngestService *ingest;
+  struct rand_gen *dist = nullptr; // inter-arrival distribution
 public:
-  EpochDispatcher(char* read_top, uint32_t log_len, EpochClient *client, char *gen_type)
-    : read_top(read_top), log_len(log_len), client(client)
+  EpochDispatcher(char* read_top, uint32_t log_len, EpochClient *client, int shard, std::string gen_type,
+                  IngestService *ingest = nullptr)
+    : read_top(read_top), log_len(log_len), client(client), shard(shard), ingest(ingest)
   {
-    read_pos = read_top;
-    dist = lancet_init_rand(gen_type);
+    if (ingest) return;
+    // lancet tokenizes the spec in place, so every shard parses its own copy.
+    dist = lancet_init_rand(gen_type.data());
 #if 0
     for (int i = 0; i < 10; i++) {
       printf("gen_ia is %ld\n", gen_inter_arrival(dist));
@@ -95,12 +117,38 @@ class AllocStateTxnWorker : public EpochClientBaseWorker {
   void Run() override final;
 };
 
+// Runs PrepareState(), Insert and Initialize of the next epoch in the
+// background while the current epoch executes. Version appends cannot touch
+// the rows yet, so they are held here and applied at the epoch boundary.
+class PipelineTxnWorker : public EpochClientBaseWorker {
+  struct DeferredAppend {
+    VHandle *row;
+    uint64_t sid;
+    int ondemand_split_weight;
+  };
+  std::vector<DeferredAppend> deferred_appends;
+
+  void WaitForStage(int stage);
+ public:
+  static constexpr int kNrStages = 3; // PrepareState, Insert, Initialize
+  static inline std::atomic_int g_stage_finished[kNrStages];
+
+  using EpochClientBaseWorker::EpochClientBaseWorker;
+  void Run() override final;
+
+  void DeferAppend(VHandle *row, uint64_t sid, int ondemand_split_weight) {
+    deferred_appends.push_back({row, sid, ondemand_split_weight});
+  }
+  void ApplyDeferredAppends(uint64_t epoch_nr);
+};
+
 struct EpochWorkers {
   CallTxnsWorker call_worker;
   AllocStateTxnWorker alloc_state_worker;
+  PipelineTxnWorker pipeline_worker;
 
   EpochWorkers(int t, EpochClient *client)
-      : call_worker(t, client), alloc_state_worker(t, client) {}
+      : call_worker(t, client), alloc_state_worker(t, client), pipeline_worker(t, client) {}
 };
 
 enum EpochPhase : int {
@@ -129,6 +177,23 @@ struct EpochTxnSet {
     TxnSet(size_t nr) : nr(nr) {}
   };
   std::array<TxnSet *, NodeConfiguration::kMaxNrThreads> per_core_txns;
+  // Spread nr txns over the cores. nr is at most g_txn_per_epoch.
+  void Resize(unsigned long nr);
+#ifdef DISPATCHER
+  // Number of dispatchers still populating this epoch. The epoch is ready to
+  // run once this reaches 0.
+  std::atomic_int nr_pending_dispatchers;
+  bool is_ready() const { return nr_pending_dispatchers.load(std::memory_order_acquire) == 0; }
+
+  // Number of txns in this epoch, at most g_txn_per_epoch. The first
+  // dispatcher reaching this epoch decides it, and the others follow.
+  std::atomic_ulong nr_txns;
+  long open_time_ns;
+  unsigned long Open(unsigned long nr);
+  // An epoch of txns from clients might close before it has nr_txns.
+  IngestEpoch ingest;
+  void Shrink(unsigned long nr);
+#endif
   EpochTxnSet();
   ~EpochTxnSet();
 };
@@ -140,6 +205,7 @@ class EpochClient {
   friend class RunTxnPromiseWorker;
   friend class CallTxnsWorker;
   friend class AllocStateTxnWorker;
+  friend class PipelineTxnWorker;
   friend class EpochExecutionDispatchService;
   friend class ContentionManager;
   friend class EpochDispatcher;
@@ -153,36 +219,62 @@ class EpochClient {
     int insert_time_ms = 0;
     int initialize_time_ms = 0;
     int execution_time_ms = 0;
+    int last_phase_time_ms = 0; // for per-epoch deltas
   } stats;
 
   PerfLog perf;
   EpochControl control;
-  EpochDispatcher *dispatcher;
+  EpochDispatcher *dispatchers[NodeConfiguration::kMaxNrThreads];
+#ifdef DISPATCHER
+  // Size of the epochs the dispatchers will open next, see EpochTxnSet::Open().
+  std::atomic_ulong next_epoch_size;
+  // Notified when epochs commit, if the dispatchers take txns from clients.
+  IngestService *ingest = nullptr;
+  // Inputs of every epoch are logged here if -XCommandLog is set.
+  CommandLog *cmd_log = nullptr;
+#endif
   EpochWorkers *workers[NodeConfiguration::kMaxNrThreads];
+  // Takes snapshots in the background if -XCheckpoint is set.
+  Checkpointer *checkpointer = nullptr;
+  // Sampled at the end of every phase if -XPerfCounters is set.
+  PerfCounters *perf_counters = nullptr;
 
   CommitBuffer *commit_buffer;
  public:
   static EpochClient *g_workload_client;
   static bool g_enable_granola;
   static bool g_enable_pwv;
+  static bool g_enable_pipeline;
 
   static long g_corescaling_threshold;
   static long g_splitting_threshold;
 
+  // Number of cores dedicated to EpochDispatcher. They are taken from the end
+  // of the core list.
+  static inline int g_nr_dispatchers = 1;
+
   EpochClient();
   virtual ~EpochClient() {}
 
   uint64_t GenerateSerialId(uint64_t epoch_nr, uint64_t sequence);
   void GenerateBenchmarks();
-  void InitializeDispatcher(char* input, uint32_t count, std::string gen_type);
-  void PopulateTxnsFromLogs(char* &input, uint32_t log_len);
+  void InitializeDispatcher(char* input, uint32_t count, std::string gen_type,
+                            IngestService *ingest = nullptr);
+  void PopulateTxnsFromLogs(const TxnLog &log);
   void Start();
 
+  // Called by txns of a pipelined epoch, see PipelineTxnWorker.
+  void DeferAppend(VHandle *row, uint64_t sid, int ondemand_split_weight);
+
   auto completion_object() { return &completion; }
   EpochWorkers *get_worker(int core_id) { return workers[core_id]; }
   LocalityManager &get_contention_locality_manager() { return cont_lmgr; }
 
   virtual unsigned int LoadPercentage() = 0;
+  // Size of a marshalled txn record in the input log.
+  virtual size_t MarshalledTxnSize() = 0;
+  // Name of BaseTxn::txn_type_id() in the latency stats.
+  virtual std::string TxnTypeName(int type_id) { return "txn"; }
   unsigned long NumberOfTxns() {
     // return LoadPercentage() * kTxnPerEpoch / 100;
     return g_txn_per_epoch;
@@ -206,6 +298,7 @@ class EpochClient {
 
   void RunTxnPromises(const char *label);
   void CallTxns(uint64_t epoch_nr, TxnMemberFunc func, const char *label);
+  void StartPipeline(uint64_t epoch_nr);
 
   void OnInsertComplete();
   void OnInitializeComplete();
@@ -217,11 +310,13 @@ class EpochClient {
 
   EpochTxnSet *all_txns;
   std::atomic<EpochTxnSet *> cur_txns;
+  std::atomic<EpochTxnSet *> next_txns; // pipelined epoch
+  uint64_t pipelined_epoch_nr = 0;
   unsigned long total_nr_txn;
+  unsigned long nr_txns_done = 0;
   unsigned long *per_core_cnts[NodeConfiguration::kMaxNrThreads];
 #if defined(DISPATCHER) && defined(LATENCY)
-  //std::vector<uint32_t>* log_arr;
-  std::vector<long long>* log_arr;
+  TxnLatencyStats *latency_stats;
 #endif
   LocalityManager cont_lmgr;
 
@@ -232,26 +327,29 @@ class EpochMemory;
 class Epoch;
 
 class EpochManager {
-  friend class EpochDispatcher;
   template <typename T> friend struct util::InstanceInit;
   EpochMemory *mem;
   std::atomic<Epoch *> cur_epoch;
   std::atomic_uint64_t cur_epoch_nr;
-#ifdef DISPATCHER
-  std::atomic_uint64_t ready_epoch_nr;
-#endif
-  EpochManager(EpochMemory *mem, Epoch *epoch);
+
+  // Only with pipelined epochs: the epoch after cur_epoch may be opened while
+  // cur_epoch is still running. The two epochs take turns on the two
+  // EpochMemory.
+  EpochMemory *next_mem;
+  Epoch *next_epoch;
+  std::atomic_uint64_t next_epoch_nr;
+
+  EpochManager(EpochMemory *mem, Epoch *epoch,
+               EpochMemory *next_mem = nullptr, Epoch *next_epoch = nullptr);
  public:
   Epoch *epoch(uint64_t epoch_nr) const;
   uint8_t *ptr(uint64_t epoch_nr, int node_id, uint64_t offset) const;
 
   uint64_t current_epoch_nr() const { return cur_epoch_nr; }
-#ifdef DISPATCHER
-  uint64_t get_ready_epoch_nr() const { return ready_epoch_nr; }
-#endif
   Epoch *current_epoch() const { return epoch(cur_epoch_nr); }
 
   void DoAdvance(EpochClient *client);
+  void OpenNextEpoch(EpochClient *client);
 };
 
 class EpochObject {
@@ -0,0 +1,57 @@
+#ifndef EPOCH_SIZE_AUTOTUNE_H
+#define EPOCH_SIZE_AUTOTUNE_H
+
+#include <cstdint>
+#include <algorithm>
+#include "threshold_autotune.h"
+#include "log.h"
+
+namespace felis {
+
+// Picks the size of the next epoch from the latency of the last one. Larger
+// epochs amortize the epoch boundary better, so we grow while we are
+// comfortably under the SLO and throughput keeps improving, and shrink as
+// soon as the SLO is violated.
+class EpochSizeAutoTuneController {
+  long slo_us;
+  unsigned long min_size;
+  unsigned long max_size;
+
+  unsigned long last_size = 0;
+  uint64_t last_thr = 0;
+  bool grown = false;
+ public:
+  EpochSizeAutoTuneController(long slo_us, unsigned long min_size, unsigned long max_size)
+      : slo_us(slo_us), min_size(min_size), max_size(max_size) {}
+
+  unsigned long GetNextEpochSize(unsigned long current_size, long p99_us, long epoch_time_us) {
+    uint64_t thr = current_size * 1000000ULL / std::max(epoch_time_us, 1L);
+    logger->info("Autotune epoch size {} p99 {}us SLO {}us throughput {}->{} txn/s",
+                 current_size, p99_us, slo_us, last_thr, thr);
+    unsigned long next = current_size;
+
+    if (p99_us > slo_us) {
+      // Shrink a bit more than proportionally, so that we don't keep hovering
+      // right above the SLO.
+      next = current_size * slo_us / p99_us * 7 / 8;
+      grown = false;
+    } else if (grown && ThresholdAutoTuneController::FuzzyCompare(thr, last_thr) != 1) {
+      // Growing didn't buy us any throughput. Back off and stay there.
+      next = last_size;
+      grown = false;
+    } else if (p99_us < slo_us * 3 / 4) {
+      next = current_size + current_size / 4 + 1;
+      grown = true;
+    } else {
+      grown = false;
+    }
+
+    last_size = current_size;
+    last_thr = thr;
+    return std::clamp(next, min_size, max_size);
+  }
+};
+
+}
+
+#endif /* EPOCH_SIZE_AUTOTUNE_H */
@@ -1,14 +1,63 @@
 #include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include "gopp/gopp.h"
+#include "json11/json11.hpp"
 
 #include "felis_probes.h"
 #include "probe_utils.h"
+#include "opts.h"
+#include "log.h"
 
 #include "vhandle.h" // Let's hope this won't slow down the build.
 #include "gc.h"
 
+namespace felis {
+namespace probes {
+
+std::atomic_bool g_enabled[(int) ProbeId::NrProbes];
+
+static const char *kProbeNames[] = {
+#define PROBE_NAME(name) #name,
+  PROBE_NAMES(PROBE_NAME)
+#undef PROBE_NAME
+};
+
+bool SetEnabled(const std::string &name, bool enabled)
+{
+  for (int i = 0; i < (int) ProbeId::NrProbes; i++) {
+    if (name == kProbeNames[i]) {
+      g_enabled[i].store(enabled);
+      return true;
+    }
+  }
+  return false;
+}
+
+void EnableProbes(const std::string &names)
+{
+  std::stringstream ss(names);
+  std::string name;
+  while (std::getline(ss, name, ',')) {
+    abort_if(!SetEnabled(name, true), "Unknown probe {}", name);
+  }
+}
+
+std::vector<std::pair<std::string, bool>> ListProbes()
+{
+  std::vector<std::pair<std::string, bool>> result;
+  for (int i = 0; i < (int) ProbeId::NrProbes; i++)
+    result.emplace_back(kProbeNames[i], g_enabled[i].load());
+  return result;
+}
+
+}
+}
+
+using felis::probes::ProbeId;
+using felis::probes::IsEnabled;
+
 static struct ProbeMain {
   agg::Agg<agg::Histogram<128, 0, 256>> wait_cnt;
   agg::Agg<agg::LogHistogram<18, 0, 2>> versions;
@@ -27,6 +76,11 @@ static struct ProbeMain {
   std::vector<long> mem_usage;
   std::vector<long> expansion;
 
+  // JSON lines, one at the end of every phase. See the EndOfPhase probe.
+  std::ofstream snapshot_output;
+
+  json11::Json Snapshot(uint64_t epoch_nr, int phase_id);
+
   ~ProbeMain();
 } global;
 
@@ -58,11 +112,10 @@ static void CountUpdate(agg::Histogram<32, 0, 1> &agg, int nr_update, int core =
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// Override for some enabled probes
+// Override for the probes that collect something. They only run while the
+// probe is switched on.
 ////////////////////////////////////////////////////////////////////////////////
 
-#if 0
-
 template <> void OnProbe(felis::probes::VHandleAbsorb p)
 {
   statcnt.absorb_memmove_size << p.size;
@@ -70,6 +123,7 @@ template <> void OnProbe(felis::probes::VHandleAbsorb p)
   statcnt.absorb_memmove_avg << p.size;
 }
 
+// VHandleAppendSlowPath needs VHandleAppend on as well.
 thread_local uint64_t last_tsc;
 template <> void OnProbe(felis::probes::VHandleAppend p)
 {
@@ -78,14 +132,12 @@ template <> void OnProbe(felis::probes::VHandleAppend p)
 
 template <> void OnProbe(felis::probes::VHandleAppendSlowPath p)
 {
-  auto msc_wait = __rdtsc() - last_tsc;
-  statcnt.msc_wait_cnt << msc_wait;
-  statcnt.msc_wait_cnt_avg << msc_wait;
+  if (last_tsc == 0) return;
+  auto mcs_wait = __rdtsc() - last_tsc;
+  statcnt.mcs_wait_cnt << mcs_wait;
+  statcnt.mcs_wait_cnt_avg << mcs_wait;
 }
 
-#endif
-
-#if 0
 thread_local uint64_t last_wait_cnt;
 template <> void OnProbe(felis::probes::VersionRead p)
 {
@@ -97,9 +149,7 @@ template <> void OnProbe(felis::probes::WaitCounters p)
   statcnt.wait_cnt << p.wait_cnt;
   last_wait_cnt = p.wait_cnt;
 }
-#endif
 
-#if 0
 template <> void OnProbe(felis::probes::TpccDelivery p)
 {
   CountUpdate(statcnt.delivery_cnt, p.nr_update);
@@ -128,45 +178,124 @@ template <> void OnProbe(felis::probes::VersionWrite p)
   }
 }
 
-static int nr_split = 0;
+static std::atomic_long nr_split = 0;
 
 template <> void OnProbe(felis::probes::OnDemandSplit p)
 {
   nr_split += p.nr_splitted;
 }
 
-static long total_expansion = 0;
+static std::atomic_long total_expansion = 0;
+
+template <> void OnProbe(felis::probes::VHandleExpand p)
+{
+  total_expansion += p.newcap - p.oldcap;
+}
 
+// The control routine calls this at the end of every phase. Every call
+// appends one line of the aggregates collected so far to -XProbeLog (default
+// probes.jsonl), so the counters of a long run can be watched as they go.
 template <> void OnProbe(felis::probes::EndOfPhase p)
 {
-  if (p.phase_id != 1) return;
+  if (p.phase_id == 1) {
+    auto p1 = mem::GetMemStats(mem::RegionPool);
+    auto p2 = mem::GetMemStats(mem::VhandlePool);
 
-  auto p1 = mem::GetMemStats(mem::RegionPool);
-  auto p2 = mem::GetMemStats(mem::VhandlePool);
+    global.mem_usage.push_back(p1.used + p2.used);
+    global.expansion.push_back(total_expansion);
+  }
 
-  global.mem_usage.push_back(p1.used + p2.used);
-  global.expansion.push_back(total_expansion);
+  if (!global.snapshot_output.is_open()) {
+    auto path = felis::Options::kProbeLog.Get("probes.jsonl");
+    global.snapshot_output.open(path, std::ios::app);
+    abort_if(!global.snapshot_output, "Cannot open the probe log {}", path);
+  }
+  global.snapshot_output << global.Snapshot(p.epoch_nr, p.phase_id).dump() << std::endl;
 }
 
-template <> void OnProbe(felis::probes::VHandleExpand p)
+template <int N, int Offset, int Bucket>
+static json11::Json ToJson(const agg::Histogram<N, Offset, Bucket> &h)
 {
-  total_expansion += p.newcap - p.oldcap;
+  return json11::Json::object({
+      {"offset", Offset},
+      {"bucket", Bucket},
+      {"hist", std::vector<double>(h.hist, h.hist + N)},
+    });
 }
 
-#endif
+template <int N, int Offset, int Base>
+static json11::Json ToJson(const agg::LogHistogram<N, Offset, Base> &h)
+{
+  return json11::Json::object({
+      {"offset", Offset},
+      {"base", Base},
+      {"hist", std::vector<double>(h.hist, h.hist + N)},
+    });
+}
+
+static json11::Json ToJson(const agg::Average &avg)
+{
+  return json11::Json::object({
+      {"sum", (double) avg.sum},
+      {"cnt", (double) avg.cnt},
+    });
+}
+
+// Cumulative, from the start of the run, and only for the probes that are on.
+json11::Json ProbeMain::Snapshot(uint64_t epoch_nr, int phase_id)
+{
+  json11::Json::object probes;
+  for (auto &[name, enabled]: felis::probes::ListProbes())
+    probes[name] = enabled;
+
+  json11::Json::object result {
+    {"epoch", (double) epoch_nr},
+    {"phase", phase_id},
+    {"probes", probes},
+  };
+
+  if (IsEnabled(ProbeId::WaitCounters))
+    result["wait_cnt"] = ToJson(wait_cnt());
+  if (IsEnabled(ProbeId::VersionWrite)) {
+    result["versions"] = ToJson(versions());
+    result["write_cnt"] = ToJson(write_cnt());
+  }
+  if (IsEnabled(ProbeId::TpccNewOrder))
+    result["neworder_cnt"] = ToJson(neworder_cnt());
+  if (IsEnabled(ProbeId::TpccPayment))
+    result["payment_cnt"] = ToJson(payment_cnt());
+  if (IsEnabled(ProbeId::TpccDelivery))
+    result["delivery_cnt"] = ToJson(delivery_cnt());
+  if (IsEnabled(ProbeId::VHandleAbsorb)) {
+    result["absorb_memmove_size_detail"] = ToJson(absorb_memmove_size_detail());
+    result["absorb_memmove_size"] = ToJson(absorb_memmove_size());
+    result["absorb_memmove_avg"] = ToJson(absorb_memmove_avg());
+  }
+  if (IsEnabled(ProbeId::VHandleAppendSlowPath)) {
+    result["mcs_wait_cnt"] = ToJson(mcs_wait_cnt());
+    result["mcs_wait_cnt_avg"] = ToJson(mcs_wait_cnt_avg());
+  }
+  if (IsEnabled(ProbeId::OnDemandSplit))
+    result["nr_split"] = (double) nr_split.load();
+  if (IsEnabled(ProbeId::VHandleExpand))
+    result["expansion"] = (double) total_expansion.load();
+  if (!mem_usage.empty())
+    result["mem_usage"] = (double) mem_usage.back();
+
+  return result;
+}
 
 ProbeMain::~ProbeMain()
 {
-  //   std::cout << global.wait_cnt() << std::endl;
-#if 0
-  std::cout
-      << "waitcnt" << std::endl
-      << global.wait_cnt() << std::endl
-      << global.write_cnt() << std::endl;
-  std::cout << nr_split << std::endl
-            << global.versions << std::endl;
+  if (IsEnabled(ProbeId::WaitCounters)) {
+    std::cout << "waitcnt" << std::endl
+              << global.wait_cnt() << std::endl;
+  }
+
+  if (IsEnabled(ProbeId::VersionWrite)) {
+    std::cout << global.write_cnt() << std::endl
+              << global.versions << std::endl;
 
-  {
     std::ofstream fout("versions.csv");
     fout << "bin_start,bin_end,count" << std::endl;
     for (int i = 0; i < global.versions.kNrBins; i++) {
@@ -176,31 +305,35 @@ ProbeMain::~ProbeMain()
     }
   }
 
-  {
+  if (IsEnabled(ProbeId::OnDemandSplit))
+    std::cout << nr_split << std::endl;
+
+  if (IsEnabled(ProbeId::EndOfPhase)) {
     std::ofstream fout("mem_usage.log");
     int label = felis::GC::g_lazy ? -1 : felis::GC::g_gc_every_epoch;
     for (int i = 0; i < mem_usage.size(); i++) {
       fout << label << ',' << i << ',' << mem_usage[i] << std::endl;
     }
   }
-#endif
-
-#if 0
-  std::cout << "VHandle MCS Spin Time Distribution (in TSC)" << std::endl
-            << global.msc_wait_cnt << std::endl;
-  std::cout << "VHandle MCS Spin Time Avg: "
-            << global.msc_wait_cnt_avg
-            << std::endl;
-
-  std::cout << "Memmove/Sorting Distance Distribution:" << std::endl;
-  std::cout << global.absorb_memmove_size_detail
-            << global.absorb_memmove_size << std::endl;
-  std::cout << "Memmove/Sorting Distance Medium: "
-            << global.absorb_memmove_size_detail.CalculatePercentile(
-                .5 * global.absorb_memmove_size.Count() / global.absorb_memmove_size_detail.Count())
-            << std::endl;
-  std::cout << "Memmove/Sorting Distance Avg: " << global.absorb_memmove_avg << std::endl;
-#endif
+
+  if (IsEnabled(ProbeId::VHandleAppendSlowPath)) {
+    std::cout << "VHandle MCS Spin Time Distribution (in TSC)" << std::endl
+              << global.mcs_wait_cnt << std::endl;
+    std::cout << "VHandle MCS Spin Time Avg: "
+              << global.mcs_wait_cnt_avg
+              << std::endl;
+  }
+
+  if (IsEnabled(ProbeId::VHandleAbsorb)) {
+    std::cout << "Memmove/Sorting Distance Distribution:" << std::endl;
+    std::cout << global.absorb_memmove_size_detail
+              << global.absorb_memmove_size << std::endl;
+    std::cout << "Memmove/Sorting Distance Medium: "
+              << global.absorb_memmove_size_detail.CalculatePercentile(
+                  .5 * global.absorb_memmove_size.Count() / global.absorb_memmove_size_detail.Count())
+              << std::endl;
+    std::cout << "Memmove/Sorting Distance Avg: " << global.absorb_memmove_avg << std::endl;
+  }
 }
 
 PROBE_LIST;
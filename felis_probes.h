@@ -3,26 +3,74 @@
 #define FELIS_PROBES_H
 
 #include <cstdint>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <utility>
+
+#define PROBE_NAMES(X)                                                         \
+  X(NumVersionsOnGC)                                                           \
+  X(VersionRead)                                                               \
+  X(VersionWrite)                                                              \
+  X(WaitCounters)                                                              \
+  X(VHandleAppend)                                                             \
+  X(VHandleAppendSlowPath)                                                     \
+  X(VHandleAbsorb)                                                             \
+  X(VHandleExpand)                                                             \
+  X(LocalitySchedule)                                                          \
+  X(OnDemandSplit)                                                             \
+  X(EndOfPhase)                                                                \
+  X(TpccNewOrder)                                                              \
+  X(TpccPayment)                                                               \
+  X(TpccDelivery)
 
 namespace felis {
 namespace probes {
 
+enum class ProbeId : int {
+#define PROBE_ID(name) name,
+  PROBE_NAMES(PROBE_ID)
+#undef PROBE_ID
+  NrProbes,
+};
+
+// Probes are off until they are switched on, with -XProbes=<name>,... or the
+// "set_probe" Console API. An off probe costs a load and a not taken branch.
+extern std::atomic_bool g_enabled[(int) ProbeId::NrProbes];
+
+static inline bool IsEnabled(ProbeId id)
+{
+  return g_enabled[(int) id].load(std::memory_order_relaxed);
+}
+
+// Returns false if there is no such probe.
+bool SetEnabled(const std::string &name, bool enabled);
+// Comma separated names.
+void EnableProbes(const std::string &names);
+std::vector<std::pair<std::string, bool>> ListProbes();
+
+#define PROBE_DECLARE(name)                                                    \
+  void operator()() const {                                                    \
+    if (__builtin_expect(IsEnabled(ProbeId::name), 0)) Fire();                 \
+  }                                                                            \
+  void Fire() const
+
 struct NumVersionsOnGC {
   unsigned long nr;
-  void operator()() const;
+  PROBE_DECLARE(NumVersionsOnGC);
 };
 
 struct VersionRead {
   bool blocking;
   void *handle;
-  void operator()() const;
+  PROBE_DECLARE(VersionRead);
 };
 
 struct VersionWrite {
   void *handle;
   long pos;
   uint64_t epoch_nr;
-  void operator()() const;
+  PROBE_DECLARE(VersionWrite);
 };
 
 struct WaitCounters {
@@ -30,25 +78,25 @@ struct WaitCounters {
   uint64_t sid;
   uint64_t version_id;
   uintptr_t ptr;
-  void operator()() const;
+  PROBE_DECLARE(WaitCounters);
 };
 
 struct VHandleAppend {
   void *handle;
   uint64_t sid;
   int alloc_regionid;
-  void operator()() const;
+  PROBE_DECLARE(VHandleAppend);
 };
 
 struct VHandleAppendSlowPath {
   void *handle;
-  void operator()() const;
+  PROBE_DECLARE(VHandleAppendSlowPath);
 };
 
 struct VHandleAbsorb {
   void *handle;
   int size;
-  void operator()() const;
+  PROBE_DECLARE(VHandleAbsorb);
 };
 
 struct VHandleExpand {
@@ -56,14 +104,14 @@ struct VHandleExpand {
   unsigned int oldcap;
   unsigned int newcap;
 
-  void operator()() const;
+  PROBE_DECLARE(VHandleExpand);
 };
 
 struct OnDemandSplit {
   uint64_t sum;
   uint64_t nr_batched;
   uint64_t nr_splitted;
-  void operator()() const;
+  PROBE_DECLARE(OnDemandSplit);
 };
 
 struct LocalitySchedule {
@@ -73,51 +121,38 @@ struct LocalitySchedule {
   uint64_t seed;
   uint64_t max_seed;
   long load;
-  void operator()() const;
+  PROBE_DECLARE(LocalitySchedule);
 };
 
 struct EndOfPhase {
   uint64_t epoch_nr;
   int phase_id;
-  void operator()() const;
+  PROBE_DECLARE(EndOfPhase);
 };
 
 struct TpccNewOrder {
   int piece_id;
   int nr_update;
-  void operator()() const;
+  PROBE_DECLARE(TpccNewOrder);
 };
 
 struct TpccPayment {
   int piece_id;
   int nr_update;
   int warehouse_coreid;
-  void operator()() const;
+  PROBE_DECLARE(TpccPayment);
 };
 
 struct TpccDelivery {
   int piece_id;
   int nr_update;
-  void operator()() const;
+  PROBE_DECLARE(TpccDelivery);
 };
 
 }
 }
 
-#define PROBE_LIST                                                             \
-  PROBE_PROXY(felis::probes::NumVersionsOnGC);                                 \
-  PROBE_PROXY(felis::probes::VersionRead);                                     \
-  PROBE_PROXY(felis::probes::VersionWrite);                                    \
-  PROBE_PROXY(felis::probes::WaitCounters);                                    \
-  PROBE_PROXY(felis::probes::VHandleAppend);                                   \
-  PROBE_PROXY(felis::probes::VHandleAppendSlowPath);                           \
-  PROBE_PROXY(felis::probes::VHandleAbsorb);                                   \
-  PROBE_PROXY(felis::probes::VHandleExpand);                                   \
-  PROBE_PROXY(felis::probes::LocalitySchedule);                                \
-  PROBE_PROXY(felis::probes::OnDemandSplit);                                   \
-  PROBE_PROXY(felis::probes::EndOfPhase);                                      \
-  PROBE_PROXY(felis::probes::TpccNewOrder);                                    \
-  PROBE_PROXY(felis::probes::TpccPayment);                                     \
-  PROBE_PROXY(felis::probes::TpccDelivery);
+#define PROBE_PROXY_NAME(name) PROBE_PROXY(felis::probes::name);
+#define PROBE_LIST PROBE_NAMES(PROBE_PROXY_NAME)
 
 #endif /* FELIS_PROBES_H */
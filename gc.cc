@@ -6,6 +6,7 @@
 #include "index.h"
 #include "node_config.h"
 #include "epoch.h"
+#include "checkpoint.h"
 
 #include "literals.h"
 
@@ -133,6 +134,8 @@ void GC::RemoveRow(VHandle *row, uint64_t gc_handle)
 
 unsigned int GC::g_gc_every_epoch = 0;
 bool GC::g_lazy = false;
+bool GC::g_background = false;
+size_t GC::g_background_threshold = 0;
 std::array<GarbageBlockSlab *, NodeConfiguration::kMaxNrThreads> GC::g_slabs;
 
 void GC::InitPool()
@@ -194,9 +197,11 @@ void GC::PrepareGCForAllCores()
 
 void GC::RunGC()
 {
-  // TODO: add memory pressure detection.
   if (g_lazy)
     return;
+  // Only if the idle time of the last Execute phase was not enough.
+  if (g_background && !(background_behind && under_pressure))
+    return;
 
   auto cur_epoch_nr = util::Instance<EpochManager>().current_epoch_nr();
   int q_idx = (cur_epoch_nr + 1) % g_gc_every_epoch;
@@ -259,6 +264,96 @@ void GC::RunGC()
   }
 }
 
+void GC::StartBackground()
+{
+  if (!g_background || g_lazy)
+    return;
+
+  auto p1 = mem::GetMemStats(mem::RegionPool);
+  under_pressure = p1.used >= g_background_threshold;
+  background_on = under_pressure;
+}
+
+void GC::StopBackground()
+{
+  if (!g_background || g_lazy)
+    return;
+
+  background_on = false;
+  while (nr_background_running.load() != 0)
+    _mm_pause();
+  background_behind = collect_head.load() != nullptr;
+}
+
+// The Execute phase version of RunGC(), one GarbageBlock at a time, on the
+// idle cycles of a core. Pieces are running on the other cores, and they read
+// the version arrays without locks, so the arrays cannot be compacted now. We
+// only free the data of the versions no one can read anymore, which is most of
+// the memory. The arrays are compacted the next time these rows are collected,
+// by IncreaseSize() or RunGC(), and there is nothing left to free by then.
+//
+// A row with versions in this epoch might get more garbage while we are here,
+// so it stays in the GC queues.
+void GC::RunBackgroundGC(int core_id)
+{
+  if (!background_on.load(std::memory_order_relaxed))
+    return;
+
+  nr_background_running.fetch_add(1);
+  // StopBackground() might have missed us.
+  if (!background_on.load()) {
+    nr_background_running.fetch_sub(1);
+    return;
+  }
+
+  auto cur_epoch_nr = util::Instance<EpochManager>().current_epoch_nr();
+  int q_idx = (cur_epoch_nr + 1) % g_gc_every_epoch;
+  auto &s = stats[core_id];
+
+  GarbageBlock *b = collect_head.load();
+  while (b && !collect_head.compare_exchange_strong(b, b->next->object()));
+  if (b == nullptr) {
+    nr_background_running.fetch_sub(1);
+    return;
+  }
+
+  auto slab = g_slabs[b->alloc_core];
+  b->Initialize();
+
+  uint64_t left = 0;
+  for (auto bitmap = b->bitmap; bitmap != 0; bitmap &= bitmap - 1) {
+    int i = __builtin_ctzll(bitmap);
+    auto row = b->rows[i];
+    util::MCSSpinLock::QNode qnode;
+    row->lock.Lock(&qnode);
+    auto nr_freed = FreeDeadVersions(row, cur_epoch_nr, 16_K);
+    bool done = nr_freed < 16_K && (row->versions[row->size - 1] >> 32) < cur_epoch_nr;
+    if (done)
+      row->gc_handle = 0;
+    row->lock.Unlock(&qnode);
+
+    if (done)
+      s.nr_rows++;
+    else
+      left |= 1ULL << i;
+  }
+  b->bitmap = left;
+
+  util::MCSSpinLock::QNode qnode;
+  slab->lock.Acquire(&qnode);
+  if (left == 0) {
+    b->InsertAfter(&slab->free);
+    s.nr_blocks++;
+  } else if (__builtin_popcountll(left) == GarbageBlock::kMaxNrRows) {
+    b->InsertAfter(&slab->full[q_idx]);
+  } else {
+    b->InsertAfter(&slab->half[q_idx]);
+  }
+  slab->lock.Release(&qnode);
+
+  nr_background_running.fetch_sub(1);
+}
+
 size_t GC::Process(VHandle *handle, uint64_t cur_epoch_nr, size_t limit)
 {
   util::MCSSpinLock::QNode qnode;
@@ -307,6 +402,7 @@ size_t GC::Collect(VHandle *handle, uint64_t cur_epoch_nr, size_t limit)
   handle->size -= i;
   handle->cur_start -= i;
   handle->latest_version.fetch_sub(i);
+  handle->ShrinkVersionsNoLock();
 
   if (is_trace_enabled(TRACE_GC)) {
     trace(TRACE_GC "GC on row {} {}", (void *) handle, handle->ToString());
@@ -314,6 +410,21 @@ size_t GC::Collect(VHandle *handle, uint64_t cur_epoch_nr, size_t limit)
   return i;
 }
 
+// Like Collect(), but leaves the arrays alone. The freed versions are left as
+// nullptr, which Collect() will skip.
+size_t GC::FreeDeadVersions(VHandle *handle, uint64_t cur_epoch_nr, size_t limit)
+{
+  auto *versions = handle->versions;
+  uintptr_t *objects = handle->versions + handle->capacity;
+  int i = 0;
+  while (i < handle->size - 1 && i < limit && (versions[i + 1] >> 32) < cur_epoch_nr) {
+    if (FreeIfGarbage(handle, (VarStr *) objects[i], (VarStr *) objects[i + 1]))
+      objects[i] = 0;
+    i++;
+  }
+  return i;
+}
+
 bool GC::IsDataGarbage(VHandle *row, VarStr *data)
 {
   if (data == nullptr) return false;
@@ -322,6 +433,8 @@ bool GC::IsDataGarbage(VHandle *row, VarStr *data)
     abort_if(!row->is_inlined(), "??? row {} p {}", (void *) row, (void *) p);
     return false;
   }
+  // Loaded from a checkpoint, and still in place.
+  if (Checkpointer::IsSnapshotData(p)) return false;
   return true;
 }
 
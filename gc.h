@@ -16,6 +16,13 @@ class GC {
   static std::array<GarbageBlockSlab *, NodeConfiguration::kMaxNrThreads> g_slabs;
   std::atomic<GarbageBlock *> collect_head = nullptr;
 
+  // Background mode, see RunBackgroundGC().
+  std::atomic_bool background_on = false;
+  std::atomic_int nr_background_running = 0;
+  bool under_pressure = false;
+  // The Execute phase ended before the background drained collect_head.
+  bool background_behind = false;
+
   struct {
     int nr_rows, nr_blocks;
     size_t nr_bytes;
@@ -42,10 +49,21 @@ class GC {
 
   size_t Collect(VHandle *handle, uint64_t cur_epoch_nr, size_t limit);
 
+  // Around the Execute phase, from the control routine. StopBackground() waits
+  // for the cores that are still in RunBackgroundGC().
+  void StartBackground();
+  void StopBackground();
+  // When the dispatch service has nothing to run on this core.
+  void RunBackgroundGC(int core_id);
+
   static unsigned int g_gc_every_epoch;
   static bool g_lazy;
+  static bool g_background;
+  // Bytes of the data region in use before the background GC starts working.
+  static size_t g_background_threshold;
  private:
   size_t Process(VHandle *handle, uint64_t cur_epoch_nr, size_t limit);
+  size_t FreeDeadVersions(VHandle *handle, uint64_t cur_epoch_nr, size_t limit);
 };
 
 }
@@ -2,139 +2,421 @@
 #include <sys/mman.h>
 
 #include "hashtable_index_impl.h"
+#include "epoch.h"
+#include "gopp/gopp.h"
 #include "xxHash/xxhash.h"
 
 namespace felis {
 
-// Useless?
-struct ThreadInfo {
-  std::atomic<HashEntry *> free = nullptr; // free list has a list of pre-allocated entries
-
-  HashEntry *AllocEntry();
-  void FreeEntry(HashEntry *);
-};
-
 static void *AllocFromHugePage(size_t length)
 {
   length = util::Align(length, 2 << 20);
   void *p = mmap(nullptr, length, PROT_READ | PROT_WRITE,
                  MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB,
                  -1, 0);
-  if (p == MAP_FAILED) return nullptr;
+  if (p == MAP_FAILED) {
+    p = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+             MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    abort_if(p == MAP_FAILED, "Cannot allocate {} bytes for hashtable sentinels", length);
+  }
   mlock(p, length);
   return p;
 }
 
-HashEntry *ThreadInfo::AllocEntry()
-{
-  while (true) {
-    auto e = free.load();
-    while (e) {
-      if (free.compare_exchange_strong(e, e->next))
-        return e;
-    }
+// Sentinels are never freed. Each thread bump allocates them from its own
+// hugepages, so there is no shared free list to fight over.
+struct SentinelAllocator {
+  static constexpr auto kAllocSize = 64 << 10;
+  HashEntry *cur = nullptr;
+  HashEntry *end = nullptr;
 
-    static constexpr auto kAllocSize = 64 << 10;
-    e = (HashEntry *) AllocFromHugePage(kAllocSize * sizeof(HashEntry));
-    HashEntry *it;
-    for (it = e; it < e + kAllocSize - 1; it++) {
-      it->next = it + 1;
+  HashEntry *Alloc() {
+    if (cur == end) {
+      cur = (HashEntry *) AllocFromHugePage(kAllocSize * sizeof(HashEntry));
+      end = cur + kAllocSize;
     }
+    return cur++;
+  }
+  // Gives back a sentinel that lost the race to be inserted.
+  void Unalloc(HashEntry *e) {
+    if (e + 1 == cur) cur--;
+  }
+};
 
-    HashEntry *tail = nullptr;
-    do {
-      it->next = tail;
-    } while (!free.compare_exchange_strong(tail, e));
+static thread_local SentinelAllocator local_sentinels;
+
+// Long keys are copied into per-thread arenas. Like the sentinels, they are
+// never freed, even if the row is deleted.
+struct KeyArena {
+  static constexpr size_t kChunkSize = 2 << 20;
+  uint8_t *cur = nullptr;
+  uint8_t *end = nullptr;
+
+  uint8_t *Alloc(size_t len) {
+    len = util::Align(len, 8);
+    if (cur + len > end) {
+      auto sz = std::max(kChunkSize, len);
+      cur = (uint8_t *) AllocFromHugePage(sz);
+      end = cur + sz;
+    }
+    auto p = cur;
+    cur += len;
+    return p;
   }
+};
+
+static thread_local KeyArena local_keys;
+
+static void SetEntryKey(HashEntry *e, const HashEntry::Key &x, const VarStrView &k)
+{
+  e->key = x;
+  if (x[15] != HashEntry::kSpilledKey) return;
+
+  auto p = local_keys.Alloc(2 + k.length());
+  *(uint16_t *) p = k.length();
+  memcpy(p + 2, k.data(), k.length());
+  *(uint8_t **) e->key.data() = p;
 }
 
-void ThreadInfo::FreeEntry(HashEntry *e)
+VHandle *HashEntry::value() const
 {
-  auto head = free.load();
-  do {
-    e->next = head;
-  } while (!free.compare_exchange_strong(head, e));
+  return (VHandle *) ((uint8_t *) this - 96);
 }
 
-static thread_local ThreadInfo *local_ti = nullptr;
+static constexpr size_t kOffset = 96;
 
+static inline uint32_t ReverseBits(uint32_t x)
+{
+  x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+  x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+  x = ((x >> 4) & 0x0F0F0F0F) | ((x & 0x0F0F0F0F) << 4);
+  return __builtin_bswap32(x);
+}
 
-VHandle *HashEntry::value() const
+// Rows have the highest bit of the hash set before reversing, so they sort
+// right after the sentinel of their bucket, never equal to it.
+static inline uint32_t RowOrder(uint32_t h) { return ReverseBits(h | 0x80000000); }
+static inline uint32_t SentinelOrder(size_t idx) { return ReverseBits(idx); }
+
+// The bucket that idx splits from: idx without its highest bit.
+static inline size_t ParentBucket(size_t idx)
 {
-  return (VHandle *) ((uint8_t *) this - 96);
+  return idx & ~(1UL << (63 - __builtin_clzl(idx)));
 }
 
-static HashEntry *kNextForUninitialized = (HashEntry *) 0;
-static HashEntry *kNextForInitializing = (HashEntry *) 0xdeadbeef00000000;
-static HashEntry *kNextForEnd = (HashEntry *) 0xEDEDEDEDEDEDEDED;
+static inline bool IsMarked(HashEntry *p) { return ((uintptr_t) p & 0x01) != 0; }
+static inline HashEntry *Marked(HashEntry *p) { return (HashEntry *) ((uintptr_t) p | 0x01); }
+static inline HashEntry *Unmarked(HashEntry *p) { return (HashEntry *) ((uintptr_t) p & ~0x01UL); }
+
+static inline int CurrentCore()
+{
+  return (unsigned int) (go::Scheduler::CurrentThreadPoolId() - 1) % NodeConfiguration::kMaxNrThreads;
+}
 
 HashtableIndex::HashtableIndex(std::tuple<HashFunc, size_t, bool> conf)
+    : HashtableIndex(std::tuple_cat(conf, std::make_tuple(kNoOrderedIndex)))
+{}
+
+HashtableIndex::HashtableIndex(std::tuple<HashFunc, size_t, bool, size_t> conf)
     : Table()
 {
   hash = std::get<0>(conf);
-  nr_buckets = std::get<1>(conf);
   enable_inline = std::get<2>(conf);
 
-  // Instead pre-allocate the table from the beginning, we'll use fine on-demand
-  // paging for the bucket. In this way, the insertion CPU will allocate the
-  // page from its local NUMA zone. As long as the hash function can generate
-  // NUMA friendly hash function, we can make sure all pages are accessed from
-  // local NUMA zone.
-  auto nrpg = ((nr_buckets * row_size() - 1) >> 12) + 1;
-  table = (uint8_t *)
-          mmap(nullptr, nrpg << 12, PROT_READ | PROT_WRITE,
-               MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-  printf("addr %p %p\n", table, table + (nrpg << 12));
+  size_t n = std::max<size_t>(std::get<1>(conf), 2);
+  min_nr_buckets = std::min(1UL << (64 - __builtin_clzl(n - 1)), kMaxNrBuckets);
+  nr_buckets = min_nr_buckets;
+
+  // Reserve the bucket array for the largest size we can grow to, but page it
+  // in on demand. The CPU that initializes a bucket will allocate the page from
+  // its local NUMA zone.
+  buckets = (HashBucket *)
+            mmap(nullptr, kMaxNrBuckets * sizeof(HashBucket), PROT_READ | PROT_WRITE,
+                 MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+  abort_if(buckets == MAP_FAILED, "Cannot reserve the hashtable buckets, errno={}", errno);
+
+  for (auto &cnt: nr_rows) cnt.store(0);
+
+  // Bucket 0 is the head of the list.
+  auto head = local_sentinels.Alloc();
+  head->key.fill(0);
+  head->next = nullptr;
+  head->order = SentinelOrder(0);
+  head->rcu_epoch = 0;
+  buckets[0].meta = 0;
+  buckets[0].sentinel = head;
+
+  if (std::get<3>(conf) != kNoOrderedIndex)
+    ordered = new OrderedIndex(std::get<3>(conf));
 }
 
-static constexpr size_t kOffset = 96;
+HashEntry *HashtableIndex::GetBucket(size_t idx)
+{
+  auto p = buckets[idx].sentinel.load(std::memory_order_acquire);
+  if (__builtin_expect(p != nullptr, 1)) return p;
+  return InitializeBucket(idx);
+}
 
-VHandle *HashtableIndex::SearchOrCreate(const VarStrView &k, bool *created)
+HashEntry *HashtableIndex::InitializeBucket(size_t idx)
 {
-  auto idx = hash(k) % nr_buckets;
-  HashEntry *first = (HashEntry *) (table + idx * row_size() + kOffset);
-
-  if (first->next == kNextForUninitialized) {
-    HashEntry *old = kNextForUninitialized;
-    if (first->next.compare_exchange_strong(old, kNextForInitializing)) {
-      first->key = HashEntry::Convert(k);
-      auto row = first->value();
-      new (row) SortedArrayVHandle();
-      row->capacity = 1;
-      first->next = kNextForEnd;
-      *created = true;
-      return row;
+  auto parent = GetBucket(ParentBucket(idx));
+  auto b = &buckets[idx];
+  auto sentinel = local_sentinels.Alloc();
+  sentinel->key.fill(0);
+  sentinel->order = SentinelOrder(idx);
+  sentinel->rcu_epoch = 0;
+
+  std::atomic<HashEntry *> *prev;
+  HashEntry *cur;
+  while (true) {
+    if (Find(parent, sentinel->order, nullptr, VarStrView(), &prev, &cur)) {
+      // Someone else is splitting it. It's only a few instructions away from
+      // setting up the slots.
+      local_sentinels.Unalloc(sentinel);
+      HashEntry *p;
+      while ((p = b->sentinel.load(std::memory_order_acquire)) == nullptr) _mm_pause();
+      return p;
     }
+    sentinel->next.store(cur, std::memory_order_relaxed);
+    if (prev->compare_exchange_strong(cur, sentinel))
+      break;
   }
-  while (first->next == kNextForInitializing) _mm_pause();
 
-  HashEntry *p = first, *newentry = nullptr;
-  std::atomic<HashEntry *> *parent = nullptr;
-  auto x = HashEntry::Convert(k);
-  VHandle *row = nullptr;
+  // Nobody publishes into the slots before the sentinel is set. Until we are
+  // done filling them, lookups have to walk the list.
+  b->meta.store(HashBucket::FlagBits(HashBucket::kPopulating), std::memory_order_relaxed);
+  b->sentinel.store(sentinel, std::memory_order_release);
 
-  do {
-    while (p != kNextForEnd) {
-      if (p->Compare(x)) {
-        if (row) delete row;
-        *created = false;
-        return p->value();
+  // Rows up to the next sentinel are ours, or of descendants that are not
+  // split yet.
+  for (auto p = Unmarked(sentinel->next.load()); p && !p->is_sentinel();) {
+    auto next = p->next.load();
+    if (!IsMarked(next)) Publish(idx, p);
+    p = Unmarked(next);
+  }
+  b->meta.fetch_and(~HashBucket::FlagBits(HashBucket::kPopulating));
+  return sentinel;
+}
+
+// Looks for the entry at order with key k (key is Convert(k)), or the sentinel
+// at order if key is nullptr, starting from a sentinel. Returns whether it's
+// found. Either way, *cur_out is where it is or should be, and *prev_out is the
+// link to it.
+//
+// Marked entries on the way are unlinked, and retired by whoever unlinks them.
+bool HashtableIndex::Find(HashEntry *head, uint32_t order, const HashEntry::Key *key,
+                          const VarStrView &k, std::atomic<HashEntry *> **prev_out, HashEntry **cur_out)
+{
+retry:
+  auto prev = &head->next;
+  auto cur = Unmarked(prev->load(std::memory_order_acquire));
+  while (cur) {
+    auto next = cur->next.load(std::memory_order_acquire);
+    if (IsMarked(next)) {
+      auto expected = cur;
+      if (!prev->compare_exchange_strong(expected, Unmarked(next)))
+        goto retry;
+      Retire(cur);
+      cur = Unmarked(next);
+      continue;
+    }
+    if (cur->order > order) break;
+    if (cur->order == order && (key == nullptr || cur->Compare(*key, k))) {
+      *prev_out = prev;
+      *cur_out = cur;
+      return true;
+    }
+    prev = &cur->next;
+    cur = next;
+  }
+  *prev_out = prev;
+  *cur_out = cur;
+  return false;
+}
+
+// Looks in the slots of b. *complete tells if a miss here is a miss in the
+// list as well.
+HashEntry *HashtableIndex::Probe(HashBucket *b, uint32_t order, const HashEntry::Key &x,
+                                 const VarStrView &k, bool *complete)
+{
+  auto meta = b->meta.load(std::memory_order_acquire);
+  for (auto m = HashBucket::Match(meta, HashBucket::Tag(order)); m; m &= m - 1) {
+    auto e = b->slots[__builtin_ctz(m)].load(std::memory_order_acquire);
+    // Might be half published, or deleted.
+    if (e && e->order == order && !IsMarked(e->next.load(std::memory_order_acquire))
+        && e->Compare(x, k))
+      return e;
+  }
+  *complete = HashBucket::Flags(meta) == 0;
+  return nullptr;
+}
+
+// Caches e in the slots of bucket idx. If they are full, the bucket becomes
+// incomplete for good, and we return false.
+bool HashtableIndex::Publish(size_t idx, HashEntry *e)
+{
+  auto b = &buckets[idx];
+  auto tag = HashBucket::Tag(e->order);
+  auto meta = b->meta.load();
+  while (true) {
+    auto free = HashBucket::FreeSlots(meta);
+    if (free == 0) {
+      if (Evict(idx)) {
+        meta = b->meta.load();
+        continue;
       }
-      parent = &p->next;
-      p = parent->load();
+      b->meta.fetch_or(HashBucket::FlagBits(HashBucket::kIncomplete));
+      return false;
+    }
+    auto i = __builtin_ctz(free);
+    if (b->meta.compare_exchange_weak(meta, meta | ((uint64_t) tag << (8 * i)))) {
+      b->slots[i].store(e);
+      // Delete() marks first and then unpublishes. If it missed this slot, we
+      // see the mark.
+      if (IsMarked(e->next.load())) Unpublish(b, e);
+      return true;
     }
+  }
+}
+
+void HashtableIndex::ClearSlot(HashBucket *b, int i, HashEntry *e)
+{
+  if (b->slots[i].compare_exchange_strong(e, nullptr))
+    b->meta.fetch_and(~(0xFFULL << (8 * i)));
+}
+
+void HashtableIndex::Unpublish(HashBucket *b, HashEntry *e)
+{
+  for (int i = 0; i < HashBucket::kNrSlots; i++) {
+    if (b->slots[i].load() == e) ClearSlot(b, i, e);
+  }
+}
+
+// Frees the slots of deleted rows, and of rows that belong to a split bucket
+// now. Returns whether there's any.
+bool HashtableIndex::Evict(size_t idx)
+{
+  auto b = &buckets[idx];
+  auto mask = nr_buckets.load() - 1;
+  bool evicted = false;
+  for (int i = 0; i < HashBucket::kNrSlots; i++) {
+    auto e = b->slots[i].load();
+    if (e == nullptr) continue;
+    if (IsMarked(e->next.load()) || (ReverseBits(e->order) & mask) != idx) {
+      ClearSlot(b, i, e);
+      evicted = true;
+    }
+  }
+  return evicted;
+}
+
+void HashtableIndex::Retire(HashEntry *entry)
+{
+  // Scans can still find it in the OrderedIndex, until the next merge takes
+  // it out.
+  if (ordered) {
+    ordered->LogDelete(CurrentCore(), entry);
+    return;
+  }
+  Reclaim(entry);
+}
+
+void HashtableIndex::Reclaim(HashEntry *entry)
+{
+  static constexpr size_t kReclaimThreshold = 64;
+  auto cur_epoch_nr = util::Instance<EpochManager>().current_epoch_nr();
+  auto &l = retired[CurrentCore()];
+
+  entry->rcu_epoch = cur_epoch_nr;
 
+  l.lock.Lock();
+  l.entries.push_back(entry);
+  if (l.entries.size() >= kReclaimThreshold) {
+    // Txns of the unlinking epoch may still hold the row, and so may the
+    // pipelined epoch after it. The GC may still have the row queued as well,
+    // and it lets go of the row by clearing its gc_handle.
+    auto it = std::remove_if(
+        l.entries.begin(), l.entries.end(),
+        [cur_epoch_nr](HashEntry *e) {
+          if (e->rcu_epoch + 2 > cur_epoch_nr) return false;
+          auto row = e->value();
+          if (row->gc_handle.load(std::memory_order_acquire) != 0) return false;
+          delete row;
+          return true;
+        });
+    l.entries.erase(it, l.entries.end());
+  }
+  l.lock.Unlock();
+}
+
+long HashtableIndex::nr_rows_approx() const
+{
+  long total = 0;
+  for (auto &cnt: nr_rows) total += cnt.load(std::memory_order_relaxed);
+  return total;
+}
+
+void HashtableIndex::Resize(long delta)
+{
+  auto local = nr_rows[CurrentCore()].fetch_add(delta, std::memory_order_relaxed) + delta;
+  // Summing up all counters is not free. Look at the load once in a while.
+  if ((local & 0x3F) != 0) return;
+
+  auto size = nr_buckets.load();
+  if (nr_rows_approx() > (long) size * kGrowLoad && size < kMaxNrBuckets)
+    nr_buckets.compare_exchange_strong(size, size * 2);
+}
+
+VHandle *HashtableIndex::SearchOrCreate(const VarStrView &k, bool *created)
+{
+  auto h = hash(k);
+  auto order = RowOrder(h);
+  auto idx = bucket_idx(h);
+  auto head = GetBucket(idx);
+  auto x = HashEntry::Convert(k);
+  bool complete = false;
+
+  auto e = Probe(&buckets[idx], order, x, k, &complete);
+  if (e) {
+    *created = false;
+    return e->value();
+  }
+
+  std::atomic<HashEntry *> *prev;
+  HashEntry *cur, *newentry = nullptr;
+  VHandle *row = nullptr;
+
+  while (!Find(head, order, &x, k, &prev, &cur)) {
     if (newentry == nullptr) {
       row = NewRow();
-      row->capacity = 1;
-      newentry = (HashEntry *) ((uint8_t *) row + 96);
-      newentry->key = x;
-      newentry->next = kNextForEnd;
+      // Two versions, the committed one and the one being written this epoch,
+      // fit next to the HashEntry. The lookup has brought that line in already.
+      row->LimitInlineVersions(kOffset);
+      newentry = (HashEntry *) ((uint8_t *) row + kOffset);
+      SetEntryKey(newentry, x, k);
+      newentry->order = order;
+      newentry->rcu_epoch = 0;
     }
+    newentry->next.store(cur, std::memory_order_relaxed);
+    if (prev->compare_exchange_strong(cur, newentry)) {
+      // The table might have grown since we picked the bucket. Buckets split
+      // from now on will find the row in the list.
+      idx = bucket_idx(h);
+      GetBucket(idx);
+      Publish(idx, newentry);
+
+      if (ordered) ordered->LogInsert(CurrentCore(), newentry);
 
-  } while (!parent->compare_exchange_strong(p, newentry));
-  *created = true;
-  return row;
+      RememberKeyLength(k);
+      Resize(1);
+      *created = true;
+      return row;
+    }
+  }
+
+  if (row) delete row;
+  *created = false;
+  return cur->value();
 }
 
 VHandle *HashtableIndex::SearchOrCreate(const VarStrView &k)
@@ -145,26 +427,440 @@ VHandle *HashtableIndex::SearchOrCreate(const VarStrView &k)
 
 VHandle *HashtableIndex::Search(const VarStrView &k)
 {
-  auto idx = hash(k) % nr_buckets;
-  auto p = (HashEntry *) (table + idx * row_size() + kOffset);
+  return Search(k, hash(k));
+}
+
+VHandle *HashtableIndex::Search(const VarStrView &k, uint32_t h)
+{
+  auto order = RowOrder(h);
   auto x = HashEntry::Convert(k);
-  unsigned int cnt = 0;
 
-  if (p->next == kNextForUninitialized) return nullptr;
+retry:
+  auto nr = nr_buckets.load(std::memory_order_acquire);
+  auto idx = h & (nr - 1);
 
-  while (p->next == kNextForInitializing) _mm_pause();
+  // Lookups do not write. If the bucket is not split yet, its rows are still
+  // in the parent's part of the list.
+  HashEntry *p = buckets[idx].sentinel.load(std::memory_order_acquire);
+  if (p) {
+    bool complete = false;
+    auto e = Probe(&buckets[idx], order, x, k, &complete);
+    if (e) return e->value();
+    if (complete) goto miss;
+  } else {
+    do {
+      idx = ParentBucket(idx);
+    } while ((p = buckets[idx].sentinel.load(std::memory_order_acquire)) == nullptr);
+  }
 
-  while (p != kNextForEnd) {
-    cnt++;
-    if (p->Compare(x)) {
-      // if (cnt > 1) printf("table id %d\n", relation_id()); std::abort();
+  p = Unmarked(p->next.load(std::memory_order_acquire));
+  while (p && p->order <= order) {
+    auto next = p->next.load(std::memory_order_acquire);
+    if (p->order == order && !IsMarked(next) && p->Compare(x, k))
       return p->value();
+    p = Unmarked(next);
+  }
+
+miss:
+  // If the table grew in the meantime, the row might have been published only
+  // in the slots of a newer bucket, or evicted from ours, which still looks
+  // complete.
+  if (nr_buckets.load(std::memory_order_acquire) != nr) goto retry;
+  return nullptr;
+}
+
+// Group prefetching. Each stage issues the loads of the next one for the whole
+// group, so the cache misses of the lookups overlap instead of adding up.
+void HashtableIndex::SearchBatch(const VarStrView *keys, size_t n, VHandle **results)
+{
+  static constexpr size_t kGroupSize = 16;
+  uint32_t hashes[kGroupSize];
+  HashBucket *bkts[kGroupSize];
+
+  for (size_t base = 0; base < n; base += kGroupSize) {
+    auto cnt = std::min(kGroupSize, n - base);
+
+    for (size_t i = 0; i < cnt; i++) {
+      hashes[i] = hash(keys[base + i]);
+      bkts[i] = &buckets[bucket_idx(hashes[i])];
+      __builtin_prefetch(bkts[i]);
+    }
+
+    for (size_t i = 0; i < cnt; i++) {
+      auto meta = bkts[i]->meta.load(std::memory_order_acquire);
+      auto tag = HashBucket::Tag(RowOrder(hashes[i]));
+      for (auto m = HashBucket::Match(meta, tag); m; m &= m - 1) {
+        auto e = bkts[i]->slots[__builtin_ctz(m)].load(std::memory_order_relaxed);
+        if (e) __builtin_prefetch(e);
+      }
     }
-    p = p->next.load();
+
+    for (size_t i = 0; i < cnt; i++) {
+      auto row = Search(keys[base + i], hashes[i]);
+      // The caller is going to read the version array.
+      if (row) __builtin_prefetch(row);
+      results[base + i] = row;
+    }
+  }
+}
+
+bool HashtableIndex::Delete(const VarStrView &k)
+{
+  auto h = hash(k);
+  auto order = RowOrder(h);
+  auto head = GetBucket(bucket_idx(h));
+  auto x = HashEntry::Convert(k);
+  std::atomic<HashEntry *> *prev;
+  HashEntry *cur;
+
+  while (true) {
+    if (!Find(head, order, &x, k, &prev, &cur))
+      return false;
+    auto next = cur->next.load(std::memory_order_acquire);
+    if (!IsMarked(next) && cur->next.compare_exchange_strong(next, Marked(next)))
+      break;
+  }
+
+  // The row might be in the slots of its bucket, or of any bucket it was split
+  // from. Buckets split after the mark skip it.
+  for (auto idx = bucket_idx(h);; idx = ParentBucket(idx)) {
+    if (buckets[idx].sentinel.load() != nullptr) Unpublish(&buckets[idx], cur);
+    if (idx == 0) break;
+  }
+
+  // Try to unlink it. If we lose, whoever walks by next will do it.
+  auto next = Unmarked(cur->next.load(std::memory_order_acquire));
+  auto expected = cur;
+  if (prev->compare_exchange_strong(expected, next))
+    Retire(cur);
+  else
+    Find(head, order, &x, k, &prev, &cur);
+
+  Resize(-1);
+  return true;
+}
+
+bool HashtableIndex::Delete(VHandle *row)
+{
+  return Delete(((HashEntry *) ((uint8_t *) row + kOffset))->key_view());
+}
+
+void HashtableIndex::QueueDelete(VHandle *row)
+{
+  auto &q = queued_deletes[CurrentCore()];
+  q.lock.Lock();
+  q.rows.push_back(row);
+  q.lock.Unlock();
+}
+
+void HashtableIndex::ApplyQueuedDeletes()
+{
+  for (auto &q: queued_deletes) {
+    q.lock.Lock();
+    auto rows = std::move(q.rows);
+    q.rows.clear();
+    q.lock.Unlock();
+    for (auto row: rows) Delete(row);
+  }
+}
+
+// Rows are split into partitions by the lowest bits of their hash, which are
+// the highest bits of their order. So a partition is a range of the list, and
+// it starts with the sentinel of the bucket with the same number.
+static constexpr size_t kScanPartitionSize = 64 << 10;
+
+size_t HashtableIndex::nr_scan_partitions() const
+{
+  return std::max<size_t>(1, min_nr_buckets / kScanPartitionSize);
+}
+
+void HashtableIndex::ScanPartition(size_t part, const ScanFunc &f, threadinfo *ti)
+{
+  auto mask = nr_scan_partitions() - 1;
+  auto p = Unmarked(GetBucket(part)->next.load(std::memory_order_acquire));
+  while (p && (ReverseBits(p->order) & mask) == part) {
+    auto next = p->next.load(std::memory_order_acquire);
+    if (!p->is_sentinel() && !IsMarked(next))
+      f(p->key_view(), p->value());
+    p = Unmarked(next);
+  }
+}
+
+// Scans have to see every row inserted before them.
+OrderedIndex *HashtableIndex::ordered_index()
+{
+  abort_if(ordered == nullptr, "Table {} has no ordered index for range scans", id);
+  if (ordered->is_dirty()) {
+    for (auto e: ordered->Merge()) Reclaim(e);
+  }
+  return ordered;
+}
+
+Table::Iterator *HashtableIndex::IndexSearchIterator(const VarStrView &start, const VarStrView &end)
+{
+  return ordered_index()->NewIterator(start, end, false);
+}
+
+Table::Iterator *HashtableIndex::IndexSearchIterator(const VarStrView &start)
+{
+  return IndexSearchIterator(start, VarStrView(std::numeric_limits<uint16_t>::max(), nullptr));
+}
+
+Table::Iterator *HashtableIndex::IndexReverseIterator(const VarStrView &start, const VarStrView &end)
+{
+  return ordered_index()->NewIterator(start, end, true);
+}
+
+Table::Iterator *HashtableIndex::IndexReverseIterator(const VarStrView &start)
+{
+  return IndexReverseIterator(start, VarStrView());
+}
+
+OrderedIndex::OrderedIndex(size_t prefix_len)
+    : prefix_len(prefix_len)
+{
+  abort_if(prefix_len > 8, "The prefix of an ordered index is at most 8 bytes, not {}", prefix_len);
+  partitions = new Partition[kMaxNrPartitions];
+}
+
+// Zero padded, so keys compare the same as their bytes.
+uint64_t OrderedIndex::ReadBigEndian(const VarStrView &k, size_t off, size_t len) const
+{
+  uint64_t v = 0;
+  for (size_t i = 0; i < 8; i++) {
+    v <<= 8;
+    if (i < len && off + i < k.length()) v |= k.data()[off + i];
   }
+  return v;
+}
+
+OrderedIndex::Partition *OrderedIndex::FindPartition(uint64_t prefix, bool create)
+{
+  static constexpr int kShift = 64 - __builtin_ctzl(kMaxNrPartitions);
+  auto idx = (prefix * 0x9E3779B97F4A7C15ULL) >> kShift;
+  for (size_t n = 0; n < kMaxNrPartitions; n++, idx = (idx + 1) % kMaxNrPartitions) {
+    auto p = &partitions[idx];
+    if (!p->used.load(std::memory_order_acquire)) {
+      if (!create) return nullptr;
+      p->prefix = prefix;
+      p->used.store(true, std::memory_order_release);
+      return p;
+    }
+    if (p->prefix == prefix) return p;
+  }
+  abort_if(create, "Ordered index has more than {} partitions", kMaxNrPartitions);
   return nullptr;
 }
 
+// Lexicographic, like Masstree.
+static int CompareKeys(const VarStrView &a, const VarStrView &b)
+{
+  auto r = memcmp(a.data(), b.data(), std::min(a.length(), b.length()));
+  return r != 0 ? r : (int) a.length() - (int) b.length();
+}
+
+static bool SlotLess(const OrderedIndex::Slot &a, const OrderedIndex::Slot &b)
+{
+  if (a.sort_key != b.sort_key) return a.sort_key < b.sort_key;
+  return CompareKeys(a.entry->key_view(), b.entry->key_view()) < 0;
+}
+
+void OrderedIndex::LogInsert(int core, HashEntry *e)
+{
+  auto &l = logs[core];
+  l.lock.Lock();
+  l.inserted.push_back(e);
+  l.nr_logged.store(l.nr_logged.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  l.lock.Unlock();
+}
+
+void OrderedIndex::LogDelete(int core, HashEntry *e)
+{
+  auto &l = logs[core];
+  l.lock.Lock();
+  l.deleted.push_back(e);
+  l.nr_logged.store(l.nr_logged.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  l.lock.Unlock();
+}
+
+bool OrderedIndex::is_dirty() const
+{
+  for (auto &l: logs) {
+    if (l.nr_logged.load(std::memory_order_acquire) != l.nr_merged.load(std::memory_order_acquire))
+      return true;
+  }
+  return false;
+}
+
+// deleted is sorted by address. Deleted rows are not reclaimed before they are
+// merged, so they can still be compared.
+OrderedIndex::Run *OrderedIndex::BuildRun(const Run *old, const std::vector<Slot> &fresh,
+                                          const std::vector<HashEntry *> &deleted) const
+{
+  auto is_deleted = [&deleted](const Slot &s) {
+    return std::binary_search(deleted.begin(), deleted.end(), s.entry);
+  };
+  size_t nr_old = old ? old->nr : 0;
+  auto run = (Run *) malloc(sizeof(Run) + (nr_old + fresh.size()) * sizeof(Slot));
+  size_t i = 0, j = 0, k = 0;
+  while (true) {
+    while (i < nr_old && is_deleted(old->slots[i])) i++;
+    while (j < fresh.size() && is_deleted(fresh[j])) j++;
+    if (i == nr_old && j == fresh.size()) break;
+    if (j == fresh.size() || (i < nr_old && SlotLess(old->slots[i], fresh[j])))
+      run->slots[k++] = old->slots[i++];
+    else
+      run->slots[k++] = fresh[j++];
+  }
+  run->nr = k;
+  run->rcu_epoch = 0;
+  return run;
+}
+
+std::vector<HashEntry *> OrderedIndex::Merge()
+{
+  std::vector<std::pair<uint64_t, Slot>> fresh; // prefix and slot
+  std::vector<HashEntry *> deleted;
+  std::array<uint64_t, NodeConfiguration::kMaxNrThreads> nr_logged;
+
+  merge_lock.Lock();
+  if (!is_dirty()) {
+    merge_lock.Unlock();
+    return deleted;
+  }
+
+  for (size_t c = 0; c < logs.size(); c++) {
+    auto &l = logs[c];
+    l.lock.Lock();
+    nr_logged[c] = l.nr_logged.load(std::memory_order_relaxed);
+    for (auto e: l.inserted) {
+      auto k = e->key_view();
+      fresh.emplace_back(prefix_of(k), Slot{sort_key_of(k), e});
+    }
+    deleted.insert(deleted.end(), l.deleted.begin(), l.deleted.end());
+    l.inserted.clear();
+    l.deleted.clear();
+    l.lock.Unlock();
+  }
+
+  std::sort(fresh.begin(), fresh.end(),
+            [](const auto &a, const auto &b) {
+              return a.first != b.first ? a.first < b.first : SlotLess(a.second, b.second);
+            });
+  std::sort(deleted.begin(), deleted.end());
+
+  // Partitions with only deletes are rewritten too.
+  std::vector<uint64_t> prefixes;
+  for (auto &[prefix, s]: fresh) prefixes.push_back(prefix);
+  for (auto e: deleted) prefixes.push_back(prefix_of(e->key_view()));
+  std::sort(prefixes.begin(), prefixes.end());
+  prefixes.erase(std::unique(prefixes.begin(), prefixes.end()), prefixes.end());
+
+  auto cur_epoch_nr = util::Instance<EpochManager>().current_epoch_nr();
+  std::vector<Slot> group;
+  auto it = fresh.begin();
+  for (auto prefix: prefixes) {
+    group.clear();
+    for (; it != fresh.end() && it->first == prefix; ++it) group.push_back(it->second);
+
+    auto p = FindPartition(prefix, true);
+    auto old = p->run.load(std::memory_order_relaxed);
+    p->run.store(BuildRun(old, group, deleted), std::memory_order_release);
+    if (old) {
+      old->rcu_epoch = cur_epoch_nr;
+      retired_runs.push_back(old);
+    }
+  }
+
+  for (size_t c = 0; c < logs.size(); c++)
+    logs[c].nr_merged.store(nr_logged[c], std::memory_order_release);
+
+  // Scans of this epoch and the pipelined one may still be reading.
+  auto end = std::remove_if(
+      retired_runs.begin(), retired_runs.end(),
+      [cur_epoch_nr](Run *r) {
+        if (r->rcu_epoch + 2 > cur_epoch_nr) return false;
+        free(r);
+        return true;
+      });
+  retired_runs.erase(end, retired_runs.end());
+  merge_lock.Unlock();
+
+  return deleted;
+}
+
+class OrderedIndex::Iterator final : public Table::Iterator {
+  const Run *run;
+  long pos;
+  int step;
+
+  bool in_range() const { return pos >= 0 && pos < (long) run->nr; }
+  // Rows deleted after the merge are still in the array.
+  void Adapt() {
+    for (; in_range(); pos += step) {
+      auto e = run->slots[pos].entry;
+      if (IsMarked(e->next.load(std::memory_order_acquire))) continue;
+      cur_key = e->key_view();
+      vhandle = e->value();
+      break;
+    }
+  }
+ public:
+  Iterator(const Run *run, long pos, bool reverse, const VarStrView &end)
+      : run(run), pos(pos), step(reverse ? -1 : 1) {
+    end_key = end;
+    Adapt();
+  }
+
+  void Next() override final {
+    pos += step;
+    Adapt();
+  }
+  bool IsValid() const override final {
+    if (!in_range()) return false;
+    return step > 0 ? !(end_key < cur_key) : !(cur_key < end_key);
+  }
+
+  static void *operator new(size_t sz) {
+    return mem::AllocFromRoutine(sz);
+  }
+  static void operator delete(void *p) {}
+};
+
+static OrderedIndex::Run g_empty_run = {0, 0};
+
+Table::Iterator *OrderedIndex::NewIterator(const VarStrView &start, const VarStrView &end, bool reverse)
+{
+  auto prefix = prefix_of(start);
+  abort_if(end.data() != nullptr && prefix_of(end) != prefix,
+           "Range scan from {} to {} leaves its partition of the ordered index",
+           start.ToHex(), end.ToHex());
+
+  auto p = FindPartition(prefix, false);
+  const Run *run = p ? p->run.load(std::memory_order_acquire) : nullptr;
+  if (run == nullptr) run = &g_empty_run;
+
+  auto sort_key = sort_key_of(start);
+  auto first = run->slots, last = run->slots + run->nr;
+  long pos;
+  if (!reverse) {
+    // The first slot >= start
+    pos = std::lower_bound(
+        first, last, start,
+        [sort_key](const Slot &s, const VarStrView &k) {
+          return s.sort_key != sort_key ? s.sort_key < sort_key : CompareKeys(s.entry->key_view(), k) < 0;
+        }) - first;
+  } else {
+    // The last slot <= start
+    pos = std::upper_bound(
+        first, last, start,
+        [sort_key](const VarStrView &k, const Slot &s) {
+          return s.sort_key != sort_key ? sort_key < s.sort_key : CompareKeys(k, s.entry->key_view()) < 0;
+        }) - first - 1;
+  }
+  return new Iterator(run, pos, reverse, end);
+}
+
 uint32_t DefaultHash(const VarStrView &k)
 {
   return XXH32(k.data(), k.length(), 0xdeadbeef);
@@ -2,9 +2,13 @@
 #define HASHTABLE_INDEX_IMPL
 
 #include <cstdlib>
+#include <vector>
+#include <limits>
 #include <immintrin.h>
 
 #include "index_common.h"
+#include "util/arch.h"
+#include "util/locks.h"
 
 namespace felis {
 
@@ -12,38 +16,269 @@ typedef uint32_t (*HashFunc)(const VarStrView &);
 
 struct HashEntry {
   using Key = std::array<uint8_t, 16>;
+  // Keys up to kMaxInlineKeyLength bytes are inline, zero padded, with the
+  // length in the last byte. Longer keys are copied to an arena. The entry then
+  // keeps the pointer to the copy in the first 8 bytes, the first 7 bytes of
+  // the key after it, and kSpilledKey in the last byte. Most mismatches are
+  // caught by the one vector compare on the 16 bytes.
+  static constexpr size_t kMaxInlineKeyLength = 15;
+  static constexpr uint8_t kSpilledKey = 0xFF;
+
   Key key;
+  // The lowest bit marks this entry as deleted.
   std::atomic<HashEntry *> next;
+  // Position in the split-ordered list. Odd for rows and even for the bucket
+  // sentinels, see HashtableIndex.
+  uint32_t order;
+  // The epoch in which this entry was unlinked.
+  uint32_t rcu_epoch;
 
-  // TODO: we have not implemented delete yet
-  uint64_t rcu_epoch;
-
+  // The key to search with. For a long key, the pointer is left as 0, so it
+  // never fully matches an entry.
   static Key Convert(const VarStrView &k) {
     Key x;
     x.fill(0);
-    std::copy(k.data(), k.data() + k.length(), x.begin());
+    if (k.length() <= kMaxInlineKeyLength) {
+      std::copy(k.data(), k.data() + k.length(), x.begin());
+      x[15] = k.length();
+    } else {
+      std::copy(k.data(), k.data() + 7, x.begin() + 8);
+      x[15] = kSpilledKey;
+    }
     return x;
   }
 
-  bool Compare(const Key &x) {
-    return __builtin_memcmp(key.data(), x.data(), 16) == 0;
+  // x is Convert(k).
+  bool Compare(const Key &x, const VarStrView &k) const {
+    auto eq = _mm_movemask_epi8(
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) key.data()),
+                       _mm_loadu_si128((const __m128i *) x.data())));
+    if (eq == 0xFFFF) return true;
+    if ((eq & 0xFF00) != 0xFF00 || key[15] != kSpilledKey) return false;
+    auto p = spilled_key();
+    return *(uint16_t *) p == k.length() && __builtin_memcmp(p + 2, k.data(), k.length()) == 0;
+  }
+
+  // The arena copy of a long key: the length as a uint16_t and the key.
+  const uint8_t *spilled_key() const { return *(const uint8_t * const *) key.data(); }
+
+  VarStrView key_view() const {
+    if (key[15] != kSpilledKey) return VarStrView(key[15], key.data());
+    auto p = spilled_key();
+    return VarStrView(*(uint16_t *) p, p + 2);
   }
 
+  bool is_sentinel() const { return (order & 0x01) == 0; }
+
   VHandle *value() const;
 };
 
 static_assert(sizeof(HashEntry) == 32);
 
+// The metadata of a bucket, one cache line. Besides the sentinel, it caches up
+// to kNrSlots rows of the bucket, like a group of a Swiss table. Each slot has
+// a tag, 7 bits from the hash with the high bit set, so one vector compare
+// finds the slots worth dereferencing. A lookup that misses touches only this
+// cache line, unless the bucket has more rows than slots.
+struct alignas(64) HashBucket {
+  static constexpr int kNrSlots = 6;
+  // Flags, in the 7th byte of meta.
+  static constexpr uint8_t kIncomplete = 0x01; // some rows did not fit
+  static constexpr uint8_t kPopulating = 0x02; // the split is still filling the slots
+
+  std::atomic<HashEntry *> sentinel;
+  // The tags of the slots from the lowest byte, 0 for a free slot, then the
+  // flags.
+  std::atomic_uint64_t meta;
+  std::atomic<HashEntry *> slots[kNrSlots];
+
+  // From the split order, since the rows of a bucket share its highest bits.
+  static uint8_t Tag(uint32_t order) { return ((order * 0x9E3779B1U) >> 25) | 0x80; }
+  static uint8_t Flags(uint64_t meta) { return meta >> 48; }
+  static uint64_t FlagBits(uint8_t flags) { return (uint64_t) flags << 48; }
+
+  // Slots whose tag is tag, as a bitmask.
+  static unsigned int Match(uint64_t meta, uint8_t tag) {
+    auto eq = _mm_cmpeq_epi8(_mm_cvtsi64_si128(meta), _mm_set1_epi8(tag));
+    return _mm_movemask_epi8(eq) & ((1 << kNrSlots) - 1);
+  }
+  static unsigned int FreeSlots(uint64_t meta) { return Match(meta, 0); }
+};
+
+static_assert(sizeof(HashBucket) == 64);
+
+// The ordered companion of a HashtableIndex, so that the table can be range
+// scanned while point lookups stay in the hashtable.
+//
+// Rows are partitioned by the first prefix_len (up to 8) bytes of the key, say
+// the warehouse and the district, and a range scan never leaves the partition
+// it starts in. Each partition is a sorted array of HashEntry pointers, with
+// the next 8 key bytes next to each pointer, so a binary search rarely touches
+// the rows. Arrays are never modified. Inserts and deletes are logged per core
+// first, and the first scan that finds anything in the logs merges them into
+// new arrays of the partitions they touched. Rows are inserted in the Insert
+// phase and scanned after it, so that's about once an epoch, and scans see
+// every row inserted before them. Replaced arrays are freed two epochs later,
+// like the rows.
+class OrderedIndex {
+ public:
+  static constexpr size_t kMaxNrPartitions = 16 << 10;
+
+  struct Slot {
+    uint64_t sort_key; // key bytes after the prefix, big endian
+    HashEntry *entry;
+  };
+  struct Run {
+    size_t nr;
+    uint64_t rcu_epoch;
+    Slot slots[];
+  };
+  class Iterator;
+ private:
+  size_t prefix_len;
+
+  // Open addressing, and only the merge inserts.
+  struct Partition {
+    std::atomic_bool used = false;
+    uint64_t prefix;
+    std::atomic<Run *> run = nullptr;
+  };
+  Partition *partitions;
+
+  struct Log {
+    util::SpinLock lock;
+    std::vector<HashEntry *> inserted;
+    std::vector<HashEntry *> deleted;
+    std::atomic_ulong nr_logged = 0;
+    std::atomic_ulong nr_merged = 0;
+  };
+  std::array<util::CacheAligned<Log>, NodeConfiguration::kMaxNrThreads> logs;
+
+  util::SpinLock merge_lock;
+  std::vector<Run *> retired_runs;
+
+  uint64_t ReadBigEndian(const VarStrView &k, size_t off, size_t len) const;
+  uint64_t prefix_of(const VarStrView &k) const { return ReadBigEndian(k, 0, prefix_len); }
+  uint64_t sort_key_of(const VarStrView &k) const { return ReadBigEndian(k, prefix_len, 8); }
+  Partition *FindPartition(uint64_t prefix, bool create);
+  Run *BuildRun(const Run *old, const std::vector<Slot> &fresh,
+                const std::vector<HashEntry *> &deleted) const;
+ public:
+  OrderedIndex(size_t prefix_len);
+
+  void LogInsert(int core, HashEntry *e);
+  void LogDelete(int core, HashEntry *e);
+  bool is_dirty() const;
+  // Merges the logs. Returns the deleted entries, which are not in any array
+  // now, for the HashtableIndex to reclaim.
+  std::vector<HashEntry *> Merge();
+
+  Table::Iterator *NewIterator(const VarStrView &start, const VarStrView &end, bool reverse);
+};
+
+// A split-ordered list (Shalev and Shavit). All entries are in one lock-free
+// linked list, sorted by the bit reversed hash. A bucket points to a sentinel
+// entry in the list, and its rows follow the sentinel. Doubling the number of
+// buckets does not move anything: the new bucket b + n splits bucket b by
+// inserting its sentinel in the middle of b's rows, lazily, by the first
+// insert or lookup that hits it. So rows never move, and VHandle pointers stay
+// valid while the table grows.
+//
+// Lookups probe the slots of the bucket first, and only walk the list if the
+// bucket is not complete. A split fills the slots of the new bucket from the
+// list. The table never shrinks, because the merged bucket would not know the
+// rows of the other half. A Search() may miss a row whose SearchOrCreate() has
+// not returned yet.
+//
+// Deletes mark the entry and unlink it (Harris). Readers do not take locks, so
+// an unlinked row might still be in use. It is freed two epochs later, or once
+// the GC is done with it, whichever is later.
+//
+// If configured with an ordered prefix length, the table keeps an OrderedIndex
+// as well, and supports range scans.
 class HashtableIndex final : public Table {
+ public:
+  static constexpr size_t kMaxNrBuckets = 1UL << 27;
+  // Grow when there are more rows than buckets.
+  static constexpr long kGrowLoad = 1;
+  static constexpr size_t kNoOrderedIndex = std::numeric_limits<size_t>::max();
+ private:
   HashFunc hash;
-  size_t nr_buckets;
-  uint8_t *table;
+  // Reserved for kMaxNrBuckets, and paged in on demand.
+  HashBucket *buckets;
+  std::atomic_ulong nr_buckets;
+  // What we were created with.
+  size_t min_nr_buckets;
+
+  std::array<util::CacheAligned<std::atomic_long>, NodeConfiguration::kMaxNrThreads> nr_rows;
+
+  struct RetiredList {
+    util::SpinLock lock;
+    std::vector<HashEntry *> entries;
+  };
+  std::array<util::CacheAligned<RetiredList>, NodeConfiguration::kMaxNrThreads> retired;
+
+  struct DeleteQueue {
+    util::SpinLock lock;
+    std::vector<VHandle *> rows;
+  };
+  std::array<util::CacheAligned<DeleteQueue>, NodeConfiguration::kMaxNrThreads> queued_deletes;
+
+  OrderedIndex *ordered = nullptr;
+
+  // For chkpt/, which assumes that all keys in a table have the same length.
+  void RememberKeyLength(const VarStrView &k) {
+    if (key_len != k.length()) key_len = k.length();
+  }
+
+  VHandle *Search(const VarStrView &k, uint32_t h);
+  size_t bucket_idx(uint32_t h) const { return h & (nr_buckets.load(std::memory_order_acquire) - 1); }
+  HashEntry *GetBucket(size_t idx);
+  HashEntry *InitializeBucket(size_t idx);
+  bool Find(HashEntry *head, uint32_t order, const HashEntry::Key *key, const VarStrView &k,
+            std::atomic<HashEntry *> **prev_out, HashEntry **cur_out);
+  HashEntry *Probe(HashBucket *b, uint32_t order, const HashEntry::Key &x, const VarStrView &k,
+                   bool *complete);
+  bool Publish(size_t idx, HashEntry *e);
+  void Unpublish(HashBucket *b, HashEntry *e);
+  bool Evict(size_t idx);
+  void ClearSlot(HashBucket *b, int i, HashEntry *e);
+  void Retire(HashEntry *entry);
+  void Reclaim(HashEntry *entry);
+  void Resize(long delta);
+  OrderedIndex *ordered_index();
  public:
   HashtableIndex(std::tuple<HashFunc, size_t, bool> conf);
+  // The last one is the prefix length of the OrderedIndex.
+  HashtableIndex(std::tuple<HashFunc, size_t, bool, size_t> conf);
 
   VHandle *SearchOrCreate(const VarStrView &k, bool *created) override;
   VHandle *SearchOrCreate(const VarStrView &k) override;
   VHandle *Search(const VarStrView &k) override;
+  void SearchBatch(const VarStrView *keys, size_t n, VHandle **results) override;
+
+  // Only with an OrderedIndex. start and end must have the same prefix.
+  Table::Iterator *IndexSearchIterator(const VarStrView &start, const VarStrView &end) override;
+  Table::Iterator *IndexSearchIterator(const VarStrView &start) override;
+  Table::Iterator *IndexReverseIterator(const VarStrView &start, const VarStrView &end) override;
+  Table::Iterator *IndexReverseIterator(const VarStrView &start) override;
+
+  // Removes the row from the index. Txns that found it in this epoch or the
+  // last can still use it. Returns false if the key is not there.
+  bool Delete(const VarStrView &k);
+  // row must be from this table.
+  bool Delete(VHandle *row);
+  // Deletes the row at the start of the next Insert phase instead. A checkpoint
+  // scan of this epoch would miss the row if it left the index now, although
+  // the row is still there as of the epoch.
+  void QueueDelete(VHandle *row);
+  void ApplyQueuedDeletes() override;
+
+  size_t nr_scan_partitions() const override;
+  void ScanPartition(size_t part, const ScanFunc &f, threadinfo *ti) override;
+
+  size_t current_nr_buckets() const { return nr_buckets.load(std::memory_order_acquire); }
+  long nr_rows_approx() const;
 };
 
 uint32_t DefaultHash(const VarStrView &);
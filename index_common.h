@@ -7,6 +7,7 @@
 #include <memory>
 #include <mutex>
 #include <atomic>
+#include <functional>
 
 #include "mem.h"
 #include "log.h"
@@ -17,6 +18,8 @@
 #include "node_config.h"
 #include "shipping.h"
 
+class threadinfo;
+
 namespace felis {
 
 using util::ListNode;
@@ -40,7 +43,7 @@ class Table {
   std::atomic_uint64_t *auto_increment_cnt;
   bool enable_inline;
  public:
-  Table() : id(-1), read_only(false) {
+  Table() : id(-1), read_only(false), key_len(0) {
     auto_increment_cnt = new std::atomic_uint64_t[kAutoIncrementZones];
   }
 
@@ -100,6 +103,11 @@ class Table {
   virtual VHandle *SearchOrCreate(const VarStrView &k, bool *created) { return nullptr; }
   virtual VHandle *SearchOrCreate(const VarStrView &k) { return nullptr; }
   virtual VHandle *Search(const VarStrView &k) { return nullptr; }
+  // Looks up n keys at once. Indexes that can overlap the cache misses of the
+  // lookups override this.
+  virtual void SearchBatch(const VarStrView *keys, size_t n, VHandle **results) {
+    for (size_t i = 0; i < n; i++) results[i] = Search(keys[i]);
+  }
   virtual Table::Iterator *IndexSearchIterator(const VarStrView &start) {
     return nullptr;
   }
@@ -113,6 +121,18 @@ class Table {
     return nullptr;
   }
 
+  // Checkpoints walk every row with ScanPartition(). Partitions are disjoint,
+  // so they can be scanned in parallel. Rows inserted during the scan may or
+  // may not show up. The scanning threads are not on the go scheduler, so each
+  // brings its own Masstree threadinfo, from MasstreeIndex::NewThreadInfo().
+  using ScanFunc = std::function<void (const VarStrView &, VHandle *)>;
+  virtual size_t nr_scan_partitions() const { return 1; }
+  virtual void ScanPartition(size_t part, const ScanFunc &f, threadinfo *ti) {}
+
+  // Indexes that can defer deletes apply them here. It is called at the start
+  // of the Insert phase, once no checkpoint is scanning.
+  virtual void ApplyQueuedDeletes() {}
+
   VHandle *NewRow();
   size_t row_size() const {
     if (is_enable_inline()) return VHandle::kInlinedSize;
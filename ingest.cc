@@ -0,0 +1,288 @@
+#include <thread>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "ingest.h"
+#include "epoch.h"
+#include "log.h"
+
+namespace felis {
+
+unsigned long IngestEpoch::Claim(unsigned long nr)
+{
+  auto seq = next_seq.fetch_add(1, std::memory_order_acq_rel) + 1;
+  if (seq > nr) return 0;
+  if (seq == 1) first_txn_ns.store(time_ns(), std::memory_order_release);
+  return seq;
+}
+
+unsigned long IngestEpoch::Close(unsigned long nr)
+{
+  // Claims after this one see kClosed, so whatever was claimed before is the
+  // epoch.
+  auto n = next_seq.exchange(kClosed, std::memory_order_acq_rel);
+  return n < nr ? n : 0;
+}
+
+IngestService::IngestService(size_t record_size, int nr_shards, long epoch_timeout_ns)
+    : record_size(record_size),
+      slot_size(util::Align(sizeof(Slot) + record_size, CACHE_LINE_SIZE)),
+      nr_shards(nr_shards),
+      epoch_timeout_ns(epoch_timeout_ns),
+      origins(EpochClient::g_max_epoch - 1)
+{
+  for (int d = 0; d < nr_shards; d++) {
+    auto ring = new Ring();
+    ring->slots = new uint8_t[kRingSize * slot_size];
+    rings.push_back(ring);
+  }
+}
+
+void IngestService::Listen(const std::string &address)
+{
+  int res = -1;
+  if (address.compare(0, 5, "unix:") == 0) {
+    struct sockaddr_un addr;
+    auto path = address.substr(5);
+    abort_if(path.length() >= sizeof(addr.sun_path), "Unix socket path {} is too long", path);
+
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+    unlink(path.c_str());
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd >= 0)
+      res = bind(listen_fd, (struct sockaddr *) &addr, sizeof(struct sockaddr_un));
+  } else {
+    struct sockaddr_in addr;
+    auto pos = address.find(":");
+
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    if (pos != address.npos) {
+      addr.sin_addr.s_addr = inet_addr(address.substr(0, pos).c_str());
+      addr.sin_port = htons(std::stoi(address.substr(pos + 1)));
+    } else {
+      addr.sin_port = htons(std::stoi(address));
+    }
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd >= 0) {
+      int enable = 1;
+      setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int));
+      res = bind(listen_fd, (struct sockaddr *) &addr, sizeof(struct sockaddr_in));
+    }
+  }
+  abort_if(res < 0 || listen(listen_fd, 128) < 0,
+           "Cannot listen on {} for ingestion, errno={}", address, errno);
+  logger->info("Ingesting requests from {}", address);
+
+  std::thread([this]() { ReceiveLoop(); }).detach();
+  std::thread([this]() { SendLoop(); }).detach();
+}
+
+void IngestService::Accept()
+{
+  int fd = accept(listen_fd, nullptr, nullptr);
+  if (fd < 0) {
+    perror("accept");
+    return;
+  }
+  // Completions are small and latency sensitive. Harmless on Unix sockets.
+  int enable = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(int));
+
+  std::lock_guard _(conns_lock);
+  conns.push_back(new Connection(fd));
+}
+
+bool IngestService::Read(unsigned int conn_id)
+{
+  auto conn = conns[conn_id];
+  auto frame_size = sizeof(IngestRequestHeader) + record_size;
+  int rs = read(conn->fd, conn->buffer + conn->len, kReadBufferSize - conn->len);
+  if (rs < 0 && errno == EINTR)
+    return true;
+  if (rs <= 0)
+    return false;
+
+  conn->len += rs;
+  size_t off = 0;
+  for (; off + frame_size <= conn->len; off += frame_size) {
+    Push(conn_id, conn->buffer + off);
+  }
+  memmove(conn->buffer, conn->buffer + off, conn->len - off);
+  conn->len -= off;
+  return true;
+}
+
+void IngestService::Push(unsigned int conn_id, const uint8_t *req)
+{
+  auto ring = rings[next_shard++ % nr_shards];
+  auto head = ring->head.load(std::memory_order_relaxed);
+
+  // Backpressure: while we wait here, nobody reads the sockets.
+  while (head - ring->tail.load(std::memory_order_acquire) >= kRingSize)
+    _mm_pause();
+
+  auto s = slot(ring, head);
+  s->req_id = ((const IngestRequestHeader *) req)->req_id;
+  s->conn = conn_id;
+  memcpy(s->record, req + sizeof(IngestRequestHeader), record_size);
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+void IngestService::ReceiveLoop()
+{
+  std::vector<struct pollfd> fds;
+  std::vector<unsigned int> fd_conns;
+  while (true) {
+    fds.clear();
+    fd_conns.clear();
+    fds.push_back({listen_fd, POLLIN, 0});
+    for (unsigned int i = 0; i < conns.size(); i++) {
+      if (!conns[i]->alive.load()) continue;
+      fds.push_back({conns[i]->fd, POLLIN, 0});
+      fd_conns.push_back(i);
+    }
+
+    int res = poll(fds.data(), fds.size(), -1);
+    if (res < 0) {
+      abort_if(errno != EINTR, "poll() failed on ingestion sockets, errno={}", errno);
+      continue;
+    }
+
+    for (size_t i = 1; i < fds.size(); i++) {
+      if (fds[i].revents == 0) continue;
+      if (!Read(fd_conns[i - 1])) {
+        // Keep the fd open. Completions of its txns in flight are simply
+        // dropped, and we don't want the fd number to be reused by then.
+        auto conn = conns[fd_conns[i - 1]];
+        conn->alive = false;
+        shutdown(conn->fd, SHUT_RDWR);
+      }
+    }
+    if (fds[0].revents & POLLIN)
+      Accept();
+  }
+}
+
+char *IngestService::WaitForRequest(int shard, IngestEpoch &epoch, unsigned long nr, unsigned long *seq)
+{
+  auto ring = rings[shard];
+  auto tail = ring->tail.load(std::memory_order_relaxed);
+  *seq = 0;
+  while (ring->head.load(std::memory_order_acquire) == tail) {
+    // Other shards might fill the epoch while we wait.
+    if (epoch.is_complete(nr))
+      return nullptr;
+    auto first = epoch.first_txn_ns.load(std::memory_order_acquire);
+    if (first != 0 && time_ns() - first >= epoch_timeout_ns) {
+      *seq = epoch.Close(nr);
+      return nullptr;
+    }
+    _mm_pause();
+  }
+  if ((*seq = epoch.Claim(nr)) == 0)
+    return nullptr;
+  return slot(ring, tail)->record;
+}
+
+IngestService::Origin *IngestService::EpochOrigins(uint64_t epoch_nr)
+{
+  auto &p = origins[epoch_nr - 1];
+  auto epoch_origins = p.load(std::memory_order_acquire);
+  if (epoch_origins) return epoch_origins;
+
+  // Shards race on the first requests of an epoch. One allocation wins.
+  auto n = new Origin[EpochClient::g_txn_per_epoch];
+  if (p.compare_exchange_strong(epoch_origins, n, std::memory_order_acq_rel))
+    return n;
+  delete [] n;
+  return epoch_origins;
+}
+
+void IngestService::FinishRequest(int shard, uint64_t epoch_nr, uint64_t seq)
+{
+  auto ring = rings[shard];
+  auto tail = ring->tail.load(std::memory_order_relaxed);
+  auto s = slot(ring, tail);
+  EpochOrigins(epoch_nr)[seq - 1] = {s->req_id, s->conn};
+  ring->tail.store(tail + 1, std::memory_order_release);
+}
+
+void IngestService::OnEpochCommit(uint64_t epoch_nr, uint64_t nr_txns)
+{
+  {
+    std::lock_guard _(commit_lock);
+    committed_epochs.emplace_back(epoch_nr, nr_txns);
+  }
+  commit_cond.notify_one();
+}
+
+bool IngestService::Send(Connection *conn, const void *p, size_t len)
+{
+  size_t l = 0;
+  while (l < len) {
+    int rs = write(conn->fd, (const uint8_t *) p + l, len - l);
+    if (rs < 0) {
+      if (errno == EINTR)
+        continue;
+      else
+        return false;
+    }
+    l += rs;
+  }
+  return true;
+}
+
+void IngestService::SendLoop()
+{
+  std::vector<std::vector<IngestCompletion>> batches;
+  while (true) {
+    uint64_t epoch_nr, nr_txns;
+    {
+      std::unique_lock l(commit_lock);
+      commit_cond.wait(l, [this]() { return !committed_epochs.empty(); });
+      std::tie(epoch_nr, nr_txns) = committed_epochs.front();
+      committed_epochs.pop_front();
+    }
+
+    std::vector<Connection *> snapshot;
+    {
+      std::lock_guard _(conns_lock);
+      snapshot = conns;
+    }
+    batches.resize(snapshot.size());
+
+    // Empty epochs never allocated any.
+    auto epoch_origins = origins[epoch_nr - 1].load(std::memory_order_acquire);
+    for (uint64_t i = 0; i < nr_txns; i++) {
+      auto &o = epoch_origins[i];
+      batches[o.conn].push_back({o.req_id, epoch_nr});
+    }
+    for (size_t c = 0; c < snapshot.size(); c++) {
+      auto &b = batches[c];
+      if (b.empty()) continue;
+      if (snapshot[c]->alive.load()
+          && !Send(snapshot[c], b.data(), b.size() * sizeof(IngestCompletion))) {
+        snapshot[c]->alive = false;
+      }
+      b.clear();
+    }
+
+    delete [] epoch_origins;
+    origins[epoch_nr - 1].store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+}
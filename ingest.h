@@ -0,0 +1,152 @@
+// -*- mode: c++ -*-
+
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace felis {
+
+// Wire protocol of the ingestion socket. A client streams requests, each one
+// is this header followed by one marshalled txn of
+// EpochClient::MarshalledTxnSize() bytes, the same record as in the txn log.
+// Everything is in host byte order.
+struct IngestRequestHeader {
+  uint64_t req_id;
+} __attribute__((packed));
+
+// Sent back to the client once the epoch of the request has committed. There
+// is no ordering between completions of the same epoch.
+struct IngestCompletion {
+  uint64_t req_id;
+  uint64_t epoch_nr;
+} __attribute__((packed));
+
+// How the dispatcher shards share the sequence numbers of an epoch when txns
+// come from clients. Shards take the next number whenever they have a request,
+// so the numbers follow the arrivals. The epoch closes when it's full, or, if
+// it's not full after the timeout since its first txn, when the first shard to
+// notice closes it with the txns it has so far.
+struct IngestEpoch {
+  static constexpr unsigned long kClosed = 1UL << 62;
+
+  std::atomic_ulong next_seq = 0;
+  std::atomic_long first_txn_ns = 0;
+
+  // Returns the sequence number for a request, or 0 if the epoch already has
+  // all of its nr txns.
+  unsigned long Claim(unsigned long nr);
+  // Returns the number of txns of the epoch if we closed it before it has all
+  // of its nr txns, 0 otherwise.
+  unsigned long Close(unsigned long nr);
+  bool is_complete(unsigned long nr) const { return next_seq.load(std::memory_order_acquire) >= nr; }
+};
+
+// Feeds the streaming dispatchers (DISPATCHER mode) from clients over a TCP or
+// Unix socket, instead of replaying the txn log.
+//
+// One thread accepts and reads all connections. It reads in large chunks and
+// deals complete requests to the dispatcher shards round-robin, through one
+// single-producer single-consumer ring per shard. When a ring is full, the
+// thread stops reading, so the socket buffers fill up and clients see the
+// backpressure.
+//
+// Epochs do not wait to be full forever. Under light load, one closes
+// epoch_timeout_ns after its first request, so that a single request still
+// runs.
+//
+// Once an epoch commits, another thread sends one batch of completions to
+// every client that had txns in it.
+class IngestService {
+ public:
+  static constexpr size_t kRingSize = 16 << 10;
+  static constexpr size_t kReadBufferSize = 256 << 10;
+ private:
+  struct Slot {
+    uint64_t req_id;
+    uint32_t conn;
+    uint32_t __padding__;
+    char record[];
+  };
+
+  struct Ring {
+    std::atomic_ulong head = 0; // written by the receiver
+    alignas(CACHE_LINE_SIZE) std::atomic_ulong tail = 0; // written by the dispatcher
+    uint8_t *slots;
+  };
+
+  struct Origin {
+    uint64_t req_id;
+    uint32_t conn;
+  };
+
+  struct Connection {
+    int fd;
+    std::atomic_bool alive = true;
+    size_t len = 0;
+    uint8_t *buffer;
+    Connection(int fd) : fd(fd), buffer(new uint8_t[kReadBufferSize]) {}
+  };
+
+  size_t record_size;
+  size_t slot_size;
+  int nr_shards;
+  long epoch_timeout_ns;
+  int listen_fd = -1;
+  unsigned int next_shard = 0;
+  std::vector<Ring *> rings; // one per shard
+
+  // Per epoch, indexed by sequence number - 1. Allocated by the dispatcher
+  // that finishes the first request of the epoch, and freed after the
+  // completions are sent.
+  std::vector<std::atomic<Origin *>> origins;
+
+  // Only grows. The lock is only for the sender to look at it.
+  std::mutex conns_lock;
+  std::vector<Connection *> conns;
+
+  std::mutex commit_lock;
+  std::condition_variable commit_cond;
+  std::deque<std::pair<uint64_t, uint64_t>> committed_epochs; // epoch_nr, nr_txns
+
+  Slot *slot(Ring *ring, unsigned long pos) {
+    return (Slot *) (ring->slots + (pos % kRingSize) * slot_size);
+  }
+
+  void ReceiveLoop();
+  void SendLoop();
+  void Accept();
+  bool Read(unsigned int conn_id);
+  void Push(unsigned int conn_id, const uint8_t *req);
+  Origin *EpochOrigins(uint64_t epoch_nr);
+  bool Send(Connection *conn, const void *p, size_t len);
+ public:
+  IngestService(size_t record_size, int nr_shards, long epoch_timeout_ns);
+
+  // address is either unix:<path>, or [<host>:]<port> for TCP.
+  void Listen(const std::string &address);
+
+  // Called by dispatcher shard, for an epoch of at most nr txns. Spins until
+  // there is a request for this shard, and returns its marshalled txn and its
+  // sequence number in *seq. The record stays valid until FinishRequest().
+  //
+  // Returns nullptr once the epoch has all its txns. The request we have, if
+  // any, stays for the next epoch. If we closed the epoch early, *seq is the
+  // number of txns it ended up with, and 0 otherwise.
+  char *WaitForRequest(int shard, IngestEpoch &epoch, unsigned long nr, unsigned long *seq);
+  // The request has been populated into txn epoch_nr:seq.
+  void FinishRequest(int shard, uint64_t epoch_nr, uint64_t seq);
+
+  // Called by the epoch control once all txns of epoch_nr have committed.
+  void OnEpochCommit(uint64_t epoch_nr, uint64_t nr_txns);
+};
+
+}
+
+#endif /* INGEST_H */
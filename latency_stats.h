@@ -0,0 +1,123 @@
+// -*- mode: c++ -*-
+
+#ifndef LATENCY_STATS_H
+#define LATENCY_STATS_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include "probe_utils.h"
+#include "json11/json11.hpp"
+#include "log.h"
+
+namespace felis {
+
+// Txn latencies in us, from the arrival at the dispatcher until the workload
+// records the duration. The queueing delay is the part before the Execute
+// phase picks the txn up, the execution time is the rest.
+//
+// Each epoch is collected into one set of histograms, which is then merged
+// into the per txn type totals.
+class TxnLatencyStats {
+ public:
+  static constexpr int kMaxTxnTypes = 8;
+  using Histogram = agg::HdrLogHistogram<>;
+
+  struct Histograms {
+    Histogram total;
+    Histogram queue;
+    Histogram exec;
+
+    Histograms &operator<<(const Histograms &rhs) {
+      total << rhs.total;
+      queue << rhs.queue;
+      exec << rhs.exec;
+      return *this;
+    }
+    void Clear() {
+      total.Clear();
+      queue.Clear();
+      exec.Clear();
+    }
+  };
+ private:
+  Histograms cur_epoch;
+  Histograms types[kMaxTxnTypes];
+  std::vector<json11::Json> epochs;
+
+  static json11::Json PercentilesToJson(const Histogram &h) {
+    return json11::Json::object({
+        {"p50", static_cast<int>(h.CalculatePercentile(0.5))},
+        {"p99", static_cast<int>(h.CalculatePercentile(0.99))},
+        {"p999", static_cast<int>(h.CalculatePercentile(0.999))},
+      });
+  }
+  static json11::Json ToJson(const Histograms &h) {
+    return json11::Json::object({
+        {"count", static_cast<int>(h.total.Count())},
+        {"latency", PercentilesToJson(h.total)},
+        {"queue", PercentilesToJson(h.queue)},
+        {"exec", PercentilesToJson(h.exec)},
+      });
+  }
+ public:
+  void Add(int type, long total_us, long queue_us) {
+    abort_if(type < 0 || type >= kMaxTxnTypes, "Txn type {} out of range", type);
+    total_us = std::max(total_us, queue_us);
+    cur_epoch.total << total_us;
+    cur_epoch.queue << queue_us;
+    cur_epoch.exec << total_us - queue_us;
+    types[type].total << total_us;
+    types[type].queue << queue_us;
+    types[type].exec << total_us - queue_us;
+  }
+
+  // Of the epoch being collected.
+  long EpochPercentile(double scale) const { return cur_epoch.total.CalculatePercentile(scale); }
+
+  void EndEpoch(uint64_t epoch_nr) {
+    logger->info("Epoch {} latency us p50 {} p99 {} p999 {}, queueing p99 {}, execution p99 {}",
+                 epoch_nr,
+                 cur_epoch.total.CalculatePercentile(0.5),
+                 cur_epoch.total.CalculatePercentile(0.99),
+                 cur_epoch.total.CalculatePercentile(0.999),
+                 cur_epoch.queue.CalculatePercentile(0.99),
+                 cur_epoch.exec.CalculatePercentile(0.99));
+    auto j = ToJson(cur_epoch).object_items();
+    j["epoch"] = static_cast<int>(epoch_nr);
+    epochs.push_back(j);
+    cur_epoch.Clear();
+  }
+
+  // type_name(i) names txn type i.
+  template <typename F>
+  json11::Json ToJson(F type_name) const {
+    Histograms all;
+    json11::Json::object per_type;
+    for (int i = 0; i < kMaxTxnTypes; i++) {
+      if (types[i].total.Count() == 0) continue;
+      per_type[type_name(i)] = ToJson(types[i]);
+      all << types[i];
+    }
+    return json11::Json::object({
+        {"all", ToJson(all)},
+        {"types", per_type},
+        {"epochs", epochs},
+      });
+  }
+
+  // One "count latency" line per non-empty bucket, for scripts/p99-latency.py.
+  void DumpBuckets(std::ostream &out) const {
+    Histogram all;
+    for (int i = 0; i < kMaxTxnTypes; i++)
+      all << types[i].total;
+    for (int i = 0; i < Histogram::kNrBins; i++) {
+      if (all.hist[i] == 0) continue;
+      out << all.hist[i] << " " << Histogram::BinStart(i) << "\n";
+    }
+  }
+};
+
+}
+
+#endif /* LATENCY_STATS_H */
@@ -12,6 +12,8 @@
 #include "log.h"
 #include "epoch.h"
 #include "opts.h"
+#include "txn_log.h"
+#include "ingest.h"
 
 void show_usage(const char *progname)
 {
@@ -67,6 +69,8 @@ int main(int argc, char *argv[])
   NodeConfiguration::g_data_migration = Options::kDataMigration;
   if (Options::kEpochSize)
     EpochClient::g_txn_per_epoch = Options::kEpochSize.ToInt();
+  if (Options::kNrDispatchers)
+    EpochClient::g_nr_dispatchers = Options::kNrDispatchers.ToInt();
 
   Module<CoreModule>::ShowAllModules();
   Module<WorkloadModule>::ShowAllModules();
@@ -94,37 +98,33 @@ int main(int argc, char *argv[])
   // init tables from the workload module
   Module<WorkloadModule>::InitModule(workload_name);
 
-#if 1 
-  // parsing txn from external logs instead of in-mem generation
-  int fd = open(Options::kLogFile.Get().c_str(), O_RDONLY);
-  if (fd == -1) 
-  {
-    logger->info("File not existed\n");
-    exit(1);
+#ifdef DISPATCHER
+  if (Options::kIngestAddress) {
+    // txns come from clients over the network instead of the log
+    auto client = EpochClient::g_workload_client;
+    auto ingest = new IngestService(client->MarshalledTxnSize(), EpochClient::g_nr_dispatchers,
+                                    Options::kIngestEpochTimeout.ToLargeNumber("1000") * 1000);
+    ingest->Listen(Options::kIngestAddress.Get());
+    client->InitializeDispatcher(nullptr, 0, "", ingest);
+    return 0;
   }
+#endif
 
-  struct stat sb;
-  fstat(fd, &sb);
-  void* ret = reinterpret_cast<char*>(mmap(nullptr, sb.st_size, PROT_READ,
-    MAP_PRIVATE | MAP_POPULATE, fd, 0));
-
-  char* content = reinterpret_cast<char*>(ret);
-  uint32_t count = *(reinterpret_cast<uint32_t*>(content));
-  printf("log count is %u\n", count);
-  content += sizeof(uint32_t);
-  char* read_head = content;
-
+#if 1 
+  // parsing txn from external logs instead of in-mem generation
+  TxnLog log(Options::kLogFile.Get());
   auto client = EpochClient::g_workload_client;
+  log.CheckRecordSize(client->MarshalledTxnSize());
+  printf("log count is %lu\n", log.size());
   //logger->info("Generating Benchmarks...");
   //client->GenerateBenchmarks();
-  
 
 #ifdef DISPATCHER
   logger->info("dispatcher streaming fashion\n");
-  client->InitializeDispatcher(read_head, count, Options::kInterArrival.Get());
+  client->InitializeDispatcher(log.record(0), log.size(), Options::kInterArrival.Get());
 #else
   logger->info("Populating txns from logs...");
-  client->PopulateTxnsFromLogs(read_head, count);
+  client->PopulateTxnsFromLogs(log);
 
   console.UpdateServerStatus(Console::ServerStatus::Listening);
   logger->info("Ready. Waiting for run command from the controller.");
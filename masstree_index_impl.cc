@@ -124,6 +124,19 @@ VHandle *MasstreeIndex::Search(const VarStrView &k)
   return result;
 }
 
+// Masstree already prefetches the nodes on its way down, but a lookup can't
+// start before the last one finished. We can at least get the rows into the
+// cache while the next keys are looked up.
+void MasstreeIndex::SearchBatch(const VarStrView *keys, size_t n, VHandle **results)
+{
+  auto ti = GetThreadInfo();
+  for (size_t i = 0; i < n; i++) {
+    VHandle *result = nullptr;
+    get_map()->get(lcdf::Str(keys[i].data(), keys[i].length()), result, *ti);
+    if (result) __builtin_prefetch(result);
+    results[i] = result;
+  }
+}
 
 static thread_local threadinfo *TLSThreadInfo;
 
@@ -139,6 +152,11 @@ void MasstreeIndex::ResetThreadInfo()
   TLSThreadInfo = nullptr;
 }
 
+threadinfo *MasstreeIndex::NewThreadInfo(int id)
+{
+  return threadinfo::make(threadinfo::TI_PROCESS, id);
+}
+
 Table::Iterator *MasstreeIndex::IndexSearchIterator(const VarStrView &start, const VarStrView &end)
 {
   auto it = get_map()->find_iterator<MasstreeMap::ForwardIterator>(
@@ -167,6 +185,24 @@ Table::Iterator *MasstreeIndex::IndexReverseIterator(const VarStrView &start)
   return IndexReverseIterator(start, VarStrView());
 }
 
+struct MasstreeScanner {
+  const Table::ScanFunc &f;
+
+  template <typename StackElement, typename Key>
+  void visit_leaf(const StackElement &, const Key &, threadinfo &) {}
+  bool visit_value(lcdf::Str key, VHandle *row, threadinfo &) {
+    if (row) f(VarStrView(key.length(), (const uint8_t *) key.data()), row);
+    return true;
+  }
+};
+
+// We don't know the key distribution, so the whole tree is one partition.
+void MasstreeIndex::ScanPartition(size_t part, const ScanFunc &f, threadinfo *ti)
+{
+  MasstreeScanner scanner{f};
+  get_map()->scan(lcdf::Str(), true, scanner, *ti);
+}
+
 void MasstreeIndex::ImmediateDelete(const VarStrView &k)
 {
   auto ti = GetThreadInfo();
@@ -31,6 +31,9 @@ class MasstreeIndex final : public Table {
   VHandle *SearchOrCreateImpl(const VarStrView &k, Func f);
  public:
   static void ResetThreadInfo();
+  // For threads outside of the go scheduler. id must be unique among them,
+  // and not a thread pool id.
+  static threadinfo *NewThreadInfo(int id);
 
   MasstreeIndex(std::tuple<bool> conf) noexcept; // no configuration required
 
@@ -40,12 +43,15 @@ class MasstreeIndex final : public Table {
   VHandle *SearchOrCreate(const VarStrView &k, bool *created) override;
   VHandle *SearchOrCreate(const VarStrView &k) override;
   VHandle *Search(const VarStrView &k) override;
+  void SearchBatch(const VarStrView *keys, size_t n, VHandle **results) override;
 
   Table::Iterator *IndexSearchIterator(const VarStrView &start, const VarStrView &end) override;
   Table::Iterator *IndexSearchIterator(const VarStrView &start) override;
   Table::Iterator *IndexReverseIterator(const VarStrView &start, const VarStrView &end) override;
   Table::Iterator *IndexReverseIterator(const VarStrView &start) override;
 
+  void ScanPartition(size_t part, const ScanFunc &f, threadinfo *ti) override;
+
   void ImmediateDelete(const VarStrView &k);
 };
 
@@ -531,6 +531,7 @@ ParallelRegion::ParallelRegion()
   }
 #endif
   memset(proposed_caps, 0, sizeof(size_t) * kMaxPools);
+  for (auto &n: shrunk_bytes) n = 0;
 }
 
 void *ParallelRegion::Alloc(size_t sz)
@@ -604,8 +605,8 @@ void ParallelRegion::PrintUsageEachClass()
       used += pool.get_pool(j)->stats.used;
     }
     auto chk_size = 32UL << i;
-    printf("RegionInfo: class %d size %lu mem %lu/%lu\n", i, chk_size, used,
-           chk_size * pool.capacity());
+    printf("RegionInfo: class %d size %lu mem %lu/%lu shrunk %lu\n", i, chk_size, used,
+           chk_size * pool.capacity(), shrunk_bytes[i].load());
   }
 }
 
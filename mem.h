@@ -1,6 +1,7 @@
 #ifndef MEM_H
 #define MEM_H
 
+#include <atomic>
 #include <cstdlib>
 #include <string>
 #include <mutex>
@@ -361,6 +362,9 @@ class ParallelRegion {
   // static const int kMaxPools = 12;
   ParallelSlabPool pools[32];
   size_t proposed_caps[32];
+  // Bytes given back by shrinking arrays of this class, see
+  // SortedArrayVHandle::ShrinkVersionsNoLock().
+  std::atomic_ulong shrunk_bytes[32];
  public:
   ParallelRegion();
   ParallelRegion(const ParallelRegion &) = delete;
@@ -388,6 +392,11 @@ class ParallelRegion {
   void Free(void *ptr, int alloc_core, size_t sz);
   void Quiescence();
 
+  // sz is the size of the old allocation.
+  void AddShrunkBytes(size_t sz, size_t nr_bytes) {
+    shrunk_bytes[SizeToClass(sz)].fetch_add(nr_bytes, std::memory_order_relaxed);
+  }
+
   void PrintUsageEachClass();
 };
 
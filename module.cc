@@ -16,6 +16,8 @@
 #include "vhandle_sync.h"
 #include "contention_manager.h"
 #include "pwv_graph.h"
+#include "felis_probes.h"
+#include "tracer.h"
 
 #include "util/os.h"
 
@@ -84,6 +86,12 @@ class AllocatorModule : public Module<CoreModule> {
     if (Options::kVHandleLockElision)
       VHandleSyncService::g_lock_elision = true;
 
+    if (Options::kProbes)
+      probes::EnableProbes(Options::kProbes.Get());
+
+    if (Options::kTrace)
+      Tracer::SetEnabled(true);
+
     if (Options::kNrEpoch)
       EpochClient::g_max_epoch = Options::kNrEpoch.ToInt();
 
@@ -108,6 +116,23 @@ class AllocatorModule : public Module<CoreModule> {
       util::InstanceInit<PWVGraphManager>::instance = new PWVGraphManager();
     }
 
+    if (Options::kPipelineEpochs) {
+      abort_if(Options::kEnableGranola || Options::kEnablePWV,
+               "PipelineEpochs cannot be on with Granola or PWV");
+      abort_if(Options::kVHandleBatchAppend || Options::kOnDemandSplitting,
+               "PipelineEpochs cannot be on with VHandleBatchAppend or OnDemandSplitting");
+      abort_if(Options::kCoreScaling, "PipelineEpochs cannot be on with CoreScaling");
+      EpochClient::g_enable_pipeline = true;
+    }
+
+    if (Options::kWorkStealing) {
+      // Stolen pieces run on another core, which partitioned execution
+      // doesn't expect.
+      abort_if(Options::kEnablePartition || Options::kVHandleLockElision,
+               "WorkStealing cannot be on with EnablePartition or VHandleLockElision");
+      EpochExecutionDispatchService::g_enable_work_stealing = true;
+    }
+
     if (Options::kBatchAppendAlloc) {
       ContentionManager::g_prealloc_count = Options::kBatchAppendAlloc.ToLargeNumber();
       abort_if(ContentionManager::g_prealloc_count % 64 != 0, "BatchAppend Memory must align to 64 bytes");
@@ -117,6 +142,12 @@ class AllocatorModule : public Module<CoreModule> {
     GC::g_gc_every_epoch = 600;// /*8 for EpochSize-100k:*/ 2 + Options::kMajorGCThreshold.ToLargeNumber("600K") / EpochClient::g_txn_per_epoch;
     //GC::g_gc_every_epoch = 2 + Options::kMajorGCThreshold.ToLargeNumber("600K") / EpochClient::g_txn_per_epoch;
     GC::g_lazy = Options::kMajorGCLazy;
+    if (Options::kBackgroundGC) {
+      GC::g_background = true;
+      auto threshold = Options::kBackgroundGC.Get();
+      if (!threshold.empty())
+        GC::g_background_threshold = ParseLargeNumber(threshold);
+    }
 
     // logger->info("setting up regions {}", i);
     tasks.emplace_back([]() { mem::GetDataRegion().InitPools(); });
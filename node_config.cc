@@ -110,7 +110,7 @@ void LocalDispatcherImpl::FlushOnCore(int tid, unsigned int start, unsigned int
   auto q = queues[tid];
   auto nr_threads = NodeConfiguration::g_nr_threads;
 #ifdef DISPATCHER
-  nr_threads--;
+  nr_threads -= EpochClient::g_nr_dispatchers;
 #endif
 
   if (!q->need_scan) {
@@ -326,7 +326,7 @@ bool NodeConfiguration::FlushBufferPlan(unsigned long *per_core_cnts)
 
   size_t worker_cnt = g_nr_threads;
 #ifdef DISPATCHER
-  worker_cnt--;
+  worker_cnt -= EpochClient::g_nr_dispatchers;
 #endif
   if (local_batch_completed.fetch_add(1) + 1 < worker_cnt)
     return false;
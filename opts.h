@@ -56,17 +56,31 @@ struct Options {
   static inline const auto kOutputDir = Option("OutputDir");
   static inline const auto kLogFile = Option("LogFile");
   static inline const auto kInterArrival = Option("InterArrival");
+  static inline const auto kNrDispatchers = Option("NrDispatchers");
+  static inline const auto kIngestAddress = Option("IngestAddress"); // unix:<path> or [<host>:]<port>
+  static inline const auto kIngestEpochTimeout = Option("IngestEpochTimeout"); // us, 1000 by default
+  static inline const auto kCommandLog = Option("CommandLog"); // path, replayed on restart
+  static inline const auto kCheckpoint = Option("Checkpoint"); // path of the image to write
+  static inline const auto kCheckpointInterval = Option("CheckpointInterval"); // in epochs, 0 for once
+  static inline const auto kCheckpointThreads = Option("CheckpointThreads");
+  static inline const auto kLoadCheckpoint = Option("LoadCheckpoint"); // path, instead of the loaders
   static inline const auto kDataMigration = Option("DataMigrationMode", false);
   static inline const auto kMaxNodeLimit = Option("MaxNodeLimit");
 
   static inline const auto kNrEpoch = Option("NrEpoch");
+  static inline const auto kPipelineEpochs = Option("PipelineEpochs", false);
   static inline const auto kEpochSize = Option("EpochSize");
+  static inline const auto kEpochLatencySLO = Option("EpochLatencySLO"); // p99 in us
   static inline const auto kMajorGCThreshold = Option("MajorGCThreshold");
   static inline const auto kMajorGCLazy = Option("LazyMajorGC", false);
+  // Free garbage while idle in the Execute phase, once the data region uses
+  // more than this many bytes (0 by default).
+  static inline const auto kBackgroundGC = Option("BackgroundGC");
   static inline const auto kEpochQueueLength = Option("EpochQueueLength");
   static inline const auto kVHandleLockElision = Option("VHandleLockElision", false);
   static inline const auto kVHandleBatchAppend = Option("VHandleBatchAppend", false);
   static inline const auto kEnablePartition = Option("EnablePartition", false);
+  static inline const auto kWorkStealing = Option("WorkStealing", false);
   static inline const auto kBatchAppendAlloc = Option("BatchAppendAlloc");
 
   // In 0.001 of txns per-epoch
@@ -82,6 +96,7 @@ struct Options {
   static inline const auto kTpccHotWarehouseLoad = Option("TpccHotWarehouseLoad");
   static inline const auto kTpccHashShard = Option("TpccHashShard", false);
   static inline const auto kTpccReadOnlyDelayQuery = Option("TpccReadOnlyDelayQuery", false);
+  static inline const auto kTpccReadOnlySnapshot = Option("TpccReadOnlySnapshot", false);
 
   static inline const auto kYcsbContentionKey = Option("YcsbContentionKey");
   static inline const auto kYcsbSkewFactor = Option("YcsbSkewFactor");
@@ -92,6 +107,15 @@ struct Options {
   static inline const auto kEnablePWV = Option("EnablePWV", false);
   static inline const auto kPWVGraphAlloc = Option("PWVGraphAlloc");
 
+  // Probes to switch on at start, comma separated, see felis_probes.h.
+  static inline const auto kProbes = Option("Probes");
+  static inline const auto kProbeLog = Option("ProbeLog");
+  // Per-phase hardware counters of the workers, in the result JSON.
+  static inline const auto kPerfCounters = Option("PerfCounters", false);
+  // Timeline of the workers, see tracer.h.
+  static inline const auto kTrace = Option("Trace", false);
+  static inline const auto kTraceBufferSize = Option("TraceBufferSize"); // events per core
+
   static inline bool ParseExtentedOptions(std::string arg)
   {
     for (auto o: Option::g_options) {
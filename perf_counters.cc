@@ -0,0 +1,140 @@
+#include <cstring>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <x86intrin.h>
+
+#include "perf_counters.h"
+#include "epoch.h"
+#include "log.h"
+
+namespace felis {
+
+static const struct {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+} kCounterConfigs[] = {
+  {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+  {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+  {"llc_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+  {"dtlb_misses", PERF_TYPE_HW_CACHE,
+   PERF_COUNT_HW_CACHE_DTLB
+   | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+   | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+};
+
+static_assert(sizeof(kCounterConfigs) / sizeof(kCounterConfigs[0]) == PerfCounters::kNrCounters);
+
+static const char *kPhaseNames[] = {"insert", "initialize", "execute"};
+
+static int OpenCounter(int idx, int group_fd)
+{
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = kCounterConfigs[idx].type;
+  attr.config = kCounterConfigs[idx].config;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  // User space only, so that the default perf_event_paranoid lets us in.
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+PerfCounters::PerfCounters(int nr_cores)
+    : nr_cores(nr_cores)
+{
+  constexpr int kNrPauses = 1 << 16;
+  auto start = __rdtsc();
+  for (int i = 0; i < kNrPauses; i++) _mm_pause();
+  pause_tsc = double(__rdtsc() - start) / kNrPauses;
+}
+
+PerfCounters::~PerfCounters()
+{
+  for (auto &c: cores) {
+    if (c.group_fd >= 0) close(c.group_fd);
+  }
+}
+
+void PerfCounters::OpenForCurrentThread(int core)
+{
+  auto &c = cores[core];
+  if (c.group_fd >= 0) return;
+
+  c.group_fd = OpenCounter(Cycles, -1);
+  if (c.group_fd < 0) {
+    logger->warn("Cannot open the perf counters on core {}: {}", core, strerror(errno));
+    return;
+  }
+  c.pos[Cycles] = 0;
+  int nr = 1;
+  for (int i = Cycles + 1; i < kNrCounters; i++) {
+    // The group leader owns the fds of its members.
+    c.pos[i] = OpenCounter(i, c.group_fd) >= 0 ? nr++ : -1;
+  }
+  ioctl(c.group_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(c.group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+bool PerfCounters::Read(PerCore &c, Values &out)
+{
+  struct {
+    uint64_t nr;
+    uint64_t time_enabled;
+    uint64_t time_running;
+    uint64_t values[kNrCounters];
+  } buf;
+  if (c.group_fd < 0 || read(c.group_fd, &buf, sizeof(buf)) <= 0)
+    return false;
+
+  // Scale up if the kernel had to multiplex the counters.
+  double scale = 1.0;
+  if (buf.time_running > 0 && buf.time_running < buf.time_enabled)
+    scale = double(buf.time_enabled) / buf.time_running;
+
+  for (int i = 0; i < kNrCounters; i++) {
+    out.v[i] = c.pos[i] < 0 ? 0 : buf.values[c.pos[i]] * scale;
+  }
+  return true;
+}
+
+void PerfCounters::EndPhase(int phase)
+{
+  for (int core = 0; core < nr_cores; core++) {
+    auto &c = cores[core];
+    Values now;
+    if (!Read(c, now)) continue;
+    for (int i = 0; i < kNrCounters; i++) {
+      c.phases[phase].v[i] += now.v[i] - c.last.v[i];
+    }
+    c.last = now;
+  }
+}
+
+json11::Json PerfCounters::ToJson() const
+{
+  json11::Json::object result;
+  for (int p = 0; p < kNrPhases; p++) {
+    json11::Json::array per_core;
+    for (int core = 0; core < nr_cores; core++) {
+      auto &c = cores[core];
+      json11::Json::object values;
+      for (int i = 0; i < kNrCounters; i++) {
+        if (c.pos[i] >= 0) values[kCounterConfigs[i].name] = double(c.phases[p].v[i]);
+      }
+      if (p == EpochPhase::Execute) {
+        values["wait_cnt"] = double(c.wait_cnt);
+        values["spin_tsc"] = c.wait_cnt * pause_tsc;
+      }
+      per_core.push_back(values);
+    }
+    result[kPhaseNames[p]] = per_core;
+  }
+  result["pause_tsc"] = pause_tsc;
+  return result;
+}
+
+}
@@ -0,0 +1,73 @@
+// -*- mode: c++ -*-
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include "node_config.h"
+#include "json11/json11.hpp"
+
+namespace felis {
+
+// Hardware counters of the worker threads (-XPerfCounters), to tell whether a
+// slow phase missed the cache on the version arrays, spun in WaitForData(), or
+// was just busy.
+//
+// Every worker opens a counter group on itself, with perf_event_open(2), the
+// first time it calls txns. When a phase completes, all groups are read and
+// the deltas since the last read are added to that phase. In a pipelined epoch,
+// the Insert and Initialize phases of the next epoch overlap the Execute phase,
+// so their counts go to whichever of them completes first.
+//
+// Spinning is not a counter, but the VHandleSyncService counts the iterations
+// of every core in the Execute phase. Each iteration is about one _mm_pause(),
+// so the wait counts times the cost of a pause, measured at start, estimates
+// the spin time.
+class PerfCounters {
+ public:
+  enum Counter : int {
+    Cycles,
+    Instructions,
+    LLCMisses,
+    DTLBMisses,
+    kNrCounters,
+  };
+  static constexpr int kNrPhases = 3;
+
+ private:
+  struct Values {
+    uint64_t v[kNrCounters] = {};
+  };
+
+  struct PerCore {
+    int group_fd = -1;
+    // Position of each counter in the group, -1 if the CPU does not have it.
+    int pos[kNrCounters];
+    Values last;
+    Values phases[kNrPhases];
+    long wait_cnt = 0;
+    PerCore() { std::fill(pos, pos + kNrCounters, -1); }
+  };
+  std::array<PerCore, NodeConfiguration::kMaxNrThreads> cores;
+  int nr_cores;
+  double pause_tsc;
+
+  bool Read(PerCore &c, Values &out);
+ public:
+  PerfCounters(int nr_cores);
+  ~PerfCounters();
+
+  // On the worker thread itself. Does nothing if already opened.
+  void OpenForCurrentThread(int core);
+  // Phase is an EpochPhase.
+  void EndPhase(int phase);
+  void AddWaitCount(int core, long wait_cnt) { cores[core].wait_cnt += wait_cnt; }
+
+  json11::Json ToJson() const;
+};
+
+}
+
+#endif
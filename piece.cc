@@ -8,6 +8,7 @@
 #include "util/arch.h"
 #include "opts.h"
 #include "mem.h"
+#include "tracer.h"
 
 using util::Instance;
 using util::Impl;
@@ -184,6 +185,7 @@ void BasePieceCollection::ExecutionRoutine::Run()
 
   int core_id = scheduler()->thread_pool_id() - 1;
   trace(TRACE_EXEC_ROUTINE "new ExecutionRoutine up and running on {}", core_id);
+  Tracer::Record(core_id, Tracer::RoutineStart, (uintptr_t) this);
 
   PieceRoutine *next_r;
   bool give_up = false;
@@ -225,12 +227,15 @@ void BasePieceCollection::ExecutionRoutine::Run()
       if (rt->sched_key != 0)
         debug(TRACE_EXEC_ROUTINE "Run {} sid {}", (void *) rt, rt->sched_key);
 
+      Tracer::Record(core_id, Tracer::PieceBegin, rt->sched_key);
       rt->callback(rt);
+      Tracer::Record(core_id, Tracer::PieceEnd, rt->sched_key);
       svc.Complete(core_id);
     }
   } while (!give_up && svc.IsReady(core_id) && transport.PeriodicIO(core_id));
 
   trace(TRACE_EXEC_ROUTINE "Coroutine Exit on core {} give up {}", core_id, give_up);
+  Tracer::Record(core_id, Tracer::RoutineExit, (uintptr_t) this);
 }
 
 bool BasePieceCollection::ExecutionRoutine::Preempt()
@@ -245,7 +250,9 @@ bool BasePieceCollection::ExecutionRoutine::Preempt()
       sched->WakeUp(new ExecutionRoutine());
     }
     trace(TRACE_EXEC_ROUTINE "Sleep. Spawning a new coroutine = {}.", spawn);
+    Tracer::Record(core_id, Tracer::Suspend, (uintptr_t) this);
     sched->RunNext(go::Scheduler::SleepState);
+    Tracer::Record(core_id, Tracer::Resume, (uintptr_t) this);
 
     spawn = true;
     auto should_pop = PromiseRoutineDispatchService::GenericDispatchPeekListener(
@@ -286,7 +293,7 @@ void BasePieceCollection::FlushScheduler()
   auto &svc = util::Impl<PromiseRoutineDispatchService>();
   size_t worker_cnt = g_nr_threads;
 #ifdef DISPATCHER
-  worker_cnt--;
+  worker_cnt -= EpochClient::g_nr_dispatchers;
 #endif
   for (int i = 0; i < worker_cnt; i++) {
     if (!svc.IsRunning(i)) {
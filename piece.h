@@ -137,6 +137,8 @@ class PromiseRoutineDispatchService {
 
   // For debugging
   virtual int TraceDependency(uint64_t) { return -1; }
+  virtual long GetStealCountStat(int core_id) { return 0; }
+  virtual void ClearStealCountStats() {}
 };
 
 class PromiseAllocationService {
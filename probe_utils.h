@@ -2,6 +2,7 @@
 #ifndef PROBE_UTILS_H
 #define PROBE_UTILS_H
 
+#include <cstdint>
 #include <cstring>
 #include <cmath>
 #include <mutex>
@@ -13,7 +14,7 @@
 
 template <typename T> void OnProbe(T t);
 
-#define PROBE_PROXY(klass) void klass::operator()() const { OnProbe(*this); }
+#define PROBE_PROXY(klass) void klass::Fire() const { OnProbe(*this); }
 
 namespace agg {
 
@@ -185,6 +186,58 @@ struct LogHistogram {
   }
 };
 
+// HDR style LogHistogram: every power of 2 is split into 2^SubBits linear
+// sub-buckets, so the relative error stays below 2^-SubBits over the whole
+// uint32_t range. Values below 2^SubBits are exact. Fixed size and mergeable,
+// so it can stand in for a vector of all the samples.
+template <int SubBits = 4>
+struct HdrLogHistogram {
+  static constexpr int kNrSubBuckets = 1 << SubBits;
+  static constexpr int kNrBins = (32 - SubBits + 1) * kNrSubBuckets;
+  long hist[kNrBins];
+  HdrLogHistogram() {
+    Clear();
+  }
+  void Clear() {
+    memset(hist, 0, sizeof(long) * kNrBins);
+  }
+  static int Bin(unsigned long value) {
+    if (value < kNrSubBuckets) return value;
+    if (value > std::numeric_limits<uint32_t>::max()) value = std::numeric_limits<uint32_t>::max();
+    int shift = 63 - __builtin_clzl(value) - SubBits;
+    return (shift + 1) * kNrSubBuckets + (value >> shift) - kNrSubBuckets;
+  }
+  // Smallest value that falls into bin idx.
+  static long BinStart(int idx) {
+    if (idx < kNrSubBuckets) return idx;
+    int shift = idx / kNrSubBuckets - 1;
+    return long(kNrSubBuckets + idx % kNrSubBuckets) << shift;
+  }
+  HdrLogHistogram &operator<<(long value) {
+    if (value >= 0) hist[Bin(value)]++;
+    return *this;
+  }
+  HdrLogHistogram &operator<<(const HdrLogHistogram &rhs) {
+    for (int i = 0; i < kNrBins; i++) hist[i] += rhs.hist[i];
+    return *this;
+  }
+  long CalculatePercentile(double scale) const {
+    long idx = Count() * scale;
+    for (int i = 0; i < kNrBins; i++) {
+      idx -= hist[i];
+      if (idx < 0)
+        return BinStart(i);
+    }
+    return 0;
+  }
+  size_t Count() const {
+    size_t total_nr = 0;
+    for (int i = 0; i < kNrBins; i++)
+      total_nr += hist[i];
+    return total_nr;
+  }
+};
+
 template <int N = 10, int Offset, int Base = 2>
 std::ostream &operator<<(std::ostream &out, const LogHistogram<N, Offset, Base> &h)
 {
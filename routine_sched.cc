@@ -3,6 +3,7 @@
 #include "epoch.h"
 #include "routine_sched.h"
 #include "pwv_graph.h"
+#include "gc.h"
 
 namespace felis {
 
@@ -90,7 +91,7 @@ class PWVScheduler final : public PrioritySchedulingPolicy {
   };
 
   bool ShouldRetryBeforePick(std::atomic_ulong *zq_start, std::atomic_ulong *zq_end,
-                             std::atomic_uint *pq_start, std::atomic_uint *pq_end) override;
+                             std::atomic_ulong *pq_start, std::atomic_ulong *pq_end) override;
   bool ShouldPickWaiting(const WaitState &ws) override;
   PriorityQueueValue *Pick() override;
   void Consume(PriorityQueueValue *value) override;
@@ -208,7 +209,7 @@ void PWVScheduler::IngestPending(PriorityQueueHashEntry *hent, PriorityQueueValu
 }
 
 bool PWVScheduler::ShouldRetryBeforePick(std::atomic_ulong *zq_start, std::atomic_ulong *zq_end,
-                                         std::atomic_uint *pq_start, std::atomic_uint *pq_end)
+                                         std::atomic_ulong *pq_start, std::atomic_ulong *pq_end)
 {
   while (CallTxnsWorker::g_finished < NodeConfiguration::g_nr_threads) {
     if (zq_start->load(std::memory_order_acquire) < zq_end->load(std::memory_order_acquire))
@@ -305,13 +306,14 @@ void PWVScheduler::Reset()
 }
 
 size_t EpochExecutionDispatchService::g_max_item = 20_M;
+bool EpochExecutionDispatchService::g_enable_work_stealing = false;
 const size_t EpochExecutionDispatchService::kHashTableSize = 100001;
 
 EpochExecutionDispatchService::EpochExecutionDispatchService()
 {
   size_t worker_cnt = NodeConfiguration::g_nr_threads;
 #ifdef DISPATCHER
-  worker_cnt--;
+  worker_cnt -= EpochClient::g_nr_dispatchers;
 #endif
   auto max_item_percore = g_max_item / worker_cnt;
   logger->info("{} per_core pool capacity {}, element size {}",
@@ -330,12 +332,12 @@ EpochExecutionDispatchService::EpochExecutionDispatchService()
     }
     queue = qmem + offset_in_node;
 
-    queue->zq.end = queue->zq.start = 0;
-    queue->zq.q = (PieceRoutine **)
-                 mem::AllocMemory(
-                     mem::EpochQueuePromise,
-                     max_item_percore * sizeof(PieceRoutine *),
-                     numa_node);
+    queue->zq.Initialize(
+        mem::AllocMemory(
+            mem::EpochQueuePromise,
+            ZeroQueue::MemorySize(max_item_percore),
+            numa_node),
+        max_item_percore);
     if (EpochClient::g_enable_pwv) {
       queue->pq.sched_pol = PWVScheduler::New(max_item_percore, numa_node);
     } else {
@@ -346,13 +348,12 @@ EpochExecutionDispatchService::EpochExecutionDispatchService()
                       mem::EpochQueueItem,
                       kHashTableSize * sizeof(PriorityQueueHashHeader),
                       numa_node);
-    queue->pq.pending.q = (PieceRoutine **)
-                         mem::AllocMemory(
-                             mem::EpochQueuePromise,
-                             max_item_percore * sizeof(PieceRoutine *),
-                             numa_node);
-    queue->pq.pending.start = 0;
-    queue->pq.pending.end = 0;
+    queue->pq.pending.Initialize(
+        mem::AllocMemory(
+            mem::EpochQueuePromise,
+            decltype(queue->pq.pending)::MemorySize(max_item_percore),
+            numa_node),
+        max_item_percore);
 
     queue->pq.waiting.off = queue->pq.waiting.len = 0;
 
@@ -366,7 +367,6 @@ EpochExecutionDispatchService::EpochExecutionDispatchService()
         brk_sz);
 
     new (&queue->state) State();
-    new (&queue->lock) util::SpinLock();
   }
   tot_bubbles = 0;
 }
@@ -375,13 +375,15 @@ void EpochExecutionDispatchService::Reset()
 {
   size_t worker_cnt = NodeConfiguration::g_nr_threads;
 #ifdef DISPATCHER
-  worker_cnt--;
+  worker_cnt -= EpochClient::g_nr_dispatchers;
 #endif
   for (int i = 0; i < worker_cnt; i++) {
     auto &q = queues[i];
     while (q->state.running == State::kDeciding) _mm_pause();
-    q->zq.end.store(0);
-    q->zq.start.store(0);
+    // Whatever is left was stolen, the owner just hasn't skipped over it.
+    for (auto pos = q->zq.start.load(); pos < q->zq.end.load(); pos++)
+      q->zq.Consume(pos);
+    q->zq.Reset();
 
     q->state.ts = 0;
     q->state.current_sched_key = 0;
@@ -393,48 +395,12 @@ void EpochExecutionDispatchService::Reset()
 }
 
 
+// Lock-free. We reserve the slots of the whole batch with one fetch_add per
+// queue, so concurrent producers never wait for each other.
 void EpochExecutionDispatchService::Add(int core_id, PieceRoutine **routines,
                                         size_t nr_routines)
 {
-  auto &lock = queues[core_id]->lock;
-  lock.Lock();
-
-  auto &zq = queues[core_id]->zq;
-  auto &pq = queues[core_id]->pq.pending;
-  size_t i = 0;
-
-  auto max_item_percore = g_max_item / NodeConfiguration::g_nr_threads;
-
-again:
-  size_t zdelta = 0,
-           zend = zq.end.load(std::memory_order_acquire),
-         zlimit = max_item_percore;
-
-  size_t pdelta = 0,
-           pend = pq.end.load(std::memory_order_acquire),
-         plimit = max_item_percore
-                  - (pend - pq.start.load(std::memory_order_acquire));
-
-  for (; i < nr_routines; i++) {
-    auto r = routines[i];
-    auto key = r->sched_key;
-
-    if (key == 0) {
-      auto pos = zend + zdelta++;
-      abort_if(pos >= zlimit,
-               "Preallocation of DispatchService is too small. {} < {}", pos, zlimit);
-      zq.q[pos] = r;
-    } else {
-      if (pdelta >= plimit) goto again;
-      auto pos = pend + pdelta++;
-      pq.q[pos % max_item_percore] = r;
-    }
-  }
-  if (zdelta)
-    zq.end.fetch_add(zdelta, std::memory_order_release);
-  if (pdelta)
-    pq.end.fetch_add(pdelta, std::memory_order_release);
-  lock.Unlock();
+  Enqueue(queues[core_id]->zq, queues[core_id]->pq.pending, routines, nr_routines);
   // util::Impl<VHandleSyncService>().Notify(1 << core_id);
 }
 
@@ -472,16 +438,20 @@ found:
 void
 EpochExecutionDispatchService::ProcessPending(PriorityQueue &q)
 {
-  size_t pstart = q.pending.start.load(std::memory_order_acquire);
-  long plen = q.pending.end.load(std::memory_order_acquire) - pstart;
-
-  for (size_t i = 0; i < plen; i++) {
-    auto pos = pstart + i;
-    AddToPriorityQueue(q, q.pending.q[pos % (g_max_item / NodeConfiguration::g_nr_threads)]);
-    // AddToPriorityQueue(q, q.pending.q[pos]);
+  size_t pstart = q.pending.start.load(std::memory_order_relaxed);
+  size_t pend = q.pending.end.load(std::memory_order_acquire);
+
+  // Stop at the first slot that isn't published. Its producer might be waiting
+  // for us to make space.
+  auto pos = pstart;
+  for (; pos < pend; pos++) {
+    auto r = q.pending.Load(pos);
+    if (r == nullptr) break;
+    q.pending.Consume(pos);
+    AddToPriorityQueue(q, r);
   }
-  if (plen) {
-    q.pending.start.fetch_add(plen);
+  if (pos > pstart) {
+    q.pending.Advance(pos);
   }
 }
 
@@ -490,7 +460,6 @@ EpochExecutionDispatchService::Peek(int core_id, DispatchPeekListener &should_po
 {
   auto &zq = queues[core_id]->zq;
   auto &q = queues[core_id]->pq;
-  auto &lock = queues[core_id]->lock;
   auto &state = queues[core_id]->state;
   uint64_t zstart = 0;
 
@@ -502,15 +471,28 @@ EpochExecutionDispatchService::Peek(int core_id, DispatchPeekListener &should_po
   }
 
 retry:
-  zstart = zq.start.load(std::memory_order_acquire);
+  zstart = zq.start.load(std::memory_order_relaxed);
   if (zstart < zq.end.load(std::memory_order_acquire)) {
     state.running = State::kRunning;
-    auto r = zq.q[zstart];
+    auto &slot = zq.slot(zstart);
+    auto r = zq.WaitForSlot(zstart);
+    if (g_enable_work_stealing) {
+      // Claim the head before looking at it, a thief might be taking it at the
+      // same time. If a thief got it, it's gone for good, see Steal().
+      if (r == StolenMark() || !slot.compare_exchange_strong(r, StolenMark())) {
+        zq.Consume(zstart);
+        zq.Advance(zstart + 1);
+        goto retry;
+      }
+    }
     if (should_pop(r, nullptr)) {
-      zq.start.store(zstart + 1, std::memory_order_relaxed);
+      zq.Consume(zstart);
+      zq.Advance(zstart + 1);
       state.current_sched_key = r->sched_key;
       return true;
     }
+    if (g_enable_work_stealing)
+      slot.store(r, std::memory_order_release);
     return false;
   }
 
@@ -555,6 +537,12 @@ retry:
     }
     return false;
   }
+  if (g_enable_work_stealing && Steal(core_id, should_pop)) {
+    state.running = State::kRunning;
+    state.current_sched_key = 0;
+    return true;
+  }
+
   /*
   logger->info("pending start {} end {}, zstart {} zend {}, running {}, completed {}",
                q.pending.start.load(), q.pending.end.load(),
@@ -577,9 +565,60 @@ retry:
           core_id, n, nr_bubbles);
     comp->Complete(n + nr_bubbles);
   }
+
+  if (GC::g_background)
+    util::Instance<GC>().RunBackgroundGC(core_id);
   return false;
 }
 
+// We have nothing to run. Take one routine from the end of someone else's zero
+// queue. Ordered routines (sched_key != 0) always stay on their core.
+//
+// Both the owner and thieves claim a slot by swapping in StolenMark(), so each
+// routine goes to exactly one of them. We leave the head to the owner and only
+// look at the last few slots, where the owner is unlikely to be. The owner
+// skips over the marks.
+bool EpochExecutionDispatchService::Steal(int core_id, DispatchPeekListener &should_pop)
+{
+  size_t worker_cnt = NodeConfiguration::g_nr_threads;
+#ifdef DISPATCHER
+  worker_cnt -= EpochClient::g_nr_dispatchers;
+#endif
+  for (int i = 1; i < worker_cnt; i++) {
+    auto &zq = queues[(core_id + i) % worker_cnt]->zq;
+    auto start = zq.start.load(std::memory_order_acquire);
+    auto end = zq.end.load(std::memory_order_acquire);
+
+    for (auto pos = end; pos > start + 1 && end - pos < kStealScanLength; ) {
+      pos--;
+      auto r = zq.Load(pos);
+      if (r == nullptr || r == StolenMark()
+          || !zq.slot(pos).compare_exchange_strong(r, StolenMark()))
+        continue;
+
+      if (should_pop(r, nullptr)) {
+        queues[core_id]->state.nr_steals++;
+        return true;
+      }
+      // We cannot put it back, the owner may have skipped over our mark
+      // already. Queue it on our own core instead.
+      Add(core_id, &r, 1);
+      return false;
+    }
+  }
+  return false;
+}
+
+void EpochExecutionDispatchService::ClearStealCountStats()
+{
+  size_t worker_cnt = NodeConfiguration::g_nr_threads;
+#ifdef DISPATCHER
+  worker_cnt -= EpochClient::g_nr_dispatchers;
+#endif
+  for (int i = 0; i < worker_cnt; i++)
+    queues[i]->state.nr_steals = 0;
+}
+
 void EpochExecutionDispatchService::AddBubble()
 {
   tot_bubbles.fetch_add(1);
@@ -587,7 +626,6 @@ void EpochExecutionDispatchService::AddBubble()
 
 bool EpochExecutionDispatchService::Preempt(int core_id, BasePieceCollection::ExecutionRoutine *routine_state)
 {
-  auto &lock = queues[core_id]->lock;
   bool can_preempt = true;
   auto &zq = queues[core_id]->zq;
   auto &q = queues[core_id]->pq;
@@ -624,20 +662,14 @@ void EpochExecutionDispatchService::Complete(int core_id)
 int EpochExecutionDispatchService::TraceDependency(uint64_t key)
 {
   for (int core_id = 0; core_id < NodeConfiguration::g_nr_threads; core_id++) {
-    auto max_item_percore = g_max_item / NodeConfiguration::g_nr_threads;
     auto &q = queues[core_id]->pq.pending;
-    if (q.end.load() > max_item_percore) puts("pending queue wraps around");
     abort_if(q.end.load() < q.start.load(), "WTF? pending queue underflows");
     for (auto i = q.start.load(); i < q.end.load(); i++) {
-      if (q.q[i % max_item_percore]->sched_key == key) {
+      auto r = q.Load(i);
+      if (r && r->sched_key == key) {
         printf("found %lu in the pending area of %d\n", key, core_id);
       }
     }
-    for (auto i = 0; i < q.start.load(); i++) {
-      if (q.q[i % max_item_percore]->sched_key == key) {
-        printf("found %lu in the consumed pending area of %d\n", key, core_id);
-      }
-    }
 
     auto &hl = queues[core_id]->pq.ht[Hash(key) % kHashTableSize];
     auto ent = hl.next;
@@ -4,6 +4,7 @@
 #include "piece.h"
 #include "util/objects.h"
 #include "util/linklist.h"
+#include "util/mpsc.h"
 #include "node_config.h"
 
 namespace felis {
@@ -41,7 +42,7 @@ class PrioritySchedulingPolicy {
   // Before we try to schedule from this scheduling policy, should we double
   // check the zero queue?
   virtual bool ShouldRetryBeforePick(std::atomic_ulong *zq_start, std::atomic_ulong *zq_end,
-                                     std::atomic_uint *pq_start, std::atomic_uint *pq_end) {
+                                     std::atomic_ulong *pq_start, std::atomic_ulong *pq_end) {
     return false;
   }
   // Would you pick this key according to the current situation?
@@ -78,11 +79,7 @@ class EpochExecutionDispatchService : public PromiseRoutineDispatchService {
   struct PriorityQueue {
     PrioritySchedulingPolicy *sched_pol;
     PriorityQueueHashHeader *ht; // Hashtable. First item is a sentinel
-    struct {
-      PieceRoutine **q;
-      std::atomic_uint start;
-      std::atomic_uint end;
-    } pending; // Pending inserts into the heap and the hashtable
+    util::MPSCRing<PieceRoutine> pending; // Pending inserts into the heap and the hashtable
 
     struct {
       // Ring-buffer.
@@ -94,11 +91,10 @@ class EpochExecutionDispatchService : public PromiseRoutineDispatchService {
     mem::Brk brk; // memory allocator for hashtables entries and queue values
   };
 
-  struct ZeroQueue {
-    PieceRoutine **q;
-    std::atomic_ulong end;
-    std::atomic_ulong start;
-  };
+  // Routines with sched_key 0 have no ordering constraints. With work stealing
+  // on, other cores may take them from the end, see Steal(). The ring never
+  // wraps within an epoch.
+  using ZeroQueue = util::MPSCRing<PieceRoutine>;
 
   struct State {
     uint64_t current_sched_key;
@@ -110,20 +106,24 @@ class EpochExecutionDispatchService : public PromiseRoutineDispatchService {
     static constexpr int kDeciding = -1;
     std::atomic_int running;
 
-    State() : current_sched_key(0), ts(0), running(kSleeping) {}
+    unsigned long nr_steals; // routines this core took from others
+
+    State() : current_sched_key(0), ts(0), running(kSleeping), nr_steals(0) {}
   };
 
   struct Queue {
     PriorityQueue pq;
     ZeroQueue zq;
-    util::SpinLock lock;
     State state;
   };
  public:
   static size_t g_max_item;
+  static bool g_enable_work_stealing;
  private:
 
   static const size_t kHashTableSize;
+  // Number of slots at the end of a zero queue a thief looks at.
+  static constexpr int kStealScanLength = 8;
   static constexpr size_t kMaxNrThreads = NodeConfiguration::kMaxNrThreads;
 
   std::array<Queue *, kMaxNrThreads> queues;
@@ -133,8 +133,42 @@ class EpochExecutionDispatchService : public PromiseRoutineDispatchService {
   void AddToPriorityQueue(PriorityQueue &q, PieceRoutine *&r,
                           BasePieceCollection::ExecutionRoutine *state = nullptr);
   void ProcessPending(PriorityQueue &q);
+  // Marks a zero queue slot taken by a thief.
+  static PieceRoutine *StolenMark() { return (PieceRoutine *) 1; }
+  bool Steal(int core_id, DispatchPeekListener &should_pop);
 
  public:
+  // Splits routines between the zero queue and the pending ring of a core, in
+  // order. The zero queue entries are published before we might wait for space
+  // in the pending ring, because the owner core spins on the head of the zero
+  // queue (WaitForSlot()) before it drains the pending ring.
+  template <typename T>
+  static void Enqueue(util::MPSCRing<T> &zq, util::MPSCRing<T> &pq, T **routines, size_t nr_routines) {
+    size_t nr_zero = 0;
+    for (size_t i = 0; i < nr_routines; i++) {
+      if (routines[i]->sched_key == 0) nr_zero++;
+    }
+    size_t nr_pending = nr_routines - nr_zero;
+
+    if (nr_zero) {
+      auto zpos = zq.Reserve(nr_zero);
+      abort_if(zpos + nr_zero > zq.max_size(),
+               "Preallocation of DispatchService is too small. {} < {}",
+               zpos + nr_zero, zq.max_size());
+      for (size_t i = 0; i < nr_routines; i++) {
+        if (routines[i]->sched_key == 0) zq.Publish(zpos++, routines[i]);
+      }
+    }
+    if (nr_pending) {
+      auto ppos = pq.Reserve(nr_pending);
+      // The pending queue is a ring. Wait for the owner core to drain it.
+      pq.WaitForSpace(ppos, nr_pending);
+      for (size_t i = 0; i < nr_routines; i++) {
+        if (routines[i]->sched_key != 0) pq.Publish(ppos++, routines[i]);
+      }
+    }
+  }
+
   void Add(int core_id, PieceRoutine **routines, size_t nr_routines) final override;
   void AddBubble() final override;
   bool Peek(int core_id, DispatchPeekListener &should_pop) final override;
@@ -150,6 +184,8 @@ class EpochExecutionDispatchService : public PromiseRoutineDispatchService {
     return running == State::kRunning;
   }
   bool IsReady(int core_id) final override;
+  long GetStealCountStat(int core_id) final override { return queues[core_id]->state.nr_steals; }
+  void ClearStealCountStats() final override;
 };
 
 }
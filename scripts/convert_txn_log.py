@@ -0,0 +1,40 @@
+# Convert a legacy txn log (uint32 count + records) into the version 1 format
+# described in txn_log.h.
+#
+# usage: convert_txn_log.py <legacy log> <output> <record size> [epoch size]
+
+import struct
+import sys
+
+MAGIC = 0x4C585446
+VERSION = 1
+HEADER = struct.Struct('<IIIIQQ')
+ALIGN = 64
+
+def convert(src, dst, record_size, epoch_size):
+    with open(src, 'rb') as f:
+        count, = struct.unpack('<I', f.read(4))
+        records = f.read(count * record_size)
+    if len(records) != count * record_size:
+        sys.exit('%s is shorter than %d records of %d bytes' % (src, count, record_size))
+
+    epoch_start = []
+    if epoch_size > 0:
+        epoch_start = list(range(0, count, epoch_size)) + [count]
+    nr_epochs = max(len(epoch_start) - 1, 0)
+
+    table = struct.pack('<%dQ' % len(epoch_start), *epoch_start)
+    records_offset = HEADER.size + len(table)
+    records_offset = (records_offset + ALIGN - 1) // ALIGN * ALIGN
+
+    with open(dst, 'wb') as f:
+        f.write(HEADER.pack(MAGIC, VERSION, record_size, nr_epochs, count, records_offset))
+        f.write(table)
+        f.write(b'\0' * (records_offset - HEADER.size - len(table)))
+        f.write(records)
+
+if __name__ == "__main__":
+    if len(sys.argv) < 4:
+        sys.exit('usage: %s <legacy log> <output> <record size> [epoch size]' % sys.argv[0])
+    convert(sys.argv[1], sys.argv[2], int(sys.argv[3]),
+            int(sys.argv[4]) if len(sys.argv) > 4 else 0)
@@ -29,10 +29,8 @@ for subdir in $(ls -v); do # ne$(nrEpoch)
       if [[ -f "$file" ]]; then
         # latency
         if [[ "$file" == *latency* ]]; then
-          cat "$file" | sort -n | uniq -c > "res"
-          sed -i "1d" "res"
-          python $processLatency "res" >> $log_path
-          rm "res"
+          # already "count latency" histogram buckets
+          python $processLatency "$file" >> $log_path
           echo "Processed $file"
         fi
         # throughput
@@ -0,0 +1,69 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include "routine_sched.h"
+
+using felis::EpochExecutionDispatchService;
+
+struct FakeRoutine {
+  uint64_t sched_key;
+};
+
+using Ring = util::MPSCRing<FakeRoutine>;
+
+// Fill the pending ring, then add a batch with both kinds of routines while
+// the owner still has zero queue routines to run. The owner takes the head of
+// the zero queue first, like Peek() does, and only then drains the pending
+// ring, so the zero queue routines of the batch must not wait for it.
+TEST(DispatchQueueTest, FullPendingRingWithZeroQueue) {
+  constexpr size_t kCap = 8;
+  std::vector<std::atomic<FakeRoutine *>> zslots(64), pslots(kCap);
+  Ring zq, pq;
+  zq.Initialize(zslots.data(), zslots.size());
+  pq.Initialize(pslots.data(), kCap);
+
+  std::vector<FakeRoutine> routines(kCap + 4);
+  std::vector<FakeRoutine *> full, batch;
+  for (size_t i = 0; i < kCap; i++) {
+    routines[i].sched_key = i + 1;
+    full.push_back(&routines[i]);
+  }
+  EpochExecutionDispatchService::Enqueue(zq, pq, full.data(), full.size());
+
+  routines[kCap].sched_key = 0;
+  routines[kCap + 1].sched_key = 100;
+  routines[kCap + 2].sched_key = 0;
+  routines[kCap + 3].sched_key = 101;
+  for (size_t i = kCap; i < kCap + 4; i++) batch.push_back(&routines[i]);
+
+  std::thread producer([&]() {
+    EpochExecutionDispatchService::Enqueue(zq, pq, batch.data(), batch.size());
+  });
+
+  std::vector<uint64_t> zero_seen, pending_seen;
+  while (zero_seen.size() < 2 || pending_seen.size() < kCap + 2) {
+    auto zstart = zq.start.load();
+    if (zstart < zq.end.load()) {
+      zero_seen.push_back(zq.WaitForSlot(zstart)->sched_key);
+      zq.Consume(zstart);
+      zq.Advance(zstart + 1);
+      continue;
+    }
+    auto pstart = pq.start.load();
+    if (pstart < pq.end.load()) {
+      auto r = pq.Load(pstart);
+      if (r == nullptr) continue;
+      pending_seen.push_back(r->sched_key);
+      pq.Consume(pstart);
+      pq.Advance(pstart + 1);
+    }
+  }
+  producer.join();
+
+  ASSERT_EQ(zero_seen, std::vector<uint64_t>({0, 0}));
+  std::vector<uint64_t> expect;
+  for (size_t i = 0; i < kCap; i++) expect.push_back(i + 1);
+  expect.push_back(100);
+  expect.push_back(101);
+  ASSERT_EQ(pending_seen, expect);
+}
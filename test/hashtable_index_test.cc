@@ -0,0 +1,205 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "hashtable_index_impl.h"
+#include "worker_fixture.h"
+
+namespace felis {
+
+namespace {
+
+class HashtableIndexTest : public WorkerTest {};
+
+// Big endian, so keys sort like (prefix, id).
+static std::string Key(uint32_t prefix, uint32_t id)
+{
+  uint8_t buf[8];
+  for (int i = 0; i < 4; i++) {
+    buf[i] = prefix >> (24 - 8 * i);
+    buf[4 + i] = id >> (24 - 8 * i);
+  }
+  return std::string((const char *) buf, 8);
+}
+
+static VarStrView View(const std::string &s)
+{
+  return VarStrView(s.length(), (const uint8_t *) s.data());
+}
+
+// Every row lands in the same bucket, with the same tag.
+static uint32_t CollidingHash(const VarStrView &k)
+{
+  return 0x2A;
+}
+
+TEST_F(HashtableIndexTest, InsertAndSearchAcrossResize) {
+  RunOnWorker([]() {
+    HashtableIndex table(std::make_tuple(DefaultHash, 16, false));
+    constexpr uint32_t kNrRows = 50000;
+    std::vector<VHandle *> rows;
+    for (uint32_t i = 0; i < kNrRows; i++) {
+      bool created = false;
+      rows.push_back(table.SearchOrCreate(View(Key(0, i)), &created));
+      ASSERT_TRUE(created);
+      ASSERT_NE(rows.back(), nullptr);
+    }
+    ASSERT_GT(table.current_nr_buckets(), 16);
+
+    // Rows never move while the table grows.
+    for (uint32_t i = 0; i < kNrRows; i++) {
+      ASSERT_EQ(table.Search(View(Key(0, i))), rows[i]);
+      bool created = true;
+      ASSERT_EQ(table.SearchOrCreate(View(Key(0, i)), &created), rows[i]);
+      ASSERT_FALSE(created);
+    }
+    for (uint32_t i = kNrRows; i < kNrRows + 1000; i++) {
+      ASSERT_EQ(table.Search(View(Key(0, i))), nullptr);
+    }
+  });
+}
+
+TEST_F(HashtableIndexTest, Delete) {
+  RunOnWorker([]() {
+    HashtableIndex table(std::make_tuple(DefaultHash, 64, false));
+    constexpr uint32_t kNrRows = 4096;
+    std::vector<VHandle *> rows;
+    for (uint32_t i = 0; i < kNrRows; i++) {
+      rows.push_back(table.SearchOrCreate(View(Key(0, i))));
+    }
+
+    for (uint32_t i = 0; i < kNrRows; i += 2) {
+      ASSERT_TRUE(table.Delete(View(Key(0, i))));
+      ASSERT_FALSE(table.Delete(View(Key(0, i))));
+    }
+    // By the row, at the next Insert phase, like TPC-C Delivery does.
+    table.QueueDelete(rows[1]);
+    ASSERT_EQ(table.Search(View(Key(0, 1))), rows[1]);
+    table.ApplyQueuedDeletes();
+
+    for (uint32_t i = 0; i < kNrRows; i++) {
+      auto row = table.Search(View(Key(0, i)));
+      if (i % 2 == 0 || i == 1) {
+        ASSERT_EQ(row, nullptr);
+      } else {
+        ASSERT_EQ(row, rows[i]);
+      }
+    }
+
+    // A deleted key can be inserted again, as a new row.
+    bool created = false;
+    auto row = table.SearchOrCreate(View(Key(0, 0)), &created);
+    ASSERT_TRUE(created);
+    ASSERT_EQ(table.Search(View(Key(0, 0))), row);
+  });
+}
+
+TEST_F(HashtableIndexTest, TagSlotOverflow) {
+  RunOnWorker([]() {
+    HashtableIndex table(std::make_tuple(CollidingHash, 16, false));
+    constexpr uint32_t kNrRows = 4 * HashBucket::kNrSlots;
+    std::vector<VHandle *> rows;
+    for (uint32_t i = 0; i < kNrRows; i++) {
+      rows.push_back(table.SearchOrCreate(View(Key(0, i))));
+    }
+
+    // Only the first rows are in the slots, the rest have to be found in the
+    // list.
+    for (uint32_t i = 0; i < kNrRows; i++) {
+      ASSERT_EQ(table.Search(View(Key(0, i))), rows[i]);
+    }
+    ASSERT_EQ(table.Search(View(Key(0, kNrRows))), nullptr);
+
+    // Deletes free the slots, and the rows left are still found.
+    for (uint32_t i = 0; i < HashBucket::kNrSlots; i++) {
+      ASSERT_TRUE(table.Delete(View(Key(0, i))));
+    }
+    for (uint32_t i = 0; i < kNrRows; i++) {
+      auto row = table.Search(View(Key(0, i)));
+      ASSERT_EQ(row, i < HashBucket::kNrSlots ? nullptr : rows[i]);
+    }
+  });
+}
+
+TEST_F(HashtableIndexTest, SearchBatch) {
+  RunOnWorker([]() {
+    HashtableIndex table(std::make_tuple(DefaultHash, 16, false));
+    constexpr uint32_t kNrRows = 50000;
+    std::vector<VHandle *> rows;
+    for (uint32_t i = 0; i < kNrRows; i++) {
+      rows.push_back(table.SearchOrCreate(View(Key(0, i))));
+    }
+
+    // Hits from all over the grown table, and a miss at the end.
+    std::vector<std::string> keys;
+    for (uint32_t i = 0; i < 100; i++) keys.push_back(Key(0, i * 499));
+    keys.push_back(Key(1, 0));
+    std::vector<VarStrView> views;
+    for (auto &k: keys) views.push_back(View(k));
+    std::vector<VHandle *> results(views.size());
+    table.SearchBatch(views.data(), views.size(), results.data());
+    for (size_t i = 0; i < 100; i++) {
+      ASSERT_EQ(results[i], rows[i * 499]);
+    }
+    ASSERT_EQ(results[100], nullptr);
+  });
+}
+
+TEST_F(HashtableIndexTest, OrderedIndexScan) {
+  RunOnWorker([]() {
+    HashtableIndex table(std::make_tuple(DefaultHash, 1024, false, 4));
+    constexpr uint32_t kNrRows = 1000;
+    std::vector<uint32_t> ids;
+    for (uint32_t i = 0; i < kNrRows; i++) ids.push_back(i);
+    std::shuffle(ids.begin(), ids.end(), std::mt19937(42));
+
+    for (auto id: ids) {
+      for (uint32_t prefix = 1; prefix <= 3; prefix++) {
+        table.SearchOrCreate(View(Key(prefix, id)));
+      }
+    }
+    for (uint32_t id = 0; id < kNrRows; id += 10) {
+      ASSERT_TRUE(table.Delete(View(Key(2, id))));
+    }
+
+    auto scan = [&table](uint32_t prefix, uint32_t from, uint32_t to, bool reverse) {
+      auto start = Key(prefix, from), end = Key(prefix, to);
+      std::vector<uint32_t> result;
+      auto it = reverse ? table.IndexReverseIterator(View(start), View(end))
+                : table.IndexSearchIterator(View(start), View(end));
+      for (; it->IsValid(); it->Next()) {
+        auto k = it->key();
+        EXPECT_EQ(k.length(), 8);
+        EXPECT_EQ(table.Search(k), it->row());
+        uint32_t id = 0;
+        for (int i = 4; i < 8; i++) id = (id << 8) | k.data()[i];
+        result.push_back(id);
+      }
+      return result;
+    };
+
+    // Inclusive on both ends, and never leaves the prefix.
+    auto forward = scan(2, 100, 200, false);
+    std::vector<uint32_t> expect;
+    for (uint32_t id = 100; id <= 200; id++) {
+      if (id % 10 != 0) expect.push_back(id);
+    }
+    ASSERT_EQ(forward, expect);
+
+    auto backward = scan(2, 200, 100, true);
+    std::reverse(expect.begin(), expect.end());
+    ASSERT_EQ(backward, expect);
+
+    auto all = scan(3, 0, kNrRows, false);
+    ASSERT_EQ(all.size(), kNrRows);
+    ASSERT_TRUE(std::is_sorted(all.begin(), all.end()));
+
+    ASSERT_TRUE(scan(4, 0, kNrRows, false).empty());
+  });
+}
+
+}
+
+}
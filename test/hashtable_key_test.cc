@@ -0,0 +1,56 @@
+#include <gtest/gtest.h>
+#include <string>
+#include "hashtable_index_impl.h"
+
+using felis::HashEntry;
+using felis::VarStrView;
+
+static VarStrView View(const std::string &s)
+{
+  return VarStrView(s.length(), (const uint8_t *) s.data());
+}
+
+// What SearchOrCreate() does, with the copy of a long key kept in buf.
+static void Fill(HashEntry &e, const std::string &s, std::string &buf)
+{
+  e.key = HashEntry::Convert(View(s));
+  if (e.key[15] != HashEntry::kSpilledKey) return;
+  uint16_t len = s.length();
+  buf = std::string((const char *) &len, 2) + s;
+  *(const char **) e.key.data() = buf.data();
+}
+
+TEST(HashtableKeyTest, InlineKeys) {
+  std::string buf;
+  HashEntry e;
+  Fill(e, "abc", buf);
+  ASSERT_TRUE(e.Compare(HashEntry::Convert(View("abc")), View("abc")));
+  // Zero padding no longer hides the length.
+  ASSERT_FALSE(e.Compare(HashEntry::Convert(View(std::string("abc\0", 4))), View(std::string("abc\0", 4))));
+  ASSERT_FALSE(e.Compare(HashEntry::Convert(View("abd")), View("abd")));
+  ASSERT_EQ(e.key_view().length(), 3);
+
+  std::string longest(HashEntry::kMaxInlineKeyLength, 'x');
+  Fill(e, longest, buf);
+  ASSERT_NE(e.key[15], HashEntry::kSpilledKey);
+  ASSERT_TRUE(e.Compare(HashEntry::Convert(View(longest)), View(longest)));
+}
+
+TEST(HashtableKeyTest, SpilledKeys) {
+  std::string buf;
+  HashEntry e;
+  std::string k = "customer-name-index-key-0001";
+  Fill(e, k, buf);
+  ASSERT_EQ(e.key[15], HashEntry::kSpilledKey);
+  ASSERT_TRUE(e.Compare(HashEntry::Convert(View(k)), View(k)));
+
+  auto v = e.key_view();
+  ASSERT_EQ(std::string((const char *) v.data(), v.length()), k);
+
+  // Same prefix, different tail or length.
+  std::string other = "customer-name-index-key-0002";
+  ASSERT_FALSE(e.Compare(HashEntry::Convert(View(other)), View(other)));
+  ASSERT_FALSE(e.Compare(HashEntry::Convert(View(k + "0")), View(k + "0")));
+  // A short key never matches a spilled one.
+  ASSERT_FALSE(e.Compare(HashEntry::Convert(View("customer")), View("customer")));
+}
@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "ingest.h"
+#include "epoch.h"
+#include "log.h"
+
+namespace felis {
+
+namespace {
+
+static constexpr size_t kRecordSize = 16;
+static constexpr long kTimeoutNs = 20'000'000;
+
+static int Connect(const std::string &path)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(struct sockaddr_un));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path.c_str());
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(struct sockaddr_un)) < 0)
+    return -1;
+  return fd;
+}
+
+// A single request is not enough to fill the epoch. It still runs, once the
+// epoch times out.
+TEST(IngestTest, SingleRequestClosesEpoch) {
+  if (!logger) InitializeLogger("ingest_test");
+  EpochClient::g_max_epoch = 3;
+
+  auto path = "/tmp/felis_ingest_test." + std::to_string(getpid());
+  auto ingest = new IngestService(kRecordSize, 1, kTimeoutNs);
+  ingest->Listen("unix:" + path);
+  int fd = Connect(path);
+  ASSERT_GE(fd, 0);
+
+  uint8_t req[sizeof(IngestRequestHeader) + kRecordSize];
+  ((IngestRequestHeader *) req)->req_id = 42;
+  memset(req + sizeof(IngestRequestHeader), 0xAB, kRecordSize);
+  ASSERT_EQ(write(fd, req, sizeof(req)), sizeof(req));
+
+  constexpr unsigned long kEpochSize = 100;
+  IngestEpoch epoch;
+  unsigned long seq = 0;
+  auto record = ingest->WaitForRequest(0, epoch, kEpochSize, &seq);
+  ASSERT_NE(record, nullptr);
+  ASSERT_EQ(seq, 1);
+  ASSERT_EQ(memcmp(record, req + sizeof(IngestRequestHeader), kRecordSize), 0);
+  ingest->FinishRequest(0, 1, seq);
+
+  auto start = std::chrono::steady_clock::now();
+  ASSERT_EQ(ingest->WaitForRequest(0, epoch, kEpochSize, &seq), nullptr);
+  auto waited = std::chrono::steady_clock::now() - start;
+  // We closed it, with the one txn.
+  ASSERT_EQ(seq, 1);
+  ASSERT_LT(waited, std::chrono::nanoseconds(kTimeoutNs) + std::chrono::seconds(1));
+  ASSERT_TRUE(epoch.is_complete(kEpochSize));
+  ASSERT_EQ(epoch.Claim(kEpochSize), 0);
+
+  ingest->OnEpochCommit(1, 1);
+  IngestCompletion c;
+  ASSERT_EQ(read(fd, &c, sizeof(c)), sizeof(c));
+  ASSERT_EQ(c.req_id, 42);
+  ASSERT_EQ(c.epoch_nr, 1);
+
+  close(fd);
+  unlink(path.c_str());
+}
+
+// An empty epoch never times out, and a full one closes without waiting.
+TEST(IngestTest, EpochClaims) {
+  IngestEpoch epoch;
+  ASSERT_FALSE(epoch.is_complete(2));
+  ASSERT_EQ(epoch.first_txn_ns.load(), 0);
+  ASSERT_EQ(epoch.Claim(2), 1);
+  ASSERT_NE(epoch.first_txn_ns.load(), 0);
+  ASSERT_EQ(epoch.Claim(2), 2);
+  ASSERT_TRUE(epoch.is_complete(2));
+  ASSERT_EQ(epoch.Claim(2), 0);
+  ASSERT_EQ(epoch.Close(2), 0);
+
+  IngestEpoch partial;
+  ASSERT_EQ(partial.Claim(10), 1);
+  ASSERT_EQ(partial.Claim(10), 2);
+  ASSERT_EQ(partial.Close(10), 2);
+  // Only one shard closes it.
+  ASSERT_EQ(partial.Close(10), 0);
+  ASSERT_EQ(partial.Claim(10), 0);
+}
+
+}
+
+}
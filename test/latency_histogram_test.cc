@@ -0,0 +1,30 @@
+#include <gtest/gtest.h>
+#include "probe_utils.h"
+
+using Histogram = agg::HdrLogHistogram<>;
+
+TEST(HdrLogHistogramTest, BinBounds) {
+  for (unsigned long v = 0; v < (1UL << 32); v += v / 7 + 1) {
+    int bin = Histogram::Bin(v);
+    ASSERT_GE(bin, 0);
+    ASSERT_LT(bin, Histogram::kNrBins);
+    ASSERT_LE(Histogram::BinStart(bin), v);
+    if (bin + 1 < Histogram::kNrBins) {
+      ASSERT_GT(Histogram::BinStart(bin + 1), v);
+    }
+  }
+  EXPECT_EQ(Histogram::Bin(1UL << 40), Histogram::kNrBins - 1);
+}
+
+TEST(HdrLogHistogramTest, Percentiles) {
+  Histogram a, b;
+  for (long i = 1; i <= 500; i++) a << i;
+  for (long i = 501; i <= 1000; i++) b << i;
+  a << b;
+
+  EXPECT_EQ(a.Count(), 1000);
+  // Within one sub-bucket, i.e. 1/16 of the value.
+  EXPECT_NEAR(a.CalculatePercentile(0.5), 500, 500 / 16);
+  EXPECT_NEAR(a.CalculatePercentile(0.99), 990, 990 / 16);
+  EXPECT_NEAR(a.CalculatePercentile(0.999), 999, 999 / 16);
+}
@@ -0,0 +1,39 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include "util/lowerbound.h"
+
+static void CheckAll(std::vector<uint64_t> &a)
+{
+  auto start = a.data(), end = a.data() + a.size();
+  std::vector<uint64_t> probes = {0, ~0ULL};
+  for (auto x: a) {
+    probes.push_back(x);
+    probes.push_back(x - 1);
+    probes.push_back(x + 1);
+  }
+  for (auto v: probes) {
+    auto expect = std::lower_bound(start, end, v);
+    ASSERT_EQ(util::ScalarLowerBound(start, end, v), expect);
+    if (__builtin_cpu_supports("avx2")) {
+      ASSERT_EQ(util::AVX2LowerBound(start, end, v), expect) << "size " << a.size() << " value " << v;
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+      ASSERT_EQ(util::AVX512LowerBound(start, end, v), expect) << "size " << a.size() << " value " << v;
+    }
+    ASSERT_EQ(util::LowerBound(start, end, v), expect);
+  }
+}
+
+TEST(LowerBoundTest, Sizes) {
+  for (size_t n = 0; n <= 300; n++) {
+    std::vector<uint64_t> a;
+    // Serial id like, epoch in the upper bits.
+    for (size_t i = 0; i < n; i++) a.push_back(((i / 7 + 1) << 32) | ((i % 7) << 8) | 1);
+    CheckAll(a);
+  }
+}
+
+TEST(LowerBoundTest, UnsignedOrder) {
+  std::vector<uint64_t> a = {1, 2, 1ULL << 62, 1ULL << 63, (1ULL << 63) + 5, ~0ULL - 1};
+  CheckAll(a);
+}
@@ -0,0 +1,58 @@
+#include <gtest/gtest.h>
+#include <cstring>
+
+#include "txn_cc.h"
+#include "worker_fixture.h"
+
+namespace felis {
+
+namespace {
+
+class SnapshotReadTest : public WorkerTest {};
+
+struct Value {
+  uint64_t v;
+  void Decode(const VarStr *str) { memcpy(&v, str->data(), sizeof(uint64_t)); }
+};
+
+struct State {};
+using Row = Txn<State>::TxnRow;
+
+static uint64_t Sid(uint64_t epoch_nr, uint64_t seq)
+{
+  return (epoch_nr << 32) | (seq << 8) | 1;
+}
+
+// A snapshot txn can still find a row in the index that was inserted after its
+// snapshot, and it reads nothing from that row.
+TEST_F(SnapshotReadTest, RowCreatedAfterSnapshot) {
+  RunOnWorker([]() {
+    alignas(8) uint8_t buf[sizeof(VarStr) + sizeof(uint64_t)];
+    auto obj = VarStr::FromPtr(buf, sizeof(uint64_t));
+    uint64_t v = 42;
+    memcpy(obj->data(), &v, sizeof(uint64_t));
+
+    // Inserted by a txn of epoch 2.
+    auto row = (VHandle *) VHandle::New();
+    row->AppendNewVersion(Sid(2, 5), 2);
+    row->WriteExactVersion(0, obj, 2);
+
+    // The snapshot of epoch 2 is from before any of its txns.
+    ASSERT_EQ(Row(Sid(2, 1), 2, row).ReadSnapshotVarStr(), nullptr);
+    ASSERT_FALSE(Row(Sid(2, 9), 2, row).ReadSnapshot<Value>());
+
+    auto value = Row(Sid(3, 1), 3, row).ReadSnapshot<Value>();
+    ASSERT_TRUE(value);
+    ASSERT_EQ(value->v, 42);
+
+    // Deleted in epoch 3.
+    row->AppendNewVersion(Sid(3, 5), 3);
+    row->WriteExactVersion(1, nullptr, 3);
+    ASSERT_TRUE(Row(Sid(3, 9), 3, row).ReadSnapshot<Value>());
+    ASSERT_FALSE(Row(Sid(4, 1), 4, row).ReadSnapshot<Value>());
+  });
+}
+
+}
+
+}
@@ -0,0 +1,37 @@
+#include <gtest/gtest.h>
+#include <new>
+
+#include "benchmark/tpcc/order_status.h"
+#include "benchmark/tpcc/stock_level.h"
+
+namespace tpcc {
+
+namespace {
+
+// The tpcc library is built with -DLATENCY, which makes BaseTxn larger than
+// it is here, so the txns are constructed with room to spare.
+template <typename T, typename ...Args>
+static T *NewTxn(Args ...args)
+{
+  alignas(64) static uint8_t buf[sizeof(T) + 256];
+  return ::new (buf) T(args...);
+}
+
+// OrderStatus and StockLevel are snapshot txns only with
+// -XTpccReadOnlySnapshot. Otherwise they have to look up their rows in
+// Prepare() and get a scheduling key, like before.
+TEST(TpccSnapshotTest, ReadOnlyTxnsFollowTheFlag) {
+  constexpr uint64_t kSid = (1ULL << 32) | (1 << 8) | 1;
+  for (bool flag: {false, true}) {
+    g_tpcc_config.read_only_snapshot = flag;
+    auto order_status = NewTxn<OrderStatusTxn>((Client *) nullptr, kSid, OrderStatusStruct{1, 1, 1});
+    ASSERT_EQ(order_status->is_snapshot(), flag);
+    auto stock_level = NewTxn<StockLevelTxn>((Client *) nullptr, kSid, StockLevelStruct{1, 1, 15});
+    ASSERT_EQ(stock_level->is_snapshot(), flag);
+  }
+  g_tpcc_config.read_only_snapshot = false;
+}
+
+}
+
+}
@@ -0,0 +1,72 @@
+// -*- mode: c++ -*-
+
+#ifndef TEST_WORKER_FIXTURE_H
+#define TEST_WORKER_FIXTURE_H
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+
+#include "epoch.h"
+#include "mem.h"
+#include "vhandle.h"
+#include "gopp/gopp.h"
+
+namespace felis {
+
+class MallocStackAllocator : public go::RoutineStackAllocator {
+  static constexpr size_t kStackSize = 256 << 10;
+ public:
+  void AllocateStackAndContext(size_t &stack_size, ucontext * &ctx_ptr, void * &stack_ptr) override final {
+    stack_size = kStackSize;
+    stack_ptr = malloc(kStackSize + kContextSize);
+    ctx_ptr = (ucontext *) ((uint8_t *) stack_ptr + kStackSize);
+    memset(ctx_ptr, 0, kContextSize);
+  }
+  void FreeStackAndContext(ucontext *ctx_ptr, void *stack_ptr) override final {
+    free(stack_ptr);
+  }
+};
+
+// Rows are allocated on the current core, and iterators from the current
+// routine, so these tests run on a worker of a small go thread pool. All test
+// suites in the binary share the pool, and it is set up only once.
+class WorkerTest : public testing::Test {
+ public:
+  static void SetUpTestSuite() {
+    static std::once_flag once;
+    std::call_once(once, []() {
+      static MallocStackAllocator alloc;
+      NodeConfiguration::g_nr_threads = 1;
+      mem::InitTotalNumberOfCores(1);
+      mem::InitSlab(512 << 20);
+      VHandle::InitPool();
+      util::InstanceInit<EpochManager>();
+      go::InitThreadPool(2, &alloc);
+    });
+  }
+
+  static void RunOnWorker(std::function<void ()> f) {
+    static constexpr size_t kBrkSize = 1 << 20;
+    std::atomic_bool done = false;
+    auto r = go::Make(
+        [&f, &done]() {
+          void *buf = malloc(kBrkSize);
+          {
+            go::RoutineScopedData _(mem::Brk::New(buf, kBrkSize));
+            f();
+          }
+          free(buf);
+          done = true;
+        });
+    go::GetSchedulerFromPool(1)->WakeUp(r);
+    while (!done) _mm_pause();
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,162 @@
+// Microbenchmark of HashtableIndex, at load factors from 0.5 to 0.95: inserts,
+// lookups that hit and miss, one at a time and in batches. The table is much
+// larger than the LLC. With -g, the table starts with 1024 buckets and grows
+// to the size while we insert, so the lookups also go through split buckets.
+
+#include <vector>
+#include <random>
+#include <chrono>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "hashtable_index_impl.h"
+#include "epoch.h"
+#include "mem.h"
+#include "gopp/gopp.h"
+
+using namespace felis;
+
+static uint32_t Hash(const VarStrView &k)
+{
+  uint64_t x = *(const uint64_t *) k.data();
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  return x;
+}
+
+static VarStrView View(const uint64_t &k)
+{
+  return VarStrView(8, (const uint8_t *) &k);
+}
+
+template <typename F>
+static double Measure(F f, size_t n)
+{
+  auto t = std::chrono::steady_clock::now();
+  f();
+  auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t).count();
+  return ns / n;
+}
+
+static double SearchEach(HashtableIndex &table, const std::vector<uint64_t> &probes)
+{
+  uintptr_t sum = 0;
+  auto ns = Measure(
+      [&]() {
+        for (auto &k: probes) sum += (uintptr_t) table.Search(View(k));
+      }, probes.size());
+  asm volatile("" : : "r"(sum));
+  return ns;
+}
+
+static double SearchBatch(HashtableIndex &table, const std::vector<uint64_t> &probes)
+{
+  static constexpr size_t kBatchSize = 64;
+  std::vector<VarStrView> keys;
+  for (auto &k: probes) keys.push_back(View(k));
+  VHandle *results[kBatchSize];
+  uintptr_t sum = 0;
+  auto ns = Measure(
+      [&]() {
+        for (size_t i = 0; i < keys.size(); i += kBatchSize) {
+          auto n = std::min(kBatchSize, keys.size() - i);
+          table.SearchBatch(keys.data() + i, n, results);
+          for (size_t j = 0; j < n; j++) sum += (uintptr_t) results[j];
+        }
+      }, probes.size());
+  asm volatile("" : : "r"(sum));
+  return ns;
+}
+
+static void Run(size_t nr_buckets, size_t nr_lookups, bool grow)
+{
+  printf("%5s %10s %10s %10s %10s %10s %10s  (ns per op)\n",
+         "load", "insert", "hit", "batch-hit", "miss", "batch-miss", "buckets");
+
+  std::mt19937_64 rand(0);
+  for (auto load: {0.5, 0.6, 0.7, 0.8, 0.9, 0.95}) {
+    auto table = new HashtableIndex(std::make_tuple(Hash, grow ? 1024 : nr_buckets, false));
+
+    // Even keys are in the table, odd keys are not.
+    std::vector<uint64_t> keys;
+    for (size_t i = 0; i < nr_buckets * load; i++) keys.push_back(rand() & ~1ULL);
+    auto insert_ns = Measure(
+        [&]() {
+          for (auto &k: keys) table->SearchOrCreate(View(k));
+        }, keys.size());
+
+    std::vector<uint64_t> hits, misses;
+    for (size_t i = 0; i < nr_lookups; i++) {
+      hits.push_back(keys[rand() % keys.size()]);
+      misses.push_back(rand() | 1);
+    }
+
+    printf("%5.2f %10.2f %10.2f %10.2f %10.2f %10.2f %10lu\n", load, insert_ns,
+           SearchEach(*table, hits), SearchBatch(*table, hits),
+           SearchEach(*table, misses), SearchBatch(*table, misses),
+           table->current_nr_buckets());
+    // Tables are never freed, neither are their rows.
+  }
+}
+
+class MallocStackAllocator : public go::RoutineStackAllocator {
+  static constexpr size_t kStackSize = 1 << 20;
+ public:
+  void AllocateStackAndContext(size_t &stack_size, ucontext * &ctx_ptr, void * &stack_ptr) override final {
+    stack_size = kStackSize;
+    stack_ptr = malloc(kStackSize + kContextSize);
+    ctx_ptr = (ucontext *) ((uint8_t *) stack_ptr + kStackSize);
+    memset(ctx_ptr, 0, kContextSize);
+  }
+  void FreeStackAndContext(ucontext *ctx_ptr, void *stack_ptr) override final {
+    free(stack_ptr);
+  }
+};
+
+int main(int argc, char *argv[])
+{
+  int opt;
+  size_t nr_buckets = 1 << 22;
+  size_t nr_lookups = 1 << 22;
+  size_t mem_size = 8UL << 30;
+  bool grow = false;
+  while ((opt = getopt(argc, argv, "b:n:m:g")) != -1) {
+    switch (opt) {
+      case 'b': nr_buckets = std::stoul(optarg); break;
+      case 'n': nr_lookups = std::stoul(optarg); break;
+      case 'm': mem_size = std::stoul(optarg) << 20; break;
+      case 'g': grow = true; break;
+      default:
+        printf("Usage: %s [-b nr_buckets] [-n nr_lookups] [-m row memory in MB] [-g]\n", argv[0]);
+        return -1;
+    }
+  }
+  if (nr_buckets & (nr_buckets - 1)) {
+    printf("nr_buckets has to be a power of 2\n");
+    return -1;
+  }
+
+  // Rows come from the VHandle pool of the current core, so the benchmark runs
+  // on a worker thread of gopp, like the txns do.
+  static MallocStackAllocator alloc;
+  NodeConfiguration::g_nr_threads = 1;
+  mem::InitTotalNumberOfCores(1);
+  mem::InitSlab(mem_size);
+  VHandle::InitPool();
+  util::InstanceInit<EpochManager>();
+  go::InitThreadPool(2, &alloc);
+
+  std::atomic_bool done = false;
+  go::GetSchedulerFromPool(1)->WakeUp(
+      go::Make(
+          [&]() {
+            Run(nr_buckets, nr_lookups, grow);
+            done = true;
+          }));
+  while (!done) usleep(1000);
+  return 0;
+}
@@ -0,0 +1,205 @@
+// Open-loop load generator for the ingestion socket (-XIngestAddress).
+//
+// Replays the records of a txn log at the inter-arrival times of a lancet
+// distribution, and measures the end-to-end latency of every request, from the
+// time it was scheduled to be sent until its completion arrives. Because we
+// measure from the schedule, a server that pushes back does not hide its own
+// queueing delay.
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "log.h"
+#include "txn_log.h"
+#include "ingest.h"
+#include "lancet/inter_arrival.h"
+
+using felis::IngestRequestHeader;
+using felis::IngestCompletion;
+
+static void show_usage(const char *progname)
+{
+  printf("Usage: %s -a address -l log_file -i inter_arrival -n nr_requests [-s record_size] [-c nr_conns]\n\n",
+         progname);
+  puts("\t-a\tunix:<path> or <host>:<port>, same as -XIngestAddress");
+  puts("\t-l\ttxn log to take the records from");
+  puts("\t-i\tlancet inter-arrival distribution in ns, for example exp:10000");
+  puts("\t-n\tnumber of requests to send");
+  puts("\t-s\trecord size, only needed for legacy logs");
+  puts("\t-c\tnumber of connections, requests are spread round-robin");
+  std::exit(-1);
+}
+
+static int Connect(const std::string &address)
+{
+  int fd = -1;
+  int res = -1;
+  if (address.compare(0, 5, "unix:") == 0) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, address.c_str() + 5, sizeof(addr.sun_path) - 1);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0)
+      res = connect(fd, (struct sockaddr *) &addr, sizeof(struct sockaddr_un));
+  } else {
+    struct sockaddr_in addr;
+    auto pos = address.find(":");
+    if (pos == address.npos)
+      return -1;
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr(address.substr(0, pos).c_str());
+    addr.sin_port = htons(std::stoi(address.substr(pos + 1)));
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd >= 0) {
+      int enable = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(int));
+      res = connect(fd, (struct sockaddr *) &addr, sizeof(struct sockaddr_in));
+    }
+  }
+  if (res < 0) {
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static bool WriteAll(int fd, const uint8_t *p, size_t len)
+{
+  while (len > 0) {
+    int rs = write(fd, p, len);
+    if (rs < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    p += rs;
+    len -= rs;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  int opt;
+  std::string address, log_file, inter_arrival;
+  unsigned long nr_requests = 0;
+  size_t record_size = 0;
+  int nr_conns = 1;
+
+  while ((opt = getopt(argc, argv, "a:l:i:n:s:c:")) != -1) {
+    switch (opt) {
+      case 'a': address = optarg; break;
+      case 'l': log_file = optarg; break;
+      case 'i': inter_arrival = optarg; break;
+      case 'n': nr_requests = std::stoul(optarg); break;
+      case 's': record_size = std::stoul(optarg); break;
+      case 'c': nr_conns = std::stoi(optarg); break;
+      default: show_usage(argv[0]);
+    }
+  }
+  if (address == "" || log_file == "" || inter_arrival == "" || nr_requests == 0 || nr_conns < 1)
+    show_usage(argv[0]);
+
+  InitializeLogger("ingest_loadgen");
+
+  felis::TxnLog log(log_file);
+  if (log.is_legacy()) {
+    abort_if(record_size == 0, "{} is a legacy log, please specify the record size", log_file);
+    log.CheckRecordSize(record_size);
+  }
+  record_size = log.record_size();
+
+  auto dist = lancet_init_rand(inter_arrival.data());
+  abort_if(dist == nullptr, "Cannot parse inter-arrival distribution {}", inter_arrival);
+
+  std::vector<int> fds;
+  for (int c = 0; c < nr_conns; c++) {
+    int fd = Connect(address);
+    abort_if(fd < 0, "Cannot connect to {}, errno={}", address, errno);
+    fds.push_back(fd);
+  }
+
+  // Scheduled send time of each request, indexed by req_id.
+  auto sched_ns = new std::atomic_long[nr_requests];
+  std::vector<std::vector<long>> latencies(nr_conns);
+  std::vector<std::thread> receivers;
+
+  for (int c = 0; c < nr_conns; c++) {
+    receivers.emplace_back(
+        [c, &fds, &latencies, sched_ns, nr_requests, nr_conns]() {
+          auto expect = nr_requests / nr_conns + (c < nr_requests % nr_conns ? 1 : 0);
+          IngestCompletion buf[1024];
+          size_t len = 0;
+          while (latencies[c].size() < expect) {
+            int rs = read(fds[c], (uint8_t *) buf + len, sizeof(buf) - len);
+            if (rs < 0 && errno == EINTR) continue;
+            if (rs <= 0) break;
+            len += rs;
+            auto now = time_ns();
+            size_t n = len / sizeof(IngestCompletion);
+            for (size_t i = 0; i < n; i++) {
+              latencies[c].push_back(now - sched_ns[buf[i].req_id].load(std::memory_order_acquire));
+            }
+            memmove(buf, (uint8_t *) buf + n * sizeof(IngestCompletion), len % sizeof(IngestCompletion));
+            len %= sizeof(IngestCompletion);
+          }
+        });
+  }
+
+  // Send everything that is due in one write, so that we don't fall behind
+  // schedule because of syscalls.
+  auto frame_size = sizeof(IngestRequestHeader) + record_size;
+  std::vector<std::vector<uint8_t>> batches(nr_conns);
+  long start = time_ns();
+  long next_ts = start;
+  unsigned long req_id = 0;
+  while (req_id < nr_requests) {
+    while (time_ns() < next_ts) _mm_pause();
+
+    auto now = time_ns();
+    while (req_id < nr_requests && next_ts <= now) {
+      auto &b = batches[req_id % nr_conns];
+      IngestRequestHeader hdr{req_id};
+      b.insert(b.end(), (uint8_t *) &hdr, (uint8_t *) &hdr + sizeof(hdr));
+      auto rec = (uint8_t *) log.record(req_id % log.size());
+      b.insert(b.end(), rec, rec + record_size);
+      sched_ns[req_id].store(next_ts, std::memory_order_release);
+      next_ts += gen_inter_arrival(dist);
+      req_id++;
+    }
+    for (int c = 0; c < nr_conns; c++) {
+      if (batches[c].empty()) continue;
+      abort_if(!WriteAll(fds[c], batches[c].data(), batches[c].size()),
+               "Cannot send to {}, errno={}", address, errno);
+      batches[c].clear();
+    }
+  }
+  long send_ns = time_ns() - start;
+
+  for (auto &t: receivers) t.join();
+
+  std::vector<long> all;
+  for (auto &l: latencies) all.insert(all.end(), l.begin(), l.end());
+  std::sort(all.begin(), all.end());
+
+  printf("Sent %lu requests (%lu bytes each) in %.3f s, %.0f req/s\n",
+         nr_requests, frame_size, send_ns / 1e9, nr_requests * 1e9 / send_ns);
+  printf("Completed %lu\n", all.size());
+  if (!all.empty()) {
+    auto pct = [&all](double p) { return all[std::min<size_t>(all.size() * p, all.size() - 1)] / 1000; };
+    printf("Latency us: p50 %ld p99 %ld p999 %ld max %ld\n",
+           pct(0.5), pct(0.99), pct(0.999), all.back() / 1000);
+  }
+  return 0;
+}
@@ -0,0 +1,72 @@
+// Microbenchmark of util::LowerBound() and friends on version arrays, like
+// the ones in SortedArrayVHandle, of 4 to 4096 versions.
+
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdio>
+#include <unistd.h>
+
+#include "util/lowerbound.h"
+
+static double Measure(util::LowerBoundFunc f, std::vector<uint64_t> &versions,
+                      const std::vector<uint64_t> &sids)
+{
+  auto start = versions.data(), end = versions.data() + versions.size();
+  uintptr_t sum = 0;
+  auto t = std::chrono::steady_clock::now();
+  for (auto sid: sids)
+    sum += f(start, end, sid) - start;
+  auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t).count();
+  asm volatile("" : : "r"(sum));
+  return ns / sids.size();
+}
+
+int main(int argc, char *argv[])
+{
+  int opt;
+  size_t nr_lookups = 1 << 22;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+      case 'n': nr_lookups = std::stoul(optarg); break;
+      default:
+        printf("Usage: %s [-n nr_lookups]\n", argv[0]);
+        return -1;
+    }
+  }
+
+  struct {
+    const char *name;
+    util::LowerBoundFunc f;
+    bool supported;
+  } impls[] = {
+    {"scalar", util::ScalarLowerBound, true},
+    {"avx2", util::AVX2LowerBound, (bool) __builtin_cpu_supports("avx2")},
+    {"avx512", util::AVX512LowerBound, (bool) __builtin_cpu_supports("avx512f")},
+    {"dispatch", util::LowerBound, true},
+  };
+
+  printf("%6s", "size");
+  for (auto &impl: impls) printf(" %10s", impl.name);
+  printf("  (ns per lookup)\n");
+
+  std::mt19937_64 rand(0);
+  for (size_t size = 4; size <= 4096; size *= 2) {
+    std::vector<uint64_t> versions;
+    for (size_t i = 0; i < size; i++)
+      versions.push_back(((i / 64 + 1) << 32) | ((i % 64 + 1) << 8) | 1);
+    std::vector<uint64_t> sids;
+    for (size_t i = 0; i < nr_lookups; i++)
+      sids.push_back(versions[rand() % size] + (rand() % 2));
+
+    printf("%6zu", size);
+    for (auto &impl: impls) {
+      if (impl.supported)
+        printf(" %10.2f", Measure(impl.f, versions, sids));
+      else
+        printf(" %10s", "-");
+    }
+    printf("\n");
+  }
+  return 0;
+}
@@ -0,0 +1,143 @@
+// Microbenchmark of the per-core dispatch queues in routine_sched.
+//
+// Every thread owns one queue, like a worker core. It keeps adding batches of
+// routines to random queues, and drains its own queue in between. We compare
+// the lock-free util::MPSCRing against a ring guarded by a util::SpinLock,
+// which is what EpochExecutionDispatchService used to do.
+
+#include <thread>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "util/locks.h"
+#include "util/mpsc.h"
+
+struct Item {};
+
+static constexpr size_t kCapacity = 1 << 16;
+
+class LockedQueue {
+  util::SpinLock lock;
+  Item **q;
+  std::atomic_ulong start = 0, end = 0;
+ public:
+  LockedQueue() : q(new Item*[kCapacity]) {}
+  size_t size() const { return end.load(std::memory_order_relaxed) - start.load(std::memory_order_relaxed); }
+  void Push(Item **items, size_t n) {
+    lock.Lock();
+    auto e = end.load(std::memory_order_relaxed);
+    while (e + n > start.load(std::memory_order_acquire) + kCapacity) _mm_pause();
+    for (size_t i = 0; i < n; i++)
+      q[(e + i) % kCapacity] = items[i];
+    end.store(e + n, std::memory_order_release);
+    lock.Unlock();
+  }
+  size_t Drain() {
+    auto s = start.load(std::memory_order_relaxed);
+    auto e = end.load(std::memory_order_acquire);
+    for (auto pos = s; pos < e; pos++)
+      asm volatile("" : : "r"(q[pos % kCapacity]));
+    start.store(e, std::memory_order_release);
+    return e - s;
+  }
+};
+
+class LockFreeQueue {
+  util::MPSCRing<Item> ring;
+ public:
+  LockFreeQueue() { ring.Initialize(calloc(1, decltype(ring)::MemorySize(kCapacity)), kCapacity); }
+  size_t size() const { return ring.end.load(std::memory_order_relaxed) - ring.start.load(std::memory_order_relaxed); }
+  void Push(Item **items, size_t n) {
+    auto pos = ring.Reserve(n);
+    ring.WaitForSpace(pos, n);
+    for (size_t i = 0; i < n; i++)
+      ring.Publish(pos + i, items[i]);
+  }
+  size_t Drain() {
+    auto s = ring.start.load(std::memory_order_relaxed);
+    auto e = ring.end.load(std::memory_order_acquire);
+    auto pos = s;
+    for (; pos < e; pos++) {
+      auto p = ring.Load(pos);
+      if (p == nullptr) break;
+      asm volatile("" : : "r"(p));
+      ring.Consume(pos);
+    }
+    ring.Advance(pos);
+    return pos - s;
+  }
+};
+
+template <typename Queue>
+static void Run(const char *name, int nr_threads, size_t batch, int duration_ms)
+{
+  std::vector<Queue *> queues;
+  for (int i = 0; i < nr_threads; i++) queues.push_back(new Queue());
+
+  std::atomic_bool go = false, stop = false;
+  std::atomic_ulong nr_enqueued = 0, nr_dequeued = 0;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < nr_threads; t++) {
+    threads.emplace_back(
+        [&, t]() {
+          std::mt19937 rand(t);
+          std::vector<Item *> items(batch, (Item *) 0x40);
+          unsigned long enq = 0, deq = 0;
+          while (!go.load()) _mm_pause();
+          while (!stop.load(std::memory_order_relaxed)) {
+            auto q = queues[rand() % nr_threads];
+            // Every producer can be blocked on a full queue, whose owner might
+            // be blocked too. Stay far from full so that we never deadlock.
+            if (q->size() < kCapacity / 2) {
+              q->Push(items.data(), batch);
+              enq += batch;
+            }
+            deq += queues[t]->Drain();
+          }
+          nr_enqueued.fetch_add(enq);
+          nr_dequeued.fetch_add(deq);
+        });
+  }
+
+  go = true;
+  std::this_thread::sleep_for(std::chrono::milliseconds(duration_ms));
+  stop = true;
+  for (auto &th: threads) th.join();
+
+  printf("%-8s threads %2d batch %zu: enqueue %8.2f Mops/s dequeue %8.2f Mops/s\n",
+         name, nr_threads, batch,
+         nr_enqueued.load() / 1e3 / duration_ms, nr_dequeued.load() / 1e3 / duration_ms);
+  for (auto q: queues) delete q;
+}
+
+int main(int argc, char *argv[])
+{
+  int opt;
+  size_t batch = 1;
+  int duration_ms = 1000;
+  std::vector<int> nr_threads;
+  while ((opt = getopt(argc, argv, "t:b:d:")) != -1) {
+    switch (opt) {
+      case 't': nr_threads.push_back(std::atoi(optarg)); break;
+      case 'b': batch = std::atol(optarg); break;
+      case 'd': duration_ms = std::atoi(optarg); break;
+      default:
+        printf("Usage: %s [-t nr_threads]... [-b batch] [-d duration_ms]\n", argv[0]);
+        return -1;
+    }
+  }
+  if (nr_threads.empty()) nr_threads = {8, 16, 32};
+  // See the deadlock comment in Run().
+  if (batch == 0 || batch > kCapacity / 256) batch = 1;
+
+  for (auto n: nr_threads) {
+    Run<LockedQueue>("spinlock", n, batch, duration_ms);
+    Run<LockFreeQueue>("mpsc", n, batch, duration_ms);
+  }
+  return 0;
+}
@@ -0,0 +1,174 @@
+#include <chrono>
+#include <fstream>
+#include <thread>
+#include <unordered_map>
+
+#include "tracer.h"
+#include "opts.h"
+#include "log.h"
+
+namespace felis {
+
+Tracer &Tracer::Instance()
+{
+  static Tracer tracer(Options::kTraceBufferSize.ToLargeNumber("256K"));
+  return tracer;
+}
+
+void Tracer::SetEnabled(bool enabled)
+{
+  // Allocate the buffers before any core records.
+  Instance();
+  g_enabled.store(enabled);
+}
+
+Tracer::Tracer(size_t nr_events_per_core)
+{
+  capacity = 1;
+  while (capacity < nr_events_per_core) capacity <<= 1;
+  for (int i = 0; i < NodeConfiguration::g_nr_threads; i++) {
+    rings[i].events.reset(new Event[capacity]);
+  }
+
+  auto t = std::chrono::steady_clock::now();
+  start_tsc = __rdtsc();
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  auto us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t).count();
+  tsc_per_us = (__rdtsc() - start_tsc) / us;
+}
+
+void Tracer::AppendPhase(EventType type, uint64_t arg)
+{
+  std::lock_guard _(phase_lock);
+  phase_events.push_back(MakeEvent(type, arg));
+}
+
+// The core might keep recording while we copy. Whatever it could have
+// overwritten in the meantime is dropped.
+std::vector<Tracer::Event> Tracer::Copy(int core)
+{
+  auto &r = rings[core];
+  auto head = r.head.load(std::memory_order_acquire);
+  auto start = head > capacity ? head - capacity : 0;
+  std::vector<Event> result;
+  for (auto i = start; i < head; i++) {
+    result.push_back(r.events[i & (capacity - 1)]);
+  }
+  auto new_head = r.head.load(std::memory_order_acquire);
+  if (new_head > capacity && new_head - capacity > start) {
+    auto nr_dropped = std::min<size_t>(new_head - capacity - start, result.size());
+    result.erase(result.begin(), result.begin() + nr_dropped);
+  }
+  return result;
+}
+
+long Tracer::DumpChromeTrace(const std::string &path)
+{
+  std::ofstream fout(path);
+  if (!fout) {
+    logger->error("Cannot open {} for the trace", path);
+    return -1;
+  }
+
+  static const char *kPhaseNames[] = {"Insert", "Initialize", "Execute"};
+  long nr_events = 0;
+  fmt::memory_buffer buf;
+  auto ts = [this](const Event &e) {
+    return e.tsc() > start_tsc ? (e.tsc() - start_tsc) / tsc_per_us : 0.0;
+  };
+  auto emit = [&buf, &nr_events, &fout](std::string_view json) {
+    fmt::format_to(buf, "{}{}\n", nr_events++ == 0 ? "" : ",", json);
+    if (buf.size() > (1 << 20)) {
+      fout.write(buf.data(), buf.size());
+      buf.clear();
+    }
+  };
+
+  fout << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+
+  emit(R"({"name":"process_name","ph":"M","pid":0,"args":{"name":"workers"}})");
+  emit(R"({"name":"process_name","ph":"M","pid":1,"args":{"name":"epochs"}})");
+
+  {
+    std::lock_guard _(phase_lock);
+    for (auto &e: phase_events) {
+      emit(fmt::format(R"({{"name":"{}","ph":"{}","ts":{:.3f},"pid":1,"tid":0,"args":{{"epoch":{}}}}})",
+                       kPhaseNames[e.arg & 0xFF], e.type() == PhaseBegin ? "B" : "E",
+                       ts(e), e.arg >> 8));
+    }
+  }
+
+  for (int core = 0; core < NodeConfiguration::g_nr_threads; core++) {
+    auto events = Copy(core);
+    if (events.empty()) continue;
+
+    emit(fmt::format(R"({{"name":"thread_name","ph":"M","pid":0,"tid":{},"args":{{"name":"core {}"}}}})",
+                     core, core));
+
+    // Slices still open on each routine, from the outermost.
+    std::unordered_map<uint64_t, std::vector<Event>> open;
+    uint64_t cur = 0;
+
+    auto begin = [&](const Event &slice, double t) {
+      if (slice.type() == PieceBegin) {
+        emit(fmt::format(R"({{"name":"piece","ph":"B","ts":{:.3f},"pid":0,"tid":{},"args":{{"sched_key":{}}}}})",
+                         t, core, slice.arg));
+      } else {
+        emit(fmt::format(R"({{"name":"wait","ph":"B","ts":{:.3f},"pid":0,"tid":{},"args":{{"version":{}}}}})",
+                         t, core, slice.arg));
+      }
+    };
+    auto end = [&](double t) {
+      emit(fmt::format(R"({{"ph":"E","ts":{:.3f},"pid":0,"tid":{}}})", t, core));
+    };
+    auto close_all = [&](uint64_t routine, double t) {
+      for (size_t i = 0; i < open[routine].size(); i++) end(t);
+    };
+
+    for (auto &e: events) {
+      auto t = ts(e);
+      switch (e.type()) {
+        case RoutineStart:
+          cur = e.arg;
+          break;
+        case RoutineExit:
+          close_all(e.arg, t);
+          open.erase(e.arg);
+          cur = 0;
+          break;
+        case Suspend:
+          close_all(e.arg, t);
+          emit(fmt::format(R"({{"name":"preempt","ph":"i","s":"t","ts":{:.3f},"pid":0,"tid":{}}})",
+                           t, core));
+          cur = 0;
+          break;
+        case Resume:
+          cur = e.arg;
+          for (auto &slice: open[cur]) begin(slice, t);
+          break;
+        case PieceBegin:
+        case WaitBegin:
+          open[cur].push_back(e);
+          begin(e, t);
+          break;
+        case PieceEnd:
+        case WaitEnd:
+          // The begin might have been overwritten already.
+          if (open[cur].empty()) break;
+          open[cur].pop_back();
+          end(t);
+          break;
+        default:
+          break;
+      }
+    }
+    // Still running, or sleeping.
+    close_all(cur, ts(events.back()));
+  }
+
+  fout.write(buf.data(), buf.size());
+  fout << "]}" << std::endl;
+  return nr_events;
+}
+
+}
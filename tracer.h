@@ -0,0 +1,106 @@
+// -*- mode: c++ -*-
+
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <x86intrin.h>
+
+#include "node_config.h"
+#include "util/arch.h"
+
+namespace felis {
+
+// Timeline of every worker core, for chrome://tracing or Perfetto. Pieces,
+// waits in the VHandleSyncService, preemptions and the epoch phases.
+//
+// Each core appends 16 byte events to its own ring buffer, so the oldest
+// events are overwritten when a buffer is full. The buffers are converted to
+// Chrome trace-event JSON only on request (the dump_trace console request, or
+// at the end of the run with -XTrace). When the tracer is off, Record() is a
+// load and a not-taken branch.
+//
+// Pieces run on ExecutionRoutines, and a routine that is preempted goes to
+// sleep in the middle of its piece while other routines run pieces on the
+// same core. The routines record when they start, sleep, wake up and exit, and
+// the dump closes and reopens the slices of a routine around its sleep, so the
+// slices of a core are always nested.
+class Tracer {
+ public:
+  enum EventType : uint8_t {
+    RoutineStart, // arg is the routine
+    RoutineExit,
+    Suspend,
+    Resume,
+    PieceBegin, // arg is the sched_key
+    PieceEnd,
+    WaitBegin, // arg is the version we wait for
+    WaitEnd,
+    PhaseBegin, // arg is (epoch_nr << 8) | EpochPhase
+    PhaseEnd,
+  };
+
+  struct Event {
+    uint64_t tsc_type; // TSC in the low 56 bits
+    uint64_t arg;
+
+    uint64_t tsc() const { return tsc_type & ((1ULL << 56) - 1); }
+    EventType type() const { return EventType(tsc_type >> 56); }
+  };
+
+  static inline std::atomic_bool g_enabled = false;
+
+  static void Record(int core, EventType type, uint64_t arg) {
+    if (likely(!g_enabled.load(std::memory_order_relaxed))) return;
+    Instance().Append(core, type, arg);
+  }
+  // Phases are not on any worker core.
+  static void RecordPhase(EventType type, uint64_t epoch_nr, int phase) {
+    if (likely(!g_enabled.load(std::memory_order_relaxed))) return;
+    Instance().AppendPhase(type, (epoch_nr << 8) | phase);
+  }
+
+  static Tracer &Instance();
+  static void SetEnabled(bool enabled);
+
+  Tracer(size_t nr_events_per_core);
+
+  // Returns the number of events written, or -1.
+  long DumpChromeTrace(const std::string &path);
+
+ private:
+  struct Ring {
+    std::unique_ptr<Event[]> events;
+    std::atomic_ulong head = 0;
+  };
+  size_t capacity; // power of 2
+  std::array<util::CacheAligned<Ring>, NodeConfiguration::kMaxNrThreads> rings;
+
+  std::mutex phase_lock;
+  std::vector<Event> phase_events;
+
+  uint64_t start_tsc;
+  double tsc_per_us;
+
+  static Event MakeEvent(EventType type, uint64_t arg) {
+    return Event{(__rdtsc() & ((1ULL << 56) - 1)) | ((uint64_t) type << 56), arg};
+  }
+  void Append(int core, EventType type, uint64_t arg) {
+    auto &r = rings[core];
+    auto h = r.head.load(std::memory_order_relaxed);
+    r.events[h & (capacity - 1)] = MakeEvent(type, arg);
+    r.head.store(h + 1, std::memory_order_release);
+  }
+  void AppendPhase(EventType type, uint64_t arg);
+  std::vector<Event> Copy(int core);
+};
+
+}
+
+#endif
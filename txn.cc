@@ -8,7 +8,7 @@
 namespace felis {
 
 BaseTxn::BrkType BaseTxn::g_brk;
-int BaseTxn::g_cur_numa_node = 0;
+thread_local int BaseTxn::g_cur_numa_node = 0;
 
 void BaseTxn::InitBrk(long nr_epochs)
 {
@@ -18,6 +18,8 @@ void BaseTxn::InitBrk(long nr_epochs)
   for (auto n = 0; n < nr_numa_nodes; n++) {
     auto numa_node = n;
     g_brk[n] = mem::Brk::New(mem::AllocMemory(mem::Txn, lmt, numa_node), lmt);
+    // Txns are created by several dispatchers or populating threads at once.
+    g_brk[n]->set_thread_safe(true);
   }
 }
 
@@ -35,7 +37,13 @@ void BaseTxn::BaseTxnRow::AppendNewVersion(int ondemand_split_weight)
 #endif
 
     if (!is_dup) {
-      vhandle->AppendNewVersion(sid, epoch_nr, ondemand_split_weight);
+      if (EpochClient::g_enable_pipeline
+          && epoch_nr > util::Instance<EpochManager>().current_epoch_nr()) {
+        // Issued by the pipeline. The current epoch may still be reading this row.
+        EpochClient::g_workload_client->DeferAppend(vhandle, sid, ondemand_split_weight);
+      } else {
+        vhandle->AppendNewVersion(sid, epoch_nr, ondemand_split_weight);
+      }
     } else {
       // This should be rare. Let's warn the user.
       logger->warn("Duplicate write detected in sid {} on row {}", sid, (void *) vhandle);
@@ -61,6 +69,18 @@ VarStr *BaseTxn::BaseTxnRow::ReadVarStr()
     return vhandle->ReadWithVersion(sid);
 }
 
+VarStr *BaseTxn::BaseTxnRow::ReadSnapshotVarStr()
+{
+  // Granola and PWV keep only one version.
+  if (EpochClient::g_enable_granola || EpochClient::g_enable_pwv)
+    return ReadVarStr();
+
+  VarStr *obj = nullptr;
+  if (!vhandle->ReadStableVersion(epoch_nr << 32, &obj))
+    return nullptr;
+  return obj;
+}
+
 bool BaseTxn::BaseTxnRow::WriteVarStr(VarStr *obj)
 {
   if (!EpochClient::g_enable_granola && !EpochClient::g_enable_pwv) {
@@ -190,16 +210,54 @@ const uint8_t *BaseTxn::BaseTxnIndexOpContext::DecodeFrom(const uint8_t *buf)
   return p;
 }
 
-BaseTxn::LookupRowResult BaseTxn::BaseTxnIndexOpLookup(const BaseTxnIndexOpContext &ctx, int idx)
+static bool IsPointLookup(int64_t slice_id)
+{
+  return slice_id >= 0 || slice_id == kReadOnlySliceId;
+}
+
+void BaseTxn::BaseTxnIndexOpSearchBatch(const BaseTxnIndexOpContext &ctx,
+                                        VHandle *rows[BaseTxnIndexOpContext::kMaxPackedKeys])
+{
+  int nr_keys = __builtin_popcountll(ctx.keys_bitmap);
+  VarStrView keys[BaseTxnIndexOpContext::kMaxPackedKeys];
+  VHandle *results[BaseTxnIndexOpContext::kMaxPackedKeys];
+  int pos[BaseTxnIndexOpContext::kMaxPackedKeys];
+  uint64_t todo = 0;
+
+  for (int i = 0; i < nr_keys; i++) {
+    rows[i] = nullptr;
+    if (IsPointLookup(ctx.slice_ids[i])) todo |= 1ULL << i;
+  }
+
+  // One batch per table. A txn rarely packs more than two tables together.
+  while (todo) {
+    auto relation_id = ctx.relation_ids[__builtin_ctzll(todo)];
+    int n = 0;
+    for (int i = __builtin_ctzll(todo); i < nr_keys; i++) {
+      if ((todo & (1ULL << i)) == 0 || ctx.relation_ids[i] != relation_id) continue;
+      keys[n] = VarStrView(ctx.key_len[i], ctx.key_data[i]);
+      pos[n++] = i;
+      todo &= ~(1ULL << i);
+    }
+    util::Instance<TableManager>().GetTable(relation_id)->SearchBatch(keys, n, results);
+    for (int j = 0; j < n; j++) rows[pos[j]] = results[j];
+  }
+}
+
+BaseTxn::LookupRowResult BaseTxn::BaseTxnIndexOpLookup(const BaseTxnIndexOpContext &ctx, int idx,
+                                                       VHandle * const *rows)
 {
   auto tbl = util::Instance<TableManager>().GetTable(ctx.relation_ids[idx]);
   BaseTxn::LookupRowResult result;
   result.fill(nullptr);
 
-  if (ctx.slice_ids[idx] >= 0 || ctx.slice_ids[idx] == kReadOnlySliceId) {
-    VarStrView key(ctx.key_len[idx], ctx.key_data[idx]);
-    auto handle = tbl->Search(key);
-    result[0] = handle;
+  if (IsPointLookup(ctx.slice_ids[idx])) {
+    if (rows) {
+      result[0] = rows[idx];
+    } else {
+      VarStrView key(ctx.key_len[idx], ctx.key_data[idx]);
+      result[0] = tbl->Search(key);
+    }
   } else if (ctx.slice_ids[idx] == -1) {
     VarStrView range_start(ctx.key_len[idx], ctx.key_data[idx]);
     VarStrView range_end(ctx.key_len[idx + 1], ctx.key_data[idx + 1]);
@@ -25,6 +25,8 @@ class BaseTxn {
  protected:
   friend class EpochClient;
   friend class EpochDispatcher;
+  friend class PipelineTxnWorker;
+  friend class CallTxnsWorker;
 
   Epoch *epoch;
   uint64_t sid;
@@ -33,17 +35,20 @@ class BaseTxn {
   std::chrono::time_point<std::chrono::system_clock> init_time;
   uint32_t duration;
   //std::chrono::nanoseconds duration;
+  uint32_t queue_delay; // until the Execute phase calls Run0()
 #endif
 
   using BrkType = std::array<mem::Brk *, NodeConfiguration::kMaxNrThreads / mem::kNrCorePerNode>;
   static BrkType g_brk;
-  static int g_cur_numa_node;
+  // Set by whoever creates the txns. Several dispatchers may create txns
+  // concurrently, so this is per-thread.
+  static thread_local int g_cur_numa_node;
 
  public:
   BaseTxn(uint64_t serial_id)
     : epoch(nullptr), sid(serial_id)
 #if defined(DISPATCHER) && defined(LATENCY)
-      , duration(0)
+      , duration(0), queue_delay(0)
 #endif
   {
 #if defined(DISPATCHER) && defined(LATENCY)
@@ -56,6 +61,10 @@ class BaseTxn {
   static void InitBrk(long nr_epochs);
 
   virtual void PrepareState() {}
+  // For the per-type latency stats, see EpochClient::TxnTypeName().
+  virtual int txn_type_id() const { return 0; }
+  // See SnapshotTxn.
+  virtual bool is_snapshot() const { return false; }
 
   virtual ~BaseTxn() {}
   virtual void Prepare() = 0;
@@ -76,7 +85,9 @@ class BaseTxn {
     Run();
 
     if (!last) { // !PWV
-      root_promise()->AssignSchedulingKey(serial_id());
+      // Snapshot txns leave their pieces unordered.
+      if (!is_snapshot())
+        root_promise()->AssignSchedulingKey(serial_id());
     } else { // PWV
       uint64_t k = 0;
       for (int i = 0; i < root_promise()->nr_routines(); i++) {
@@ -118,6 +129,9 @@ class BaseTxn {
 
     void AppendNewVersion(int ondemand_split_weight = 0);
     VarStr *ReadVarStr();
+    // Reads the version as of the beginning of this epoch, without waiting.
+    // nullptr if the row did not exist then, or had been deleted.
+    VarStr *ReadSnapshotVarStr();
     bool WriteVarStr(VarStr *obj);
     bool Delete() { return WriteVarStr(nullptr); }
   };
@@ -131,6 +145,8 @@ class BaseTxn {
     BaseTxnHandle() {}
 
     uint64_t serial_id() const { return sid; }
+    // What a SnapshotTxn reads as of. Pass it to ShouldScanSkip().
+    uint64_t snapshot_id() const { return epoch_nr << 32; }
 
     // C++ wrapper will name hide this.
     BaseTxnRow operator()(VHandle *vhandle) const { return BaseTxnRow(sid, epoch_nr, vhandle); }
@@ -192,7 +208,13 @@ class BaseTxn {
   static constexpr size_t kMaxRangeScanKeys = BaseTxnIndexOpContext::kMaxPackedKeys + 1;
   using LookupRowResult = std::array<VHandle *, kMaxRangeScanKeys>;
 
-  static LookupRowResult BaseTxnIndexOpLookup(const BaseTxnIndexOpContext &ctx, int idx);
+  // Point lookups of all keys in ctx at once, so that the indexes can overlap
+  // their cache misses. Range scans are left as nullptr.
+  static void BaseTxnIndexOpSearchBatch(const BaseTxnIndexOpContext &ctx,
+                                        VHandle *rows[BaseTxnIndexOpContext::kMaxPackedKeys]);
+  // If rows is from BaseTxnIndexOpSearchBatch(), point lookups are taken from it.
+  static LookupRowResult BaseTxnIndexOpLookup(const BaseTxnIndexOpContext &ctx, int idx,
+                                              VHandle * const *rows = nullptr);
   static VHandle *BaseTxnIndexOpInsert(const BaseTxnIndexOpContext &ctx, int idx);
 };
 
@@ -9,6 +9,7 @@
 #include "txn.h"
 #include "contention_manager.h"
 #include "piece_cc.h"
+#include "util/types.h"
 
 namespace felis {
 
@@ -208,6 +209,12 @@ class Txn : public BaseTxn {
     template <typename T> T Read() {
       return ReadVarStr()->template ToType<T>();
     }
+    // Empty if the row was inserted later, or had been deleted.
+    template <typename T> util::Optional<T> ReadSnapshot() {
+      auto obj = ReadSnapshotVarStr();
+      if (obj == nullptr) return std::nullopt;
+      return obj->template ToType<T>();
+    }
     template <typename T> bool Write(const T &o) {
       return WriteVarStr(o.Encode());
     }
@@ -295,7 +302,7 @@ class Txn : public BaseTxn {
   void ResetRoot() override final { root = new PieceCollection(); }
 
   void PrepareState() override {
-    epoch = util::Instance<EpochManager>().current_epoch();
+    epoch = util::Instance<EpochManager>().epoch(epoch_nr());
     state = epoch->AllocateEpochObjectOnCurrentNode<TxnState>();
     // printf("state epoch %lu\n", state.nr());
   }
@@ -371,6 +378,27 @@ class Txn : public BaseTxn {
     return nodes_bitmap;
   }
 
+  template <typename IndexOp, typename Context, typename Completion>
+  static void RunIndexOp(const Context &ctx, Completion &completion) {
+    if constexpr (IndexOp::kBatched) {
+      VHandle *rows[TxnIndexOpContext::kMaxPackedKeys];
+      BaseTxnIndexOpSearchBatch(ctx, rows);
+      TxnIndexOpContext::ForEachWithBitmap(
+          ctx.keys_bitmap,
+          [&ctx, &completion, &rows](int j, int i) {
+            auto op = IndexOp(ctx, j, rows);
+            completion(i, op.result);
+          });
+    } else {
+      TxnIndexOpContext::ForEachWithBitmap(
+          ctx.keys_bitmap,
+          [&ctx, &completion](int j, int i) {
+            auto op = IndexOp(ctx, j);
+            completion(i, op.result);
+          });
+    }
+  }
+
   static constexpr uint64_t kIndexOpFlatten = std::numeric_limits<uint64_t>::max();
   uint64_t txn_indexop_affinity = kIndexOpFlatten;
 
@@ -403,12 +431,7 @@ class Txn : public BaseTxn {
               completion.handle = ctx.handle;
               completion.state = State(ctx.state);
 
-              TxnIndexOpContext::ForEachWithBitmap(
-                  ctx.keys_bitmap,
-                  [&ctx, &completion](int j, int i) {
-                    auto op = IndexOp(ctx, j);
-                    completion(i, op.result);
-                  });
+              RunIndexOp<IndexOp>(ctx, completion);
             },
             txn_indexop_affinity);
       } else {
@@ -420,12 +443,7 @@ class Txn : public BaseTxn {
         completion.handle = TxnHandle(op_ctx.handle);
         completion.state = State(op_ctx.state);
 
-        TxnIndexOpContext::ForEachWithBitmap(
-            op_ctx.keys_bitmap,
-            [&op_ctx, &completion](int j, int i) {
-              auto op = IndexOp(op_ctx, j);
-              completion(i, op.result);
-            });
+        RunIndexOp<IndexOp>(op_ctx, completion);
       }
     }
     return nodes_bitmap;
@@ -446,13 +464,16 @@ class Txn : public BaseTxn {
 
  public:
   struct TxnIndexLookupOpImpl {
+    // Point lookups are done together, see BaseTxnIndexOpSearchBatch().
+    static constexpr bool kBatched = true;
     using ResultType = LookupRowResult;
     LookupRowResult result;
-    TxnIndexLookupOpImpl(const BaseTxnIndexOpContext &ctx, int idx) {
-      result = BaseTxnIndexOpLookup(ctx, idx);
+    TxnIndexLookupOpImpl(const BaseTxnIndexOpContext &ctx, int idx, VHandle * const *rows = nullptr) {
+      result = BaseTxnIndexOpLookup(ctx, idx, rows);
     }
   };
   struct TxnIndexInsertOpImpl {
+    static constexpr bool kBatched = false;
     using ResultType = VHandle *;
     VHandle *result;
     TxnIndexInsertOpImpl(const BaseTxnIndexOpContext &ctx, int idx) {
@@ -486,6 +507,29 @@ class Txn : public BaseTxn {
   }
 };
 
+// A read-only txn that sees the database as of the beginning of its epoch,
+// the same cut the checkpoints take. All versions of earlier epochs are written
+// before the Execute phase, so ReadSnapshot() never waits. It writes nothing,
+// so it books no versions, and its pieces get no scheduling key: they go to
+// the unordered queue, where idle cores can steal them.
+//
+// The txn has to do its index lookups in Run(), and skip the rows with
+// ShouldScanSkip(index_handle.snapshot_id()). Everything must be read before
+// the Execute phase ends, because the GC of the next epoch collects the
+// versions it reads.
+//
+// Whether they run on the snapshot is up to the workload, like TPC-C's
+// -XTpccReadOnlySnapshot. If not, they are ordinary txns, which look up their
+// rows in Prepare() and are ordered by their serial id.
+template <typename TxnState>
+class SnapshotTxn : public Txn<TxnState> {
+ public:
+  using Txn<TxnState>::Txn;
+
+  bool is_snapshot() const override = 0;
+  void PrepareInsert() override {}
+};
+
 template <typename TxnState>
 class TxnStateCompletion {
  protected:
@@ -0,0 +1,84 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "txn_log.h"
+#include "log.h"
+
+namespace felis {
+
+TxnLog::TxnLog(const std::string &path)
+    : epoch_start(nullptr), nr_ep(0), rec_size(0)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  abort_if(fd < 0, "Cannot open txn log {}", path);
+
+  struct stat sb;
+  abort_if(fstat(fd, &sb) < 0, "Cannot stat txn log {}", path);
+  len = sb.st_size;
+  data = (uint8_t *) mmap(nullptr, len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+  close(fd);
+  abort_if(data == MAP_FAILED, "Cannot mmap txn log {}", path);
+  abort_if(len < sizeof(uint32_t), "Txn log {} is empty", path);
+
+  auto hdr = (const TxnLogHeader *) data;
+  legacy = len < sizeof(TxnLogHeader) || hdr->magic != TxnLogHeader::kMagic;
+  if (legacy) {
+    nr_records = *(const uint32_t *) data;
+    records = (char *) data + sizeof(uint32_t);
+    abort_if(nr_records == 0, "Txn log {} has no records", path);
+    logger->info("Legacy txn log {}, {} records", path, nr_records);
+    return;
+  }
+
+  abort_if(hdr->version != TxnLogHeader::kVersion,
+           "Txn log {} has version {}, but we only understand {}",
+           path, hdr->version, TxnLogHeader::kVersion);
+  abort_if(hdr->record_size == 0
+           || hdr->records_offset < sizeof(TxnLogHeader) || hdr->records_offset > len
+           || hdr->nr_records > (len - hdr->records_offset) / hdr->record_size,
+           "Txn log {} is truncated", path);
+  // The log is replayed round-robin, which needs at least one record.
+  abort_if(hdr->nr_records == 0, "Txn log {} has no records", path);
+  // The epoch table sits between the header and the records.
+  abort_if(hdr->nr_epochs > 0
+           && (uint64_t(hdr->nr_epochs) + 1) * sizeof(uint64_t) > hdr->records_offset - sizeof(TxnLogHeader),
+           "Txn log {} has an epoch table of {} epochs, which does not fit before the records",
+           path, hdr->nr_epochs);
+
+  rec_size = hdr->record_size;
+  nr_records = hdr->nr_records;
+  records = (char *) data + hdr->records_offset;
+  nr_ep = hdr->nr_epochs;
+  if (nr_ep > 0) {
+    epoch_start = (const uint64_t *) (data + sizeof(TxnLogHeader));
+    for (uint32_t i = 0; i < nr_ep; i++) {
+      abort_if(epoch_start[i] > epoch_start[i + 1],
+               "Txn log {} epoch table is not sorted at epoch {}", path, i + 1);
+    }
+    abort_if(epoch_start[nr_ep] > nr_records,
+             "Txn log {} epoch table points beyond {} records", path, nr_records);
+  }
+  logger->info("Txn log {}, {} records of {} bytes, {} epochs",
+               path, nr_records, rec_size, nr_ep);
+}
+
+TxnLog::~TxnLog()
+{
+  munmap(data, len);
+}
+
+void TxnLog::CheckRecordSize(size_t size)
+{
+  if (legacy) {
+    abort_if(sizeof(uint32_t) + nr_records * size > len,
+             "Legacy txn log is shorter than {} records of {} bytes", nr_records, size);
+    rec_size = size;
+    return;
+  }
+  abort_if(rec_size != size, "Txn log has {} bytes records, but the workload expects {}",
+           rec_size, size);
+}
+
+}
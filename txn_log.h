@@ -0,0 +1,70 @@
+// -*- mode: c++ -*-
+
+#ifndef TXN_LOG_H
+#define TXN_LOG_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+
+namespace felis {
+
+// The txn input log (-XLogFile). Version 1 of the format is
+//
+//   TxnLogHeader
+//   uint64_t epoch_start[nr_epochs + 1]  index of the first record of each epoch
+//   padding up to records_offset
+//   nr_records records, record_size bytes each
+//
+// Because records are fixed-size, any record can be located without parsing
+// the ones before it. A log without the magic is the legacy format: a
+// uint32_t count followed by the records.
+//
+// scripts/convert_txn_log.py converts legacy logs.
+struct TxnLogHeader {
+  static constexpr uint32_t kMagic = 0x4C585446; // "FTXL"
+  static constexpr uint32_t kVersion = 1;
+
+  uint32_t magic;
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t nr_epochs; // 0 if there is no epoch table
+  uint64_t nr_records;
+  uint64_t records_offset;
+} __attribute__((packed));
+
+static_assert(sizeof(TxnLogHeader) == 32);
+
+class TxnLog {
+  uint8_t *data;
+  size_t len;
+  bool legacy;
+  const uint64_t *epoch_start;
+  uint32_t nr_ep;
+  uint32_t rec_size; // 0 for legacy logs until CheckRecordSize()
+  char *records;
+  uint64_t nr_records;
+ public:
+  // mmap()s the whole log read-only.
+  TxnLog(const std::string &path);
+  ~TxnLog();
+  TxnLog(const TxnLog &rhs) = delete;
+
+  // Legacy logs don't tell us the record size, so the workload has to.
+  void CheckRecordSize(size_t size);
+
+  bool is_legacy() const { return legacy; }
+  uint64_t size() const { return nr_records; }
+  uint32_t record_size() const { return rec_size; }
+  char *record(uint64_t idx) const { return records + idx * rec_size; }
+
+  uint32_t nr_epochs() const { return nr_ep; }
+  // Records of epoch_nr (starting from 1) are [first, second).
+  std::pair<uint64_t, uint64_t> epoch_range(uint64_t epoch_nr) const {
+    return {epoch_start[epoch_nr - 1], epoch_start[epoch_nr]};
+  }
+};
+
+}
+
+#endif
@@ -2,6 +2,9 @@
 #define UTIL_LOWERBOUND_H
 
 #include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <immintrin.h>
 
 namespace util {
 
@@ -23,6 +26,94 @@ static inline uint64_t *FastLowerBound(uint64_t *start, uint64_t *end, uint64_t
   return start[ret] <= value ? start + ret + 1 : start + ret;
 }
 
+// Same as std::lower_bound() on sorted uint64_t arrays, like the version arrays
+// of SortedArrayVHandle.
+//
+// The SIMD versions binary search until the range is down to
+// kLowerBoundSIMDWindow elements, and then count the elements smaller than
+// value with vector compares. Since the array is sorted, the count is the
+// answer. LowerBound() picks the best one the CPU supports at startup.
+//
+// These are inline, not static, because g_lower_bound is one variable across
+// all translation units and has to point to the same function everywhere.
+
+inline constexpr size_t kLowerBoundSIMDWindow = 32;
+
+inline uint64_t *ScalarLowerBound(uint64_t *start, uint64_t *end, uint64_t value)
+{
+  return std::lower_bound(start, end, value);
+}
+
+inline uint64_t *LowerBoundNarrow(uint64_t *start, size_t &len, uint64_t value)
+{
+  while (len > kLowerBoundSIMDWindow) {
+    auto half = len / 2;
+    if (start[half] < value) {
+      start += half + 1;
+      len -= half + 1;
+    } else {
+      len = half;
+    }
+  }
+  return start;
+}
+
+__attribute__((target("avx2")))
+inline uint64_t *AVX2LowerBound(uint64_t *start, uint64_t *end, uint64_t value)
+{
+  size_t len = end - start;
+  start = LowerBoundNarrow(start, len, value);
+
+  // AVX2 only compares signed integers. Flipping the sign bit on both sides
+  // gives the unsigned order.
+  const auto sign = _mm256_set1_epi64x(0x8000000000000000ULL);
+  const auto v = _mm256_xor_si256(_mm256_set1_epi64x(value), sign);
+  size_t cnt = 0, i = 0;
+  for (; i + 4 <= len; i += 4) {
+    auto x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (start + i)), sign);
+    auto lt = _mm256_cmpgt_epi64(v, x);
+    cnt += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(lt)));
+  }
+  for (; i < len; i++) cnt += start[i] < value;
+  return start + cnt;
+}
+
+__attribute__((target("avx512f")))
+inline uint64_t *AVX512LowerBound(uint64_t *start, uint64_t *end, uint64_t value)
+{
+  size_t len = end - start;
+  start = LowerBoundNarrow(start, len, value);
+
+  const auto v = _mm512_set1_epi64(value);
+  size_t cnt = 0, i = 0;
+  for (; i + 8 <= len; i += 8) {
+    cnt += __builtin_popcount(_mm512_cmplt_epu64_mask(_mm512_loadu_si512(start + i), v));
+  }
+  if (i < len) {
+    __mmask8 tail = (1 << (len - i)) - 1;
+    auto x = _mm512_maskz_loadu_epi64(tail, start + i);
+    cnt += __builtin_popcount(_mm512_mask_cmplt_epu64_mask(tail, x, v));
+  }
+  return start + cnt;
+}
+
+using LowerBoundFunc = uint64_t *(*)(uint64_t *, uint64_t *, uint64_t);
+
+inline LowerBoundFunc SelectLowerBound()
+{
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return AVX512LowerBound;
+  if (__builtin_cpu_supports("avx2")) return AVX2LowerBound;
+  return ScalarLowerBound;
+}
+
+inline const LowerBoundFunc g_lower_bound = SelectLowerBound();
+
+inline uint64_t *LowerBound(uint64_t *start, uint64_t *end, uint64_t value)
+{
+  return g_lower_bound(start, end, value);
+}
+
 }
 
 #endif
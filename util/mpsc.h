@@ -0,0 +1,79 @@
+#ifndef UTIL_MPSC_H
+#define UTIL_MPSC_H
+
+#include <atomic>
+#include <cstddef>
+#include <immintrin.h>
+
+namespace util {
+
+// Bounded ring of pointers, with many producers and one consumer.
+//
+// Producers reserve a range of positions with one fetch_add on the end, then
+// publish every slot by storing a non-null pointer into it. They never wait on
+// each other, only on the consumer if the ring is full. A reserved slot which
+// is not yet published reads nullptr. The consumer clears the slots it has
+// consumed before it moves the start forward, so that they can be reused.
+//
+// The slot array lives outside, so that callers can place it on the right NUMA
+// node. It must be zero-filled.
+template <typename T>
+class MPSCRing {
+  std::atomic<T *> *slots;
+  size_t capacity;
+ public:
+  std::atomic_ulong end; // reserved by the producers
+  std::atomic_ulong start; // consumed
+
+  static size_t MemorySize(size_t capacity) { return capacity * sizeof(std::atomic<T *>); }
+
+  void Initialize(void *p, size_t cap) {
+    slots = (std::atomic<T *> *) p;
+    capacity = cap;
+    end = start = 0;
+  }
+  size_t max_size() const { return capacity; }
+  std::atomic<T *> &slot(unsigned long pos) { return slots[pos % capacity]; }
+
+  // Producer side.
+  unsigned long Reserve(size_t n) {
+    return end.fetch_add(n, std::memory_order_relaxed);
+  }
+  void WaitForSpace(unsigned long pos, size_t n) {
+    while (pos + n > start.load(std::memory_order_acquire) + capacity)
+      _mm_pause();
+  }
+  void Publish(unsigned long pos, T *p) {
+    slot(pos).store(p, std::memory_order_release);
+  }
+
+  // Consumer side. nullptr if pos is reserved but not published yet.
+  T *Load(unsigned long pos) {
+    return slot(pos).load(std::memory_order_acquire);
+  }
+  // The producer of a reserved slot is at most a few instructions away from
+  // publishing it, unless it waits for space. Only use this when the ring
+  // cannot be full.
+  T *WaitForSlot(unsigned long pos) {
+    T *p;
+    while ((p = slot(pos).load(std::memory_order_acquire)) == nullptr)
+      _mm_pause();
+    return p;
+  }
+  void Consume(unsigned long pos) {
+    slot(pos).store(nullptr, std::memory_order_relaxed);
+  }
+  void Advance(unsigned long new_start) {
+    start.store(new_start, std::memory_order_release);
+  }
+
+  // Only when nobody is using it. All reserved slots must have been consumed.
+  void Reset() {
+    end.store(0);
+    start.store(0);
+  }
+};
+
+}
+
+#endif
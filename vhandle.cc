@@ -40,7 +40,7 @@ SortedArrayVHandle::SortedArrayVHandle()
   cont_affinity = -1;
 
   // versions = (uint64_t *) mem::GetDataRegion().Alloc(2 * capacity * sizeof(uint64_t));
-  versions = (uint64_t *) ((uint8_t *) this + 64);
+  versions = (uint64_t *) ((uint8_t *) this + kInlineVersionsOffset);
   latest_version.store(-1);
 }
 
@@ -49,7 +49,9 @@ bool SortedArrayVHandle::ShouldScanSkip(uint64_t sid)
   auto epoch_of_txn = sid >> 32;
   util::MCSSpinLock::QNode qnode;
   lock.Acquire(&qnode);
-  bool skip = (first_version() >= sid);
+  // No versions yet, if a pipelined epoch inserted the row and deferred its
+  // appends.
+  bool skip = size == 0 || first_version() >= sid;
   lock.Release(&qnode);
   return skip;
 }
@@ -69,11 +71,50 @@ static uint64_t *EnlargePair64Array(SortedArrayVHandle *row,
   std::copy(old_p, old_p + old_cap, new_p);
   // memcpy((uint8_t *) new_p + new_len, (uint8_t *) old_p + old_len, old_cap * sizeof(uint64_t));
   std::copy(old_p + old_cap, old_p + 2 * old_cap, new_p + new_cap);
-  if ((uint8_t *) old_p - (uint8_t *) row != 64)
+  if ((uint8_t *) old_p - (uint8_t *) row != SortedArrayVHandle::kInlineVersionsOffset)
     mem::GetDataRegion().Free(old_p, old_regionid, 2 * old_len);
+  else
+    *old_p = old_cap; // For ShrinkVersionsNoLock(), nothing else uses the inline area now.
   return new_p;
 }
 
+// After GC has dropped some versions. Moves the versions back to the inline
+// area if they fit, or to a smaller array if they use less than a quarter of
+// this one. Half of the new array is left free, so that a row doesn't shrink and
+// grow back every epoch.
+void SortedArrayVHandle::ShrinkVersionsNoLock()
+{
+  auto inline_p = (uint64_t *) ((uint8_t *) this + kInlineVersionsOffset);
+  if (versions == inline_p)
+    return;
+
+  auto inline_cap = (unsigned int) *inline_p;
+  auto new_cap = 0U;
+  auto new_p = inline_p;
+  if (size <= inline_cap) {
+    new_cap = inline_cap;
+  } else if (capacity > 8 && size * 4 <= capacity) {
+    new_cap = std::max(8U, 1U << (32 - __builtin_clz(2 * size - 1)));
+    new_p = (uint64_t *) mem::GetDataRegion().Alloc(2 * new_cap * sizeof(uint64_t));
+    if (!new_p) return;
+  } else {
+    return;
+  }
+
+  std::copy(versions, versions + size, new_p);
+  std::copy(versions + capacity, versions + capacity + size, new_p + new_cap);
+
+  auto &region = mem::GetDataRegion();
+  auto old_len = 2 * capacity * sizeof(uint64_t);
+  region.Free(versions, alloc_by_regionid, old_len);
+  region.AddShrunkBytes(old_len, new_p == inline_p ? old_len : old_len - 2 * new_cap * sizeof(uint64_t));
+
+  versions = new_p;
+  capacity = new_cap;
+  if (new_p != inline_p)
+    alloc_by_regionid = mem::ParallelPool::CurrentAffinity();
+}
+
 std::string SortedArrayVHandle::ToString() const
 {
   fmt::memory_buffer buf;
@@ -138,6 +179,8 @@ void SortedArrayVHandle::IncreaseSize(int delta, uint64_t epoch_nr)
     }
 
     latest = latest_version.load();
+    // The GC might have shrunk the array.
+    objects = versions + capacity;
 
     if (!garbage_left && latest >= 0
         && GC::IsDataGarbage((VHandle *) this, (VarStr *) objects[latest]))
@@ -180,9 +223,9 @@ unsigned int SortedArrayVHandle::AbsorbNewVersionNoLock(unsigned int end, unsign
   unsigned int mark = (end - 1) & ~(0x03FF);
   // int i = std::lower_bound(versions + mark, versions + end, last) - versions;
 
-  int i = util::FastLowerBound(versions + mark, versions + end, last) - versions;
+  int i = util::LowerBound(versions + mark, versions + end, last) - versions;
   if (i == mark)
-    i = std::lower_bound(versions, versions + mark, last) - versions;
+    i = util::LowerBound(versions, versions + mark, last) - versions;
 
   std::move(versions + i, versions + end, versions + i + 1 + extra_shift);
   probes::VHandleAbsorb{this, (int) end - i}();
@@ -258,7 +301,7 @@ volatile uintptr_t *SortedArrayVHandle::WithVersion(uint64_t sid, int &pos)
     }
   }
 
-  p = std::lower_bound(start, end, sid);
+  p = util::LowerBound(start, end, sid);
   if (p == versions) {
     logger->critical("ReadWithVersion() {} cannot found for sid {} start is {} begin is {}",
                      (void *) this, sid, *start, *versions);
@@ -308,6 +351,26 @@ VarStr *SortedArrayVHandle::ReadExactVersion(unsigned int version_idx)
   return (VarStr *) *addr;
 }
 
+// For readers that must not wait through sync(), like checkpoints, which don't
+// run on the go schedulers, and snapshot txns. All versions before sid must
+// have been written already.
+bool SortedArrayVHandle::ReadStableVersion(uint64_t sid, VarStr **obj)
+{
+  util::MCSSpinLock::QNode qnode;
+  lock.Acquire(&qnode);
+  bool found = size > 0 && first_version() < sid;
+  if (found) {
+    auto pos = util::LowerBound(versions, versions + size, sid) - versions - 1;
+    auto val = versions[capacity + pos];
+    abort_if((val >> 32) == (kPendingValue >> 32),
+             "ReadStableVersion() {} sid {} version {} is not written yet",
+             (void *) this, sid, versions[pos]);
+    *obj = (VarStr *) val;
+  }
+  lock.Release(&qnode);
+  return found;
+}
+
 bool SortedArrayVHandle::WriteWithVersion(uint64_t sid, VarStr *obj, uint64_t epoch_nr)
 {
   if (inline_used != 0xFF) __builtin_prefetch((uint8_t *) this + 128);
@@ -315,7 +378,7 @@ bool SortedArrayVHandle::WriteWithVersion(uint64_t sid, VarStr *obj, uint64_t ep
   int pos = latest_version.load();
   uint64_t *it = versions + pos + 1;
   if (*it != sid) {
-    it = std::lower_bound(versions + cur_start, versions + size, sid);
+    it = util::LowerBound(versions + cur_start, versions + size, sid);
     if (unlikely(it == versions + size || *it != sid)) {
       // sid is greater than all the versions, or the located lower_bound isn't sid version
       logger->critical("Diverging outcomes on {}! sid {} pos {}/{}", (void *) this,
@@ -76,6 +76,14 @@ class SortedArrayVHandle : public BaseVHandle {
   std::atomic<uint64_t> gc_handle = 0;
 
   SortedArrayVHandle();
+
+  // The version array starts inline, in the second cache line of the row, and
+  // only moves out of line when it's full. Indexes that keep their own data at
+  // the end of that line, like the HashEntry of HashtableIndex, limit how many
+  // versions fit.
+  void LimitInlineVersions(size_t end) {
+    capacity = (end - kInlineVersionsOffset) / (2 * sizeof(uint64_t));
+  }
  public:
 
   static void operator delete(void *ptr) {
@@ -86,6 +94,8 @@ class SortedArrayVHandle : public BaseVHandle {
       pool.Free(ptr, phandle->this_coreid);
   }
 
+  static constexpr size_t kInlineVersionsOffset = 64;
+
   static SortedArrayVHandle *New();
   static SortedArrayVHandle *NewInline();
 
@@ -93,6 +103,7 @@ class SortedArrayVHandle : public BaseVHandle {
   void AppendNewVersion(uint64_t sid, uint64_t epoch_nr, int ondemand_split_weight = 0);
   VarStr *ReadWithVersion(uint64_t sid);
   VarStr *ReadExactVersion(unsigned int version_idx);
+  bool ReadStableVersion(uint64_t sid, VarStr **obj);
   bool WriteWithVersion(uint64_t sid, VarStr *obj, uint64_t epoch_nr);
   bool WriteExactVersion(unsigned int version_idx, VarStr *obj, uint64_t epoch_nr);
   void Prefetch() const { __builtin_prefetch(versions); }
@@ -145,6 +156,7 @@ class SortedArrayVHandle : public BaseVHandle {
     versions[pos] = sid;
   }
   void IncreaseSize(int delta, uint64_t epoch_nr);
+  void ShrinkVersionsNoLock();
   volatile uintptr_t *WithVersion(uint64_t sid, int &pos);
 };
 
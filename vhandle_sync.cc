@@ -3,6 +3,7 @@
 #include <syscall.h>
 #include "vhandle.h"
 #include "vhandle_sync.h"
+#include "tracer.h"
 
 namespace felis {
 
@@ -79,6 +80,7 @@ void SpinnerSlot::WaitForData(volatile uintptr_t *addr, uint64_t sid, uint64_t v
   int core = go::Scheduler::CurrentThreadPoolId() - 1;
   uint64_t mask = 1ULL << core;
   ulong wait_cnt = 2;
+  Tracer::Record(core, Tracer::WaitBegin, ver);
 
   while (true) {
     uintptr_t val = oldval;
@@ -90,6 +92,7 @@ void SpinnerSlot::WaitForData(volatile uintptr_t *addr, uint64_t sid, uint64_t v
     }
     if (!IsPendingVal(oldval)) {
       slot(core)->wait_cnt += wait_cnt;
+      Tracer::Record(core, Tracer::WaitEnd, ver);
       return;
     }
   }
@@ -191,6 +194,10 @@ void SimpleSync::WaitForData(volatile uintptr_t *addr, uint64_t sid, uint64_t ve
   auto &dispatch = util::Impl<PromiseRoutineDispatchService>();
   auto routine = sched->current_routine();
 
+  bool waited = IsPendingVal(*addr);
+  if (waited)
+    Tracer::Record(core_id, Tracer::WaitBegin, ver);
+
   while (IsPendingVal(*addr)) {
     wait_cnt++;
     if (unlikely((wait_cnt & 0x7FFFFFF) == 0)) {
@@ -214,6 +221,8 @@ void SimpleSync::WaitForData(volatile uintptr_t *addr, uint64_t sid, uint64_t ve
       break;
     _mm_pause();
   }
+  if (waited)
+    Tracer::Record(core_id, Tracer::WaitEnd, ver);
   auto d = std::div(core_id, mem::kNrCorePerNode);
   buffer[64 * d.quot + d.rem].wait_cnt += wait_cnt;
 }